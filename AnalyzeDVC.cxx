@@ -23,10 +23,20 @@
 #define ANALYZEDVC_H
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "DICMesh.cxx"
+#include "MetaImageMapper.cxx"
+#include "SliceStackReader.cxx"
 #include "itkImageFileReader.h"
 #include "itkLinearInterpolateImageFunction.h"
 #include "itkBSplineInterpolateImageFunction.h"
+#include <vtkXMLUnstructuredGridReader.h>
+#include <vtkXMLPUnstructuredGridReader.h>
 
 // the following provides updates for the RegularStep optimizer
 class CommandIterationUpdate : public itk::Command
@@ -102,6 +112,7 @@ typedef TMovingImage			MovingImageType;
 AnalyzeDVC()
 {
 	this->GetRegistrationMethod()->SetNumberOfThreads( 2 );	// default to 2 threads
+	this->SetNumberOfThreads( 2 );							// default to 2 threads for the mesh filters
 	m_configFileName.clear(); 							// must be set by user
 	
 	m_GlobalMaxStep = 0.010;						// must be set by user
@@ -111,39 +122,80 @@ AnalyzeDVC()
 	m_InitialDVCMinStep = 0.0005;					// must be set by user
 	m_SecondaryDVCMaxStep = 0;						// must be set by user
 	m_SecondaryDVCMinStep = 0;						// must be set by user
+	m_CoarseIRRadius = 0;							// default to twice the interrogation region radius
+	m_CoarseDVCMaxStep = 0;							// default to the initial DVC step
+	m_CoarseDVCMinStep = 0;							// default to the initial DVC step
 	//~ m_TertiaryDVCMaxStep = 0;						// must be set by user
 	//~ m_TertiaryDVCMinStep = 0;						// must be set by user
 	
 	m_IdispErrorToll = 2;							// default to 2 stdev
 	m_IdispReplaceSigma = 0.5;						// must be set by user
 	m_IdispReplaceMean = 0;							// must be set by user
+	m_IdispReplaceMaxSweeps = 1;					// default to a single replacement sweep
+	m_IdispMedian = 0;							// default to no median filter
 	m_IdispSmoothSigma = 0.1;						// must be set by user
 	m_IdispSmoothMean = 0;							// must be set by user
 	m_IstrainErrorToll = 1;							// default to 1 stdev
 	m_IstrainReplaceSigma = 0;						// must be set by user
 	m_IstrainReplaceMean = 0;						// must be set by user
+	m_IstrainReplaceMaxSweeps = 1;					// default to a single replacement sweep
+	m_IstrainMedian = 0;						// default to no median filter
 	m_IstrainSmoothSigma = 0;						// must be set by user
 	m_IstrainSmoothMean = 0;							// must be set by user
 
 	m_SdispErrorToll = 2;							// default to 2 stdev
 	m_SdispReplaceSigma = 0;						// must be set by user
 	m_SdispReplaceMean = 0;							// must be set by user
+	m_SdispReplaceMaxSweeps = 1;					// default to a single replacement sweep
+	m_SdispMedian = 0;							// default to no median filter
 	m_SdispSmoothSigma = 0;							// must be set by user
 	m_SdispSmoothMean = 0;							// must be set by user
 	m_SstrainErrorToll = 1;							// default to 1 stdev
 	m_SstrainReplaceSigma = 4;						// must be set by user
 	m_SstrainReplaceMean = 0;						// must be set by user
+	m_SstrainReplaceMaxSweeps = 1;					// default to a single replacement sweep
+	m_SstrainMedian = 0;						// default to no median filter
 	m_SstrainSmoothSigma = 2;						// must be set by user
 	m_SstrainSmoothMean = 0;						// must be set by user
 		
 	m_SecondaryDVC = 0;								// default to forgo secondary DVC
+	
+	m_RefinementLevels = 0;							// default to forgo the adaptive refinement
+	m_RefinementFraction = 0.05;					// default to refine 5% of the cells per level
+	m_RefinementMaxPoints = 0;						// default to no limit on the new points
+	
+	m_MLSStrain = 0;								// default to the strains from the mesh cells
+	m_MLSNeighbours = 20;							// default to the 20 nearest neighbours
+	m_MLSRadius = 0;								// default to use the nearest neighbours
+	m_MLSOrder = 1;									// default to a linear fit
 	//~ m_TertiaryDVC = 0;								// default to forgo tertiary DVC
 	
 	m_RestartFile = 0;								// default to not use the restart methods
 	
 	m_fixedFileName.clear();						// must be set by user
 	m_movingFileName.clear();						// must be set by user
+	m_MapImages = 1;								// default to map the MetaImage files
+	m_SliceRange[0] = 0;							// default to every slice from 0 until one is missing
+	m_SliceRange[1] = -1;
+	m_SliceSpacing[0] = m_SliceSpacing[1] = m_SliceSpacing[2] = 1;	// default to unit voxels
+	m_RawSliceSize[0] = m_RawSliceSize[1] = 0;		// must be set by user for raw slices
+	m_CropMargin = -1;								// default to keep the whole images
+	m_HasCropMeshBounds = false;					// set once the mesh is read, see ReadInputFiles
+	m_CacheDirectory.clear();						// default to forgo the cache
+	m_CacheSize = 10;								// default to a 10 GB cache
+	this->SetCacheSizeLimit( m_CacheSize*1e9 );
 	m_meshFileName.clear();							// must be set by user
+	m_GridSpacing = 0;								// default to read the mesh file
+	m_coarseMeshFileName.clear();					// default to forgo the coarse DVC
+	m_restartResultFileName.clear();				// default to start from the global registration
+	m_restartStage.clear();							// default to the last result stage of a dvcr restart
+	m_OutputFormat = "vtk";							// default to legacy ASCII vtk results
+	m_OutputCompression = 1;						// default to the fastest compression
+	m_OutputPieces = 0;								// default to one piece per thread
+	m_initialDVCArrays = "all";						// default to write every array
+	m_postInitialDVCArrays = "all";
+	m_secondaryDVCArrays = "all";
+	m_postSecondaryDVCArrays = "all";
 	m_outputDirectory.clear();						// must be set by user
 	
 	m_observer = CommandIterationUpdate::New();
@@ -165,14 +217,49 @@ void SetConfigurationFile(std::string fileName )
   * Lines starting with '#' are comments."
   * Values shown below in () are defaults.
 
-# Fixed image file name
+# Fixed image file name, or a printf pattern with the slice number (e.g. fixed_%04d.tif) for a series of TIFF or raw slices
 FIXEDIMAGEFILE=string (0)
-# Moving image file name
+# Moving image file name, or a slice series pattern as for the fixed image
 MOVINGIMAGEFILE=string (0)
+# Map uncompressed MetaImage files instead of reading them, 0: read, 1: map, 2: map with transparent huge pages
+MAPIMAGES=int (1)
+# First and last slice numbers of slice series, a last number below the first reads until a slice is missing
+SLICERANGE=int int (0 -1)
+# Voxel spacing of slice series
+SLICESPACING=double double double (1 1 1)
+# Width and height of raw slices, which are in the pixel type and byte order of the machine with no header
+RAWSLICESIZE=int int (0 0)
+# Displacement margin kept around the mesh, beyond the fixed interrogation regions, when the images are cropped after
+# loading (slice series are only read there), it must cover the displacements, -1 to keep every voxel
+CROPMARGIN=double (-1)
+# Directory shared by runs to keep the resampled images and global registration results in, found again by the image content
+CACHEDIRECTORY=string (0)
+# Size in GB the cache directory is kept to by deleting the least recently used files
+CACHESIZE=double (10)
 # Mesh image (gmsh or vtk) file name
 MESHFILENAME=string (0)
+# Node spacing of a structured grid over the fixed image, used instead of the mesh file if not 0
+GRIDSPACING=double (0)
+# Result (vtk, vtu, pvtu or dvcr) of a previous analysis on another mesh, its displacements are interpolated onto the mesh to restart the analysis
+RESTARTRESULTFILE=string (0)
+# Stage of a dvcr restart result, e.g. PostProcessedInitialDVC, 0 for the last result stage written (not debug)
+RESTARTSTAGE=string (0)
 # Output folder
 OUTPUTFOLDER=string (0)
+# Format of the result files, vtk: legacy ASCII, vtu: binary VTK XML, pvtu: binary VTK XML in pieces written in parallel,
+# dvcr: every result in one indexed binary container, Results.dvcr, that keeps the mesh once
+OUTPUTFORMAT=string (vtk)
+# zlib compression level of the vtu and pvtu result files, 0: none to 9: smallest
+OUTPUTCOMPRESSION=int (1)
+# Number of pieces of the pvtu result files, 0: one per thread
+OUTPUTPIECES=int (0)
+# Arrays written to the initial (and refined), post processed initial, secondary and post processed secondary DVC results,
+# a comma separated list of array names or name beginnings, optionally prefixed with point: or cell:, all for every array
+# and float to write the arrays in single precision, e.g. point:Displacement,float
+INITIALDVCARRAYS=string (all)
+POSTINITIALDVCARRAYS=string (all)
+SECONDARYDVCARRAYS=string (all)
+POSTSECONDARYDVCARRAYS=string (all)
 # Interrogation region radius
 IRRADIUS=int (0)
 # Number of threads
@@ -186,15 +273,40 @@ INITIALDVCMINSTEP=double (0.0005)
 # Max/Min step length for second DVC (if executing)
 SECONDARYDVCMAXSTEP=double (0)
 SECONDARYDVCMINSTEP=double (0)
+# Coarse mesh (gmsh or vtk) file name, registered before the initial DVC to give the initial displacements
+COARSEMESHFILENAME=string (0)
+# Interrogation region radius for the coarse DVC, 0 for twice IRRADIUS
+COARSEIRRADIUS=int (0)
+# Max/Min step length for the coarse DVC, 0 for the initial DVC values
+COARSEDVCMAXSTEP=double (0)
+COARSEDVCMINSTEP=double (0)
+# Number of adaptive refinement levels after the initial DVC, 0 for no refinement
+REFINEMENTLEVELS=int (0)
+# Fraction of the cells with the most bad points and strain variation refined at every level
+REFINEMENTFRACTION=double (0.05)
+# Maximum number of points added by the refinement, 0 for no limit
+REFINEMENTMAXPOINTS=int (0)
 # Flag to perform second DVC
 PERFORMSECONDARYDVC=bool (0)
+# Flag to calculate the strains by a moving least squares fit to the neighbours of each node instead of from the mesh cells
+MLSSTRAIN=bool (0)
+# Number of nearest neighbours in the fit, used if the radius is 0
+MLSNEIGHBOURS=int (20)
+# Radius of the neighbours in the fit
+MLSRADIUS=double (0)
+# Order of the fit, 1: linear, 2: quadratic
+MLSORDER=int (1)
 # Error detection and handeling after initial DVC
 # Displacement error tollerance in stdev from neighbourhood mean
 IDISPLACEMENTERRORTOLLERANCE=double (2)
 # Displacement Replacement
 IDISPREPLACESIGMA=double (0.5)
 IDISPREPLACEMEAN=double (0)
+# Maximum number of replacement sweeps (at least 1), points near replaced points are retested each sweep
+IDISPREPLACEMAXSWEEPS=int (1)
 # Displcement Smoothing
+# Median filter before smoothing, 0: none, 1: median of each component, 2: value with the median magnitude
+IDISPLACEMEDIAN=int (0)
 IDISPLACESMOOTHSIGMA=double (0.1)
 IDISPLACESMOOTHMEAN=double (0)
 # Strain error tolleranc in stdev from neighbourhood mean
@@ -202,7 +314,9 @@ ISTRAINERRORTOLLERANCE=double (1)
 # Strain Replacement
 ISTRAINREPLACESIGMA=double (0)
 ISTRAINREPLACEMEAN=double (0)
+ISTRAINREPLACEMAXSWEEPS=int (1)
 #Strain smoothing
+ISTRAINMEDIAN=int (0)
 ISTRAINSMOOTHSIGMA=double (0)
 ISTRAINSMOOTHMEAN=double (0)
 # Error detection and handelling after secondary DVC
@@ -211,7 +325,9 @@ SDISPLACEMENTERRORTOLLERANCE=double (2)
 # Displacement Replacement
 SDISPREPLACESIGMA=double (0)
 SDISPREPLACEMEAN=double (0)
+SDISPREPLACEMAXSWEEPS=int (1)
 # Displcement Smoothing
+SDISPLACEMEDIAN=int (0)
 SDISPLACESMOOTHSIGMA=double (0)
 SDISPLACESMOOTHMEAN=double (0)
 # Strain error tolleranc in stdev from neighbourhood mean
@@ -219,7 +335,9 @@ SSTRAINERRORTOLLERANCE=double (1)
 # Strain Replacement
 SSTRAINREPLACESIGMA=double (4)
 SSTRAINREPLACEMEAN=double (0)
+SSTRAINREPLACEMAXSWEEPS=int (1)
 # Strain smoothing
+SSTRAINMEDIAN=int (0)
 SSTRAINSMOOTHSIGMA=double (2)
 SSTRAINSMOOTHMEAN=double (0)
 * 
@@ -268,6 +386,60 @@ bool ReadConfigureationFile()
 			this->m_movingFileName = value;
 			continue;
 		}
+		// if map images
+		key = "MAPIMAGES";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_MapImages = atoi( value.c_str() );
+			continue;
+		}
+		// if slice range
+		key = "SLICERANGE";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			std::stringstream values( value );
+			values >> this->m_SliceRange[0] >> this->m_SliceRange[1];
+			continue;
+		}
+		// if slice spacing
+		key = "SLICESPACING";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			std::stringstream values( value );
+			values >> this->m_SliceSpacing[0] >> this->m_SliceSpacing[1] >> this->m_SliceSpacing[2];
+			continue;
+		}
+		// if raw slice size
+		key = "RAWSLICESIZE";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			std::stringstream values( value );
+			values >> this->m_RawSliceSize[0] >> this->m_RawSliceSize[1];
+			continue;
+		}
+		// if crop margin
+		key = "CROPMARGIN";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_CropMargin = atof( value.c_str() );
+			continue;
+		}
+		// if cache directory
+		key = "CACHEDIRECTORY";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_CacheDirectory = value;
+			this->SetCacheDirectory( this->m_CacheDirectory );
+			continue;
+		}
+		// if cache size
+		key = "CACHESIZE";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_CacheSize = atof( value.c_str() );
+			this->SetCacheSizeLimit( this->m_CacheSize*1e9 );
+			continue;
+		}
 		// if mesh file name
 		key = "MESHFILENAME";
 		if ( !cLine.compare(0,key.size(),key) ){
@@ -275,6 +447,28 @@ bool ReadConfigureationFile()
 			this->m_meshFileName = value;
 			continue;
 		}
+		// if structured grid spacing
+		key = "GRIDSPACING";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_GridSpacing = atof( value.c_str() );
+			continue;
+		}
+		// if restart result file name
+		key = "RESTARTRESULTFILE";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_restartResultFileName = value;
+			continue;
+		}
+		// if restart stage
+		key = "RESTARTSTAGE";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_restartStage = value;
+			if ( value == "0" ) this->m_restartStage.clear(); // the last result stage
+			continue;
+		}
 		// if output folder
 		key = "OUTPUTFOLDER";
 		if ( !cLine.compare(0,key.size(),key) ){
@@ -286,6 +480,68 @@ bool ReadConfigureationFile()
 			continue;
 		}
 		
+		// if output format
+		key = "OUTPUTFORMAT";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_OutputFormat = value;
+			if ( value.compare( "vtk" ) && value.compare( "vtu" ) && value.compare( "pvtu" ) && value.compare( "dvcr" ) ){
+				std::cout<<"Unknown output format "<<value<<", use vtk, vtu, pvtu or dvcr."<<std::endl;
+				return 1;
+			}
+			this->SetOutputFormat( value );
+			continue;
+		}
+		// if output compression
+		key = "OUTPUTCOMPRESSION";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_OutputCompression = atoi( value.c_str() );
+			this->SetOutputCompressionLevel( this->m_OutputCompression );
+			continue;
+		}
+		// if output pieces
+		key = "OUTPUTPIECES";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_OutputPieces = atoi( value.c_str() );
+			this->SetNumberOfOutputPieces( this->m_OutputPieces );
+			continue;
+		}
+		// if initial DVC result arrays
+		key = "INITIALDVCARRAYS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_initialDVCArrays = value;
+			this->SetResultArrays( "InitialDVC", value );
+			this->SetResultArrays( "RefinedDVC", value );
+			continue;
+		}
+		// if post processed initial DVC result arrays
+		key = "POSTINITIALDVCARRAYS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_postInitialDVCArrays = value;
+			this->SetResultArrays( "PostProcessedInitialDVC", value );
+			continue;
+		}
+		// if secondary DVC result arrays
+		key = "SECONDARYDVCARRAYS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_secondaryDVCArrays = value;
+			this->SetResultArrays( "SecondDVC", value );
+			continue;
+		}
+		// if post processed secondary DVC result arrays
+		key = "POSTSECONDARYDVCARRAYS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_postSecondaryDVCArrays = value;
+			this->SetResultArrays( "PostProcessedSecondDVC", value );
+			continue;
+		}
+		
 		// if IR radius
 		key = "IRRADIUS";
 		if ( !cLine.compare(0,key.size(),key) ){
@@ -298,6 +554,7 @@ bool ReadConfigureationFile()
 		if ( !cLine.compare(0,key.size(),key) ){
 			value.assign(cLine,key.size()+1,511);
 			this->GetRegistrationMethod()->SetNumberOfThreads( atoi( value.c_str()) );
+			this->SetNumberOfThreads( atoi( value.c_str()) );
 			continue;
 		}
 		
@@ -346,6 +603,57 @@ bool ReadConfigureationFile()
 			continue;
 		}
 		
+		// if refinement levels
+		key = "REFINEMENTLEVELS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_RefinementLevels = atoi( value.c_str() );
+			continue;
+		}
+		// if refinement fraction
+		key = "REFINEMENTFRACTION";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_RefinementFraction = atof( value.c_str() );
+			continue;
+		}
+		// if refinement maximum points
+		key = "REFINEMENTMAXPOINTS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_RefinementMaxPoints = atoi( value.c_str() );
+			continue;
+		}
+		
+		// if coarse mesh file name
+		key = "COARSEMESHFILENAME";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_coarseMeshFileName = value;
+			continue;
+		}
+		// if coarse IR radius
+		key = "COARSEIRRADIUS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_CoarseIRRadius = atoi( value.c_str() );
+			continue;
+		}
+		// if coarse max step size
+		key = "COARSEDVCMAXSTEP";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_CoarseDVCMaxStep = atof( value.c_str() );
+			continue;
+		}
+		// if coarse min step size
+		key = "COARSEDVCMINSTEP";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_CoarseDVCMinStep = atof( value.c_str() );
+			continue;
+		}
+		
 		//~ // if tertiary max step size
 		//~ key = "TERTIARYDVCMAXSTEP";
 		//~ if ( !cLine.compare(0,key.size(),key) ){
@@ -368,6 +676,38 @@ bool ReadConfigureationFile()
 			this->m_SecondaryDVC = atoi( value.c_str() );
 			continue;
 		}
+		// if moving least squares strain flag
+		key = "MLSSTRAIN";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_MLSStrain = atoi( value.c_str() );
+			continue;
+		}
+		// if moving least squares neighbours
+		key = "MLSNEIGHBOURS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_MLSNeighbours = atoi( value.c_str() );
+			continue;
+		}
+		// if moving least squares radius
+		key = "MLSRADIUS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_MLSRadius = atof( value.c_str() );
+			continue;
+		}
+		// if moving least squares order
+		key = "MLSORDER";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_MLSOrder = atoi( value.c_str() );
+			if ( this->m_MLSOrder != 1 && this->m_MLSOrder != 2 ){
+				std::cout<<"Unknown moving least squares order "<<value<<", use 1 or 2."<<std::endl;
+				return 1;
+			}
+			continue;
+		}
 		//~ // if tertiary flag
 		//~ key = "PERFORMTERTIARTYDVC";
 		//~ if ( !cLine.compare(0,key.size(),key) ){
@@ -397,7 +737,29 @@ bool ReadConfigureationFile()
 			this->m_IdispReplaceMean = atof( value.c_str() );
 			continue;
 		}
+		// if after initial displacement replace max sweeps
+		key = "IDISPREPLACEMAXSWEEPS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			if ( atoi( value.c_str() ) < 1 ){
+				std::cout<<"The number of replacement sweeps "<<value<<" must be at least 1."<<std::endl;
+				return 1;
+			}
+			this->m_IdispReplaceMaxSweeps = atoi( value.c_str() );
+			continue;
+		}
 		
+		// if after initial displacement median filter
+		key = "IDISPLACEMEDIAN";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_IdispMedian = atoi( value.c_str() );
+			if ( this->m_IdispMedian > 2 ){
+				std::cout<<"Unknown median mode "<<value<<", use 0, 1 or 2."<<std::endl;
+				return 1;
+			}
+			continue;
+		}
 		// if after initial displacement smooth sigma
 		key = "IDISPLACESMOOTHSIGMA";
 		if ( !cLine.compare(0,key.size(),key) ){
@@ -434,7 +796,29 @@ bool ReadConfigureationFile()
 			this->m_IstrainReplaceMean = atof( value.c_str() );
 			continue;
 		}
-		// if after initil strain smooth sigma
+		// if after initial strain replace max sweeps
+		key = "ISTRAINREPLACEMAXSWEEPS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			if ( atoi( value.c_str() ) < 1 ){
+				std::cout<<"The number of replacement sweeps "<<value<<" must be at least 1."<<std::endl;
+				return 1;
+			}
+			this->m_IstrainReplaceMaxSweeps = atoi( value.c_str() );
+			continue;
+		}
+		// if after initial strain median filter
+		key = "ISTRAINMEDIAN";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_IstrainMedian = atoi( value.c_str() );
+			if ( this->m_IstrainMedian > 2 ){
+				std::cout<<"Unknown median mode "<<value<<", use 0, 1 or 2."<<std::endl;
+				return 1;
+			}
+			continue;
+		}
+		// if after initial strain smooth sigma
 		key = "ISTRAINSMOOTHSIGMA";
 		if ( !cLine.compare(0,key.size(),key) ){
 			value.assign(cLine,key.size()+1,511);
@@ -471,6 +855,28 @@ bool ReadConfigureationFile()
 			this->m_SdispReplaceMean = atof( value.c_str() );
 			continue;
 		}
+		// if after secondary displacement replace max sweeps
+		key = "SDISPREPLACEMAXSWEEPS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			if ( atoi( value.c_str() ) < 1 ){
+				std::cout<<"The number of replacement sweeps "<<value<<" must be at least 1."<<std::endl;
+				return 1;
+			}
+			this->m_SdispReplaceMaxSweeps = atoi( value.c_str() );
+			continue;
+		}
+		// if after secondary displacement median filter
+		key = "SDISPLACEMEDIAN";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_SdispMedian = atoi( value.c_str() );
+			if ( this->m_SdispMedian > 2 ){
+				std::cout<<"Unknown median mode "<<value<<", use 0, 1 or 2."<<std::endl;
+				return 1;
+			}
+			continue;
+		}
 		// if after secondary displacement smooth sigma
 		key = "SDISPLACESMOOTHSIGMA";
 		if ( !cLine.compare(0,key.size(),key) ){
@@ -507,6 +913,28 @@ bool ReadConfigureationFile()
 			this->m_SstrainReplaceMean = atof( value.c_str() );
 			continue;
 		}
+		// if after secondary strain replace max sweeps
+		key = "SSTRAINREPLACEMAXSWEEPS";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			if ( atoi( value.c_str() ) < 1 ){
+				std::cout<<"The number of replacement sweeps "<<value<<" must be at least 1."<<std::endl;
+				return 1;
+			}
+			this->m_SstrainReplaceMaxSweeps = atoi( value.c_str() );
+			continue;
+		}
+		// if after secondary strain median filter
+		key = "SSTRAINMEDIAN";
+		if ( !cLine.compare(0,key.size(),key) ){
+			value.assign(cLine,key.size()+1,511);
+			this->m_SstrainMedian = atoi( value.c_str() );
+			if ( this->m_SstrainMedian > 2 ){
+				std::cout<<"Unknown median mode "<<value<<", use 0, 1 or 2."<<std::endl;
+				return 1;
+			}
+			continue;
+		}
 		// if after secondary strain smooth sigma
 		key = "SSTRAINSMOOTHSIGMA";
 		if ( !cLine.compare(0,key.size(),key) ){
@@ -531,12 +959,30 @@ bool ReadConfigureationFile()
 		return 1;
 	}
 	
+	this->SetUseMovingLeastSquaresStrain( this->m_MLSStrain );
+	this->SetMovingLeastSquaresParameters( this->m_MLSNeighbours, this->m_MLSRadius, this->m_MLSOrder );
+	
 	return 0;	
 }
 
-/** A function to read and set the fixed image file */
+/** A function to read and set the fixed image file.  An uncompressed
+ * MetaImage is mapped instead of read unless mapping is turned off and
+ * a file name pattern is read as a slice series.
+ * see MetaImageMapper, ReadSliceSeries */
 void ReadFixedImage()
 {
+	if ( this->m_fixedFileName.find( '%' ) != std::string::npos ){
+		this->SetFixedImage( this->template ReadSliceSeries< FixedImageType >( this->m_fixedFileName ) );
+		return;
+	}
+	if ( this->m_MapImages ){
+		if ( this->m_FixedImageMapper.Map( this->m_fixedFileName, this->m_MapImages > 1, !this->IsCropping() ) ){
+			this->SetFixedImage( this->m_FixedImageMapper.GetOutput() );
+			return;
+		}
+		this->WriteToLogfile( "The fixed image cannot be mapped, "+this->m_FixedImageMapper.GetMessage()+". Reading it." );
+	}
+	
 	typedef itk::ImageFileReader<FixedImageType>		FixedImageReaderType;
 	typename FixedImageReaderType::Pointer reader = FixedImageReaderType::New();
 	reader->SetFileName(this->m_fixedFileName);
@@ -554,9 +1000,22 @@ void ReadFixedImage()
 }
 
 
-/** A function to read and set the moving image file */
+/** A function to read and set the moving image file, mapped as for the
+ * fixed image. */
 void ReadMovingImage()
 {
+	if ( this->m_movingFileName.find( '%' ) != std::string::npos ){
+		this->SetMovingImage( this->template ReadSliceSeries< MovingImageType >( this->m_movingFileName ) );
+		return;
+	}
+	if ( this->m_MapImages ){
+		if ( this->m_MovingImageMapper.Map( this->m_movingFileName, this->m_MapImages > 1, !this->IsCropping() ) ){
+			this->SetMovingImage( this->m_MovingImageMapper.GetOutput() );
+			return;
+		}
+		this->WriteToLogfile( "The moving image cannot be mapped, "+this->m_MovingImageMapper.GetMessage()+". Reading it." );
+	}
+	
 	typedef itk::ImageFileReader<MovingImageType>		MovingImageReaderType;
 	typename MovingImageReaderType::Pointer reader = MovingImageReaderType::New();
 	reader->SetFileName(this->m_movingFileName);
@@ -573,13 +1032,317 @@ void ReadMovingImage()
 	this->SetMovingImage( reader->GetOutput() );
 }
 
+/** A function to check that a slice series pattern has exactly one 
+ * integer conversion (e.g. %04d) and no other conversions than %%, so
+ * it can be given to snprintf with the slice number. */
+static bool IsSlicePattern( const std::string &pattern )
+{
+	unsigned int nConversions = 0;
+	for ( std::size_t i = 0; i < pattern.size(); ++i ){
+		if ( pattern[i] != '%' ) continue;
+		if ( ++i < pattern.size() && pattern[i] == '%' ) continue;
+		while ( i < pattern.size() && std::strchr( "-+ #0", pattern[i] ) ) ++i;
+		while ( i < pattern.size() && std::isdigit( pattern[i] ) ) ++i;
+		if ( i < pattern.size() && pattern[i] == '.' ){
+			++i;
+			while ( i < pattern.size() && std::isdigit( pattern[i] ) ) ++i;
+		}
+		if ( i == pattern.size() || !std::strchr( "diouxX", pattern[i] ) ) return false;
+		++nConversions;
+	}
+	return nConversions == 1;
+}
+
+/** A function to read a series of TIFF or raw slices named by a printf
+ * pattern with the slice number.  The slices are decoded in parallel 
+ * and, if a crop margin is set, only the voxels around the mesh are 
+ * read, so the mesh must be read first.
+ * see SliceStackReader, GetCropBounds */
+template< typename TImage >
+typename TImage::Pointer ReadSliceSeries( const std::string &pattern )
+{
+	if ( !IsSlicePattern( pattern ) ){
+		std::cout<<"The slice series pattern "<<pattern<<" must have one integer conversion for the slice number, e.g. %04d."<<std::endl;
+		std::exit(1);
+	}
+	std::vector< std::string > fileNames;
+	for ( int i = this->m_SliceRange[0]; this->m_SliceRange[1] < this->m_SliceRange[0] || i <= this->m_SliceRange[1]; ++i ){
+		char fileName[1024];
+		snprintf( fileName, sizeof(fileName), pattern.c_str(), i );
+		if ( this->m_SliceRange[1] < this->m_SliceRange[0] && !std::ifstream( fileName ).good() ) break;
+		fileNames.push_back( fileName );
+	}
+	
+	SliceStackReader< TImage > reader;
+	reader.SetFileNames( fileNames );
+	reader.SetSpacing( this->m_SliceSpacing );
+	reader.SetRawSliceSize( this->m_RawSliceSize[0], this->m_RawSliceSize[1] );
+	reader.SetNumberOfThreads( this->GetNumberOfImageThreads() );
+	double bounds[6];
+	if ( this->GetCropBounds( this->m_SliceSpacing, bounds ) ) reader.SetCropBounds( bounds );
+	if ( !reader.Read() ){
+		std::cout<<"Error reading the slice series "<<pattern<<"."<<std::endl<<"Message: "<<std::endl;
+		std::cout<<reader.GetMessage()<<std::endl;
+		std::exit(1);
+	}
+	return reader.GetOutput();
+}
+
+/** A function to get the bounds of the images that are used: the mesh 
+ * bounds widened by the fixed interrogation region, of voxels of the 
+ * given spacing, and the crop margin.  Returns false if the images are
+ * not cropped, when the margin is negative or the mesh is a grid over 
+ * the fixed image.  The mesh bounds are those stored by ReadInputFiles
+ * before the images are read, the mesh itself is not used as the 
+ * images are read concurrently. */
+bool GetCropBounds( const double spacing[3], double bounds[6] )
+{
+	if ( !this->IsCropping() || !this->m_HasCropMeshBounds ) return false;
+	for ( unsigned int i = 0; i < 6; ++i ) bounds[i] = this->m_CropMeshBounds[i];
+	for ( unsigned int d = 0; d < 3; ++d ){
+		double margin = this->GetInterrogationRegionRadius()*this->m_FixedIRMult*spacing[d] + this->m_CropMargin;
+		bounds[2*d] = bounds[2*d] - margin;
+		bounds[2*d+1] = bounds[2*d+1] + margin;
+	}
+	return true;
+}
+
+/** A function to check whether the images will be cropped to the mesh,
+ * see GetCropBounds. */
+bool IsCropping()
+{
+	return this->m_CropMargin >= 0 && this->m_GridSpacing <= 0;
+}
+
+/** A function to crop an image to the crop bounds with the ITK region
+ * of interest filter.  The voxels keep their physical positions and 
+ * spacing.  The image is returned as it is if it is not cropped or
+ * already lies inside the bounds.  An image mapped by the mapper is 
+ * not copied: it is only cut down to the slices holding the bounds, 
+ * whole slices being the only part of the mapped pixels that is an
+ * image by itself, and only those are read.
+ * see GetCropBounds, MetaImageMapper::CropSlices */
+template< typename TImage >
+typename TImage::ConstPointer CropImage( typename TImage::ConstPointer image, MetaImageMapper< TImage > &mapper )
+{
+	bool mapped = mapper.GetOutput() && image.GetPointer() == mapper.GetOutput().GetPointer();
+	typename TImage::RegionType region;
+	typename TImage::RegionType largest = image->GetLargestPossibleRegion();
+	if ( !this->GetCropRegion( image.GetPointer(), region ) || ( mapped && region.GetSize()[2] == largest.GetSize()[2] ) ){
+		if ( mapped ) mapper.Prefetch(); // it was mapped without the read ahead in case it was cropped
+		return image;
+	}
+	
+	std::stringstream msg("");
+	if ( mapped ){
+		mapper.CropSlices( region.GetIndex()[2] - largest.GetIndex()[2], region.GetSize()[2] );
+		msg << "Cropped the mapped image from "<<largest.GetSize()[2]<<" to "<<region.GetSize()[2]<<" slices."<<std::endl;
+		this->WriteToLogfile( msg.str() );
+		return mapper.GetOutput().GetPointer();
+	}
+	
+	typedef itk::RegionOfInterestImageFilter< TImage, TImage >	ROIFilterType;
+	typename ROIFilterType::Pointer roiFilter = ROIFilterType::New();
+	roiFilter->SetInput( image );
+	roiFilter->SetRegionOfInterest( region );
+	roiFilter->SetNumberOfThreads( this->GetNumberOfImageThreads() );
+	roiFilter->Update();
+	typename TImage::Pointer cropped = roiFilter->GetOutput();
+	cropped->DisconnectPipeline();
+	
+	msg << "Cropped the image from "<<largest.GetSize()<<" to "<<region.GetSize()<<" voxels."<<std::endl;
+	this->WriteToLogfile( msg.str() );
+	return cropped.GetPointer();
+}
+
+/** A function to find the voxels of an image inside the crop bounds,
+ * which are made from the stored mesh bounds and not the mesh, so the
+ * images can be cropped concurrently.  Returns false if the image is 
+ * not cropped, lies inside the bounds or is outside them. */
+template< typename TImage >
+bool GetCropRegion( const TImage *image, typename TImage::RegionType &region )
+{
+	double spacing[3], bounds[6];
+	for ( unsigned int d = 0; d < 3; ++d ) spacing[d] = image->GetSpacing()[d];
+	if ( !this->GetCropBounds( spacing, bounds ) ) return false;
+	
+	// the voxels holding the corners of the bounds
+	typename TImage::RegionType largest = image->GetLargestPossibleRegion();
+	long start[3], end[3];
+	for ( unsigned int d = 0; d < 3; ++d ){
+		start[d] = largest.GetIndex()[d] + largest.GetSize()[d];
+		end[d] = largest.GetIndex()[d] - 1;
+	}
+	for ( unsigned int corner = 0; corner < 8; ++corner ){
+		typename TImage::PointType point;
+		for ( unsigned int d = 0; d < 3; ++d ) point[d] = bounds[ 2*d + ( ( corner >> d ) & 1 ) ];
+		itk::ContinuousIndex< double, 3 > index;
+		image->TransformPhysicalPointToContinuousIndex( point, index );
+		for ( unsigned int d = 0; d < 3; ++d ){
+			start[d] = std::min( start[d], (long)std::floor( index[d] ) );
+			end[d] = std::max( end[d], (long)std::ceil( index[d] ) );
+		}
+	}
+	for ( unsigned int d = 0; d < 3; ++d ){
+		start[d] = std::max( start[d], (long)largest.GetIndex()[d] );
+		end[d] = std::min( end[d], (long)( largest.GetIndex()[d] + largest.GetSize()[d] ) - 1 );
+		if ( end[d] < start[d] ){
+			this->WriteToLogfile( "The mesh is outside the image, the image is not cropped." );
+			return false;
+		}
+		region.SetIndex( d, start[d] );
+		region.SetSize( d, end[d] - start[d] + 1 );
+	}
+	return !( region == largest );
+}
+
+/** A function to read the fixed and moving images and the mesh file 
+ * concurrently.  Unless the analysis restarts, each image is shrunk for
+ * the global registration as soon as it is read, so the resampling of
+ * one image overlaps the reading of the other.  A structured grid is 
+ * generated once the fixed image is read.  If the images are cropped 
+ * the mesh is read before them and each image is cropped before it is
+ * shrunk, to the mesh bounds stored before the sections start so that
+ * neither section reads the mesh while the other uses it. */
+void ReadInputFiles()
+{
+	// the image IO factories are registered before the readers look for them
+	itk::ObjectFactoryBase::CreateAllInstance( "itkImageIOBase" );
+	
+	bool gridFromFixedImage = this->m_GridSpacing > 0;
+	bool restart = !this->m_restartResultFileName.empty() || ( !gridFromFixedImage && 
+		!this->m_meshFileName.compare(this->m_meshFileName.size()-3,3,"vtk") );
+	
+	// the images are cropped around the mesh
+	bool meshFirst = this->m_CropMargin >= 0 && !gridFromFixedImage;
+	if ( meshFirst ){
+		this->ReadMeshFile();
+		this->m_HasCropMeshBounds = this->GetDataImageBounds( this->m_CropMeshBounds );
+	}
+	
+	// the sections share the threads for their own parallel loops: a third for a mesh read alongside the
+	// images and half of the rest for each image, which needs a second active level of parallelism
+	unsigned int nThreads = this->GetNumberOfThreads();
+	bool meshSection = !gridFromFixedImage && !meshFirst;
+	unsigned int imageThreads = std::max( 1u, ( meshSection ? nThreads - nThreads/3 : nThreads )/2 );
+	this->SetNumberOfImageThreads( imageThreads );
+	this->SetNumberOfThreads( meshSection ? std::max( 1u, nThreads/3 ) : imageThreads );
+#ifdef _OPENMP
+	int activeLevels = omp_get_max_active_levels();
+	omp_set_max_active_levels( std::max( activeLevels, 2 ) );
+#endif
+	
+	#pragma omp parallel sections num_threads(3)
+	{
+		#pragma omp section
+		{
+			this->ReadFixedImage();
+			this->SetFixedImage( this->template CropImage< FixedImageType >( this->GetFixedImage(), this->m_FixedImageMapper ) );
+			if ( gridFromFixedImage ) this->ReadMeshFile();
+			if ( !restart ) this->ShrinkFixedImageForGlobalRegistration();
+		}
+		#pragma omp section
+		{
+			this->ReadMovingImage();
+			this->SetMovingImage( this->template CropImage< MovingImageType >( this->GetMovingImage(), this->m_MovingImageMapper ) );
+			if ( !restart ) this->ShrinkMovingImageForGlobalRegistration();
+		}
+		#pragma omp section
+		{
+			if ( meshSection ) this->ReadMeshFile();
+		}
+	}
+	
+#ifdef _OPENMP
+	omp_set_max_active_levels( activeLevels );
+#endif
+	this->SetNumberOfThreads( nThreads );
+	this->SetNumberOfImageThreads( 0 );
+}
+
+/** A function to read the mesh file, or to generate a structured grid 
+ * if a grid spacing is set.  The grid covers the fixed image less the
+ * fixed interrogation region radius on every side, so the fixed 
+ * image must be read first.  If a restart result file is set, the 
+ * displacements of the previous result are interpolated onto the mesh 
+ * and the analysis restarts from them. */
 void ReadMeshFile()
 {
-	if ( !this->m_meshFileName.compare(this->m_meshFileName.size()-3,3,"vtk") ){
+	if ( this->m_GridSpacing > 0 ){
+		typename FixedImageType::ConstPointer fixedImage = this->GetFixedImage();
+		if ( !fixedImage ){
+			std::cout<<"The fixed image must be read before generating the grid."<<std::endl;
+			std::exit(1);
+		}
+		typename FixedImageType::SizeType size = fixedImage->GetLargestPossibleRegion().GetSize();
+		typename FixedImageType::IndexType index = fixedImage->GetLargestPossibleRegion().GetIndex();
+		double bounds[6];
+		for ( unsigned int d = 0; d < 3; ++d ){
+			double inset = ( this->GetInterrogationRegionRadius()*this->m_FixedIRMult )*fixedImage->GetSpacing()[d];
+			bounds[2*d] = fixedImage->GetOrigin()[d] + index[d]*fixedImage->GetSpacing()[d] + inset;
+			bounds[2*d+1] = fixedImage->GetOrigin()[d] + ( index[d] + size[d] - 1 )*fixedImage->GetSpacing()[d] - inset;
+			if ( bounds[2*d+1] < bounds[2*d] ){
+				std::cout<<"The fixed image is too small for a grid with the interrogation region radius "<<this->GetInterrogationRegionRadius()<<"."<<std::endl;
+				std::exit(1);
+			}
+		}
+		this->GenerateStructuredGrid( bounds, this->m_GridSpacing );
+	}
+	else if ( !this->m_meshFileName.compare(this->m_meshFileName.size()-3,3,"vtk") ){
 		this->ReadVTKMesh( this->m_meshFileName );
 		this->m_RestartFile = 1;				
-	};
-	if ( !this->m_meshFileName.compare(this->m_meshFileName.size()-3,3,"msh") ){this->ReadMeshFromGmshFile( this->m_meshFileName );}
+	}
+	else if ( !this->m_meshFileName.compare(this->m_meshFileName.size()-3,3,"msh") ){this->ReadMeshFromGmshFile( this->m_meshFileName );}
+	
+	// restart from the result of a previous analysis on a different mesh
+	if ( !this->m_restartResultFileName.empty() ){
+		if ( !this->m_restartResultFileName.compare(this->m_restartResultFileName.size()-4,4,"dvcr") ){
+			ResultsContainer container;
+			if ( !container.Open( this->m_restartResultFileName ) || !container.GetNumberOfDatasets() ){
+				std::cout<<"Cannot read the results container "<<this->m_restartResultFileName<<"."<<std::endl;
+				std::exit(1);
+			}
+			std::string stage = this->m_restartStage;
+			if ( stage.empty() ){
+				// the last of the stages written by AnalyzeImages, an aborted run may end with other stages
+				const char *resultStages[] = { "InitialDVC", "RefinedDVC", "PostProcessedInitialDVC", "SecondDVC", "PostProcessedSecondDVC" };
+				for ( long i = (long)container.GetNumberOfDatasets() - 1; i >= 0 && stage.empty(); --i ){
+					for ( unsigned int j = 0; j < 5; ++j ){
+						if ( container.GetDataset( i ).stage == resultStages[j] ) stage = resultStages[j];
+					}
+				}
+			}
+			vtkSmartPointer<vtkUnstructuredGrid> restartImage = container.GetStageImage( stage );
+			if ( !restartImage ){
+				std::cout<<"The results container "<<this->m_restartResultFileName<<" has no result stage "<<stage<<"."<<std::endl;
+				std::exit(1);
+			}
+			this->InterpolateDisplacementFromMesh( restartImage );
+		}
+		else if ( !this->m_restartResultFileName.compare(this->m_restartResultFileName.size()-4,4,"pvtu") ){
+			vtkSmartPointer<vtkXMLPUnstructuredGridReader> resultReader = vtkSmartPointer<vtkXMLPUnstructuredGridReader>::New();
+			resultReader->SetFileName( this->m_restartResultFileName.c_str() );
+			resultReader->Update();
+			this->InterpolateDisplacementFromMesh( resultReader->GetOutput() );
+		}
+		else if ( !this->m_restartResultFileName.compare(this->m_restartResultFileName.size()-3,3,"vtu") ){
+			vtkSmartPointer<vtkXMLUnstructuredGridReader> resultReader = vtkSmartPointer<vtkXMLUnstructuredGridReader>::New();
+			resultReader->SetFileName( this->m_restartResultFileName.c_str() );
+			resultReader->Update();
+			this->InterpolateDisplacementFromMesh( resultReader->GetOutput() );
+		}
+		else{
+			vtkSmartPointer<vtkUnstructuredGridReader> resultReader = vtkSmartPointer<vtkUnstructuredGridReader>::New();
+			resultReader->SetFileName( this->m_restartResultFileName.c_str() );
+			resultReader->Update();
+			this->InterpolateDisplacementFromMesh( resultReader->GetOutput() );
+		}
+		this->m_RestartFile = 1;
+		
+		std::stringstream msg("");
+		msg << "Restarting from the displacements of "<<this->m_restartResultFileName<<"."<<std::endl;
+		this->WriteToLogfile( msg.str() );
+	}
 }
 
 /** A function to print the current setup of the DVC.  Returns a string
@@ -590,8 +1353,25 @@ std::string PrintConfiguration()
 	
 	outputText<<"FIXEDIMAGEFILE="<<this->m_fixedFileName<<std::endl;
 	outputText<<"MOVINGIMAGEFILE="<<this->m_movingFileName<<std::endl;
+	outputText<<"MAPIMAGES="<<this->m_MapImages<<std::endl;
+	outputText<<"SLICERANGE="<<this->m_SliceRange[0]<<" "<<this->m_SliceRange[1]<<std::endl;
+	outputText<<"SLICESPACING="<<this->m_SliceSpacing[0]<<" "<<this->m_SliceSpacing[1]<<" "<<this->m_SliceSpacing[2]<<std::endl;
+	outputText<<"RAWSLICESIZE="<<this->m_RawSliceSize[0]<<" "<<this->m_RawSliceSize[1]<<std::endl;
+	outputText<<"CROPMARGIN="<<this->m_CropMargin<<std::endl;
+	outputText<<"CACHEDIRECTORY="<<this->m_CacheDirectory<<std::endl;
+	outputText<<"CACHESIZE="<<this->m_CacheSize<<std::endl;
 	outputText<<"MESHFILENAME="<<this->m_meshFileName<<std::endl;
+	outputText<<"GRIDSPACING="<<this->m_GridSpacing<<std::endl;
+	outputText<<"RESTARTRESULTFILE="<<this->m_restartResultFileName<<std::endl;
+	outputText<<"RESTARTSTAGE="<<this->m_restartStage<<std::endl;
 	outputText<<"OUTPUTFOLDER="<<this->m_outputDirectory<<std::endl;
+	outputText<<"OUTPUTFORMAT="<<this->m_OutputFormat<<std::endl;
+	outputText<<"OUTPUTCOMPRESSION="<<this->m_OutputCompression<<std::endl;
+	outputText<<"OUTPUTPIECES="<<this->m_OutputPieces<<std::endl;
+	outputText<<"INITIALDVCARRAYS="<<this->m_initialDVCArrays<<std::endl;
+	outputText<<"POSTINITIALDVCARRAYS="<<this->m_postInitialDVCArrays<<std::endl;
+	outputText<<"SECONDARYDVCARRAYS="<<this->m_secondaryDVCArrays<<std::endl;
+	outputText<<"POSTSECONDARYDVCARRAYS="<<this->m_postSecondaryDVCArrays<<std::endl;
 	outputText<<"IRRADIUS="<<this->GetInterrogationRegionRadius()<<std::endl;
 	outputText<<"NTHREADS="<<this->GetRegistrationMethod()->GetNumberOfThreads()<<std::endl;
 	outputText<<"GLOBALMAXSTEP="<<this->m_GlobalMaxStep<<std::endl;
@@ -602,26 +1382,45 @@ std::string PrintConfiguration()
 	outputText<<"SECONDARYDVCMINSTEP="<<this->m_SecondaryDVCMinStep<<std::endl;
 	//~ outputText<<"TERTIARYDVCMAXSTEP="<<this->m_TertiaryDVCMaxStep<<std::endl;
 	//~ outputText<<"TERTIARYDVCMAXSTEP="<<this->m_TertiaryDVCMinStep<<std::endl;
+	outputText<<"COARSEMESHFILENAME="<<this->m_coarseMeshFileName<<std::endl;
+	outputText<<"COARSEIRRADIUS="<<this->m_CoarseIRRadius<<std::endl;
+	outputText<<"COARSEDVCMAXSTEP="<<this->m_CoarseDVCMaxStep<<std::endl;
+	outputText<<"COARSEDVCMINSTEP="<<this->m_CoarseDVCMinStep<<std::endl;
+	outputText<<"REFINEMENTLEVELS="<<this->m_RefinementLevels<<std::endl;
+	outputText<<"REFINEMENTFRACTION="<<this->m_RefinementFraction<<std::endl;
+	outputText<<"REFINEMENTMAXPOINTS="<<this->m_RefinementMaxPoints<<std::endl;
 	outputText<<"PERFORMSECONDARYDVC="<<this->m_SecondaryDVC<<std::endl;
+	outputText<<"MLSSTRAIN="<<this->m_MLSStrain<<std::endl;
+	outputText<<"MLSNEIGHBOURS="<<this->m_MLSNeighbours<<std::endl;
+	outputText<<"MLSRADIUS="<<this->m_MLSRadius<<std::endl;
+	outputText<<"MLSORDER="<<this->m_MLSOrder<<std::endl;
 	//~ outputText<<"PERFORMTERTIARTYDVC="<<this->m_TertiaryDVC<<std::endl;
 	outputText<<"IDISPLACEMENTERRORTOLLERANCE="<<this->m_IdispErrorToll;
 	outputText<<"IDISPREPLACESIGMA="<<this->m_IdispReplaceSigma<<std::endl;
 	outputText<<"IDISPREPLACEMEAN="<<this->m_IdispReplaceMean<<std::endl;
+	outputText<<"IDISPREPLACEMAXSWEEPS="<<this->m_IdispReplaceMaxSweeps<<std::endl;
+	outputText<<"IDISPLACEMEDIAN="<<this->m_IdispMedian<<std::endl;
 	outputText<<"IDISPLACESMOOTHSIGMA="<<this->m_IdispSmoothSigma<<std::endl;
 	outputText<<"IDISPLACESMOOTHMEAN="<<this->m_IdispSmoothMean<<std::endl;
 	outputText<<"ISTRAINERRORTOLLERANCE="<<this->m_IstrainErrorToll;
 	outputText<<"ISTRAINREPLACESIGMA="<<this->m_IstrainReplaceSigma<<std::endl;
 	outputText<<"ISTRAINREPLACEMEAN="<<this->m_IstrainReplaceMean<<std::endl;
+	outputText<<"ISTRAINREPLACEMAXSWEEPS="<<this->m_IstrainReplaceMaxSweeps<<std::endl;
+	outputText<<"ISTRAINMEDIAN="<<this->m_IstrainMedian<<std::endl;
 	outputText<<"ISTRAINSMOOTHSIGMA="<<this->m_IstrainSmoothSigma<<std::endl;
 	outputText<<"ISTRAINSMOOTHMEAN="<<this->m_IstrainSmoothMean<<std::endl;
 	outputText<<"SDISPLACEMENTERRORTOLLERANCE="<<this->m_SdispErrorToll;
 	outputText<<"SDISPREPLACESIGMA="<<this->m_SdispReplaceSigma<<std::endl;
 	outputText<<"SDISPREPLACEMEAN="<<this->m_SdispReplaceMean<<std::endl;
+	outputText<<"SDISPREPLACEMAXSWEEPS="<<this->m_SdispReplaceMaxSweeps<<std::endl;
+	outputText<<"SDISPLACEMEDIAN="<<this->m_SdispMedian<<std::endl;
 	outputText<<"SDISPLACESMOOTHSIGMA="<<this->m_SdispSmoothSigma<<std::endl;
 	outputText<<"SDISPLACESMOOTHMEAN="<<this->m_SdispSmoothMean<<std::endl;
 	outputText<<"SSTRAINERRORTOLLERANCE="<<this->m_SstrainErrorToll;
 	outputText<<"SSTRAINREPLACESIGMA="<<this->m_SstrainReplaceSigma<<std::endl;
 	outputText<<"SSTRAINREPLACEMEAN="<<this->m_SstrainReplaceMean<<std::endl;
+	outputText<<"SSTRAINREPLACEMAXSWEEPS="<<this->m_SstrainReplaceMaxSweeps<<std::endl;
+	outputText<<"SSTRAINMEDIAN="<<this->m_SstrainMedian<<std::endl;
 	outputText<<"SSTRAINSMOOTHSIGMA="<<this->m_SstrainSmoothSigma<<std::endl;
 	outputText<<"SSTRAINSMOOTHMEAN="<<this->m_SstrainSmoothMean<<std::endl;
 	outputText<<std::endl;
@@ -795,6 +1594,94 @@ bool PerformSecondaryDVC()
 	return this->m_SecondaryDVC;
 }
 
+bool PerformAdaptiveRefinement()
+{
+	return this->m_RefinementLevels > 0;
+}
+
+/** A function to refine the mesh where the initial DVC has bad points
+ * or a large strain variation and register only the new points.  The
+ * bad points are found with the initial DVC error tolerances and the 
+ * registration keeps the initial DVC settings.  The strains must be 
+ * current and are recalculated after every level.
+ * see DICMesh::FindCellsToRefine and DICMesh::RefineMesh */
+void ExecuteAdaptiveRefinement()
+{
+	this->SetDisplacementErrorTolerance( this->m_IdispErrorToll );
+	this->SetStrainErrorTolerance( this->m_IstrainErrorToll );
+	
+	unsigned int nAdded = 0;
+	for ( unsigned int level = 0; level < this->m_RefinementLevels; ++level ){
+		if ( this->m_RefinementMaxPoints > 0 && nAdded >= this->m_RefinementMaxPoints ) break;
+		
+		std::vector< unsigned int > cells;
+		this->FindCellsToRefine( this->m_RefinementFraction, cells );
+		unsigned int nNew = this->RefineMesh( cells, this->m_RefinementMaxPoints > 0 ? this->m_RefinementMaxPoints - nAdded : 0 );
+		if ( nNew == 0 ) break;
+		nAdded = nAdded + nNew;
+		
+		std::stringstream msg("");
+		msg << "Registering the "<<nNew<<" new points of refinement level "<<level+1<<"."<<std::endl;
+		this->WriteToLogfile( msg.str() );
+		this->ExecuteDIC();
+		this->GetStrains();
+	}
+}
+
+bool PerformCoarseDVC()
+{
+	return !this->m_coarseMeshFileName.empty();
+}
+
+/** A function to register the nodes of the coarse mesh with a larger
+ * interrogation region and interpolate the result onto the mesh as the
+ * starting displacement of the initial DVC.  The coarse mesh starts 
+ * from the global registration result and its bad displacements are
+ * replaced with the initial DVC settings before the interpolation.
+ * SetupInitialDVCRegistration must be called first; the interrogation 
+ * region, step lengths and region lists are restored afterwards. */
+void ExecuteCoarseDVC()
+{
+	vtkSmartPointer<vtkUnstructuredGrid> fineImage = this->GetDataImage();
+	StructuredGrid fineGrid = this->GetStructuredGrid(); // cleared with the mesh, e.g. for GRIDSPACING
+	unsigned int fineRadius = this->GetInterrogationRegionRadius();
+	
+	if ( !this->m_coarseMeshFileName.compare(this->m_coarseMeshFileName.size()-3,3,"vtk") ){this->ReadVTKMesh( this->m_coarseMeshFileName );}
+	else if ( !this->m_coarseMeshFileName.compare(this->m_coarseMeshFileName.size()-3,3,"msh") ){this->ReadMeshFromGmshFile( this->m_coarseMeshFileName );}
+	else{
+		std::cout<<"Unknown coarse mesh file type: "<<this->m_coarseMeshFileName<<std::endl;
+		std::exit(1);
+	}
+	this->InterpolateDisplacementFromMesh( fineImage );
+	
+	this->SetInterrogationRegionRadius( this->m_CoarseIRRadius > 0 ? this->m_CoarseIRRadius : 2*fineRadius );
+	this->GetOptimizer()->SetMaximumStepLength( this->m_CoarseDVCMaxStep > 0 ? this->m_CoarseDVCMaxStep : this->m_InitialDVCMaxStep );
+	this->GetOptimizer()->SetMinimumStepLength( this->m_CoarseDVCMinStep > 0 ? this->m_CoarseDVCMinStep : this->m_InitialDVCMinStep );
+	this->CalculateInitialFixedImageRegionList();
+	this->CalculateInitialMovingImageRegionList();
+	
+	std::stringstream msg("");
+	msg << "Starting coarse DVC of "<<this->GetDataImage()->GetNumberOfPoints()<<" points with interrogation region radius "<<this->GetInterrogationRegionRadius()<<"."<<std::endl;
+	this->WriteToLogfile( msg.str() );
+	this->ExecuteDIC();
+	this->ReplaceDisplacementBadPixelsAfterInitialDVC();
+	
+	vtkSmartPointer<vtkUnstructuredGrid> coarseImage = this->GetDataImage();
+	this->SetDataImage( fineImage );
+	if ( !fineGrid.IsEmpty() ) this->SetStructuredGrid( fineGrid );
+	this->InterpolateDisplacementFromMesh( coarseImage );
+	
+	this->SetInterrogationRegionRadius( fineRadius );
+	this->GetOptimizer()->SetMaximumStepLength( this->m_InitialDVCMaxStep );
+	this->GetOptimizer()->SetMinimumStepLength( this->m_InitialDVCMinStep );
+	this->CalculateInitialFixedImageRegionList();
+	this->CalculateInitialMovingImageRegionList();
+	
+	msg.str("");
+	msg << "Coarse DVC completed, the displacements are interpolated onto "<<fineImage->GetNumberOfPoints()<<" points."<<std::endl;
+	this->WriteToLogfile( msg.str() );
+}
+
 //~ bool PerformTertiaryDVC()
 //~ {
 	//~ return this->m_TertiaryDVC;
@@ -805,7 +1692,7 @@ void ReplaceDisplacementBadPixelsAfterInitialDVC()
 	this->SetDisplacementErrorTolerance( this->m_IdispErrorToll );
 	
 	vtkSmartPointer<vtkIdList> replacedPixels = vtkSmartPointer<vtkIdList>::New();
-	this->ReplaceBadDisplacementPixels( this->m_IdispReplaceSigma, this->m_IdispReplaceMean, replacedPixels );
+	this->ReplaceBadDisplacementPixels( this->m_IdispReplaceSigma, this->m_IdispReplaceMean, replacedPixels, this->m_IdispReplaceMaxSweeps );
 	std::stringstream msg("");
 	for ( int i = 0; i < replacedPixels->GetNumberOfIds(); ++i){
 		msg <<"Pixel "<<replacedPixels->GetId( i )<<" replaced."<<std::endl;
@@ -817,6 +1704,10 @@ void SmoothDisplacementAfterInitialDVC()
 {
 	this->SetDisplacementErrorTolerance( this->m_IdispErrorToll );
 	
+	if ( this->m_IdispMedian ){
+		this->DisplacementMedianFilter( (MeshMedianFilter::MedianModeType)this->m_IdispMedian );
+	}
+	
 	this->DisplacementWeightedMovingAverageFilter( this->m_IdispSmoothSigma, this->m_IdispSmoothMean );
 }
 
@@ -825,7 +1716,7 @@ void ReplaceStrainBadPixelsAfterInitialDVC()
 	this->SetStrainErrorTolerance( this->m_IstrainErrorToll );
 	
 	vtkSmartPointer<vtkIdList> replacedPixels = vtkSmartPointer<vtkIdList>::New();
-	this->ReplaceBadStrainPixels( this->m_IstrainReplaceSigma, this->m_IstrainReplaceMean, replacedPixels );
+	this->ReplaceBadStrainPixels( this->m_IstrainReplaceSigma, this->m_IstrainReplaceMean, replacedPixels, this->m_IstrainReplaceMaxSweeps );
 	std::stringstream msg("");
 	for ( int i = 0; i < replacedPixels->GetNumberOfIds(); ++i){
 		msg <<"Pixel "<<replacedPixels->GetId( i )<<" replaced."<<std::endl;
@@ -837,6 +1728,10 @@ void SmoothStrainAfterInitialDVC()
 {
 	this->SetStrainErrorTolerance( this->m_IstrainErrorToll );
 	
+	if ( this->m_IstrainMedian ){
+		this->StrainMedianFilter( (MeshMedianFilter::MedianModeType)this->m_IstrainMedian );
+	}
+	
 	this->StrainWeightedMovingAverageFilter( this->m_IstrainSmoothSigma, this->m_IstrainSmoothMean );
 }
 
@@ -845,7 +1740,7 @@ void ReplaceDisplacementBadPixelsAfterSecondDVC()
 	this->SetDisplacementErrorTolerance( this->m_SdispErrorToll );
 
 	vtkSmartPointer<vtkIdList> replacedPixels = vtkSmartPointer<vtkIdList>::New();
-	this->ReplaceBadDisplacementPixels( this->m_SdispReplaceSigma, this->m_SdispReplaceMean, replacedPixels );
+	this->ReplaceBadDisplacementPixels( this->m_SdispReplaceSigma, this->m_SdispReplaceMean, replacedPixels, this->m_SdispReplaceMaxSweeps );
 	std::stringstream msg("");
 	for ( int i = 0; i < replacedPixels->GetNumberOfIds(); ++i){
 		msg <<"Pixel "<<replacedPixels->GetId( i )<<" replaced."<<std::endl;
@@ -857,6 +1752,10 @@ void SmoothDisplacementAfterSecondDVC()
 {
 	this->SetDisplacementErrorTolerance( this->m_SdispErrorToll );
 	
+	if ( this->m_SdispMedian ){
+		this->DisplacementMedianFilter( (MeshMedianFilter::MedianModeType)this->m_SdispMedian );
+	}
+	
 	this->DisplacementWeightedMovingAverageFilter( this->m_SdispSmoothSigma, this->m_SdispSmoothMean );
 }
 
@@ -865,7 +1764,7 @@ void ReplaceStrainBadPixelsAfterSecondDVC()
 	this->SetStrainErrorTolerance( this->m_SstrainErrorToll );
 	
 	vtkSmartPointer<vtkIdList> replacedPixels = vtkSmartPointer<vtkIdList>::New();
-	this->ReplaceBadStrainPixels( this->m_SstrainReplaceSigma, this->m_SstrainReplaceMean, replacedPixels );
+	this->ReplaceBadStrainPixels( this->m_SstrainReplaceSigma, this->m_SstrainReplaceMean, replacedPixels, this->m_SstrainReplaceMaxSweeps );
 	std::stringstream msg("");
 	for ( int i = 0; i < replacedPixels->GetNumberOfIds(); ++i){
 		msg <<"Pixel "<<replacedPixels->GetId( i )<<" replaced."<<std::endl;
@@ -877,6 +1776,10 @@ void SmoothStrainAfterSecondDVC()
 {
 	this->SetStrainErrorTolerance( this->m_SstrainErrorToll );
 	
+	if ( this->m_SstrainMedian ){
+		this->StrainMedianFilter( (MeshMedianFilter::MedianModeType)this->m_SstrainMedian );
+	}
+	
 	this->StrainWeightedMovingAverageFilter( this->m_SstrainSmoothSigma, this->m_SstrainSmoothMean );
 }
 
@@ -892,6 +1795,11 @@ StepLengthType			m_GlobalMaxStep;
 StepLengthType			m_InitialDVCMinStep;
 StepLengthType			m_InitialDVCMaxStep;
 
+// Coarse DVC Parameters
+unsigned int			m_CoarseIRRadius;
+StepLengthType			m_CoarseDVCMinStep;
+StepLengthType			m_CoarseDVCMaxStep;
+
 // Secondary DVC Parameters
 StepLengthType			m_SecondaryDVCMinStep;
 StepLengthType			m_SecondaryDVCMaxStep;
@@ -905,7 +1813,9 @@ double					m_IdispErrorToll;
 // Displacement replacement
 double					m_IdispReplaceSigma;
 double					m_IdispReplaceMean;
+unsigned int			m_IdispReplaceMaxSweeps;
 // Displacement smoothing
+unsigned int			m_IdispMedian;
 double					m_IdispSmoothSigma;
 double					m_IdispSmoothMean;
 
@@ -913,7 +1823,9 @@ double					m_IstrainErrorToll;
 // Strain repalcement
 double					m_IstrainReplaceSigma;
 double					m_IstrainReplaceMean;
+unsigned int			m_IstrainReplaceMaxSweeps;
 // Strain smoothing
+unsigned int			m_IstrainMedian;
 double					m_IstrainSmoothSigma;
 double					m_IstrainSmoothMean;
 
@@ -922,7 +1834,9 @@ double_t				m_SdispErrorToll;
 // Displacement replacement
 double					m_SdispReplaceSigma;
 double					m_SdispReplaceMean;
+unsigned int			m_SdispReplaceMaxSweeps;
 // Displacement smoothing
+unsigned int			m_SdispMedian;
 double					m_SdispSmoothSigma;
 double					m_SdispSmoothMean;
 
@@ -930,22 +1844,57 @@ double					m_SstrainErrorToll;
 // Strain replacement
 double					m_SstrainReplaceSigma;
 double					m_SstrainReplaceMean;
+unsigned int			m_SstrainReplaceMaxSweeps;
 // Strain smoothing
+unsigned int			m_SstrainMedian;
 double					m_SstrainSmoothSigma;
 double					m_SstrainSmoothMean;
 
+// adaptive refinement parameters
+unsigned int			m_RefinementLevels;
+double					m_RefinementFraction;
+unsigned int			m_RefinementMaxPoints;
+
 // switch for number of DVCs
 bool					m_SecondaryDVC;
 bool					m_TertiaryDVC;
 
+// moving least squares strain parameters
+bool					m_MLSStrain;
+unsigned int			m_MLSNeighbours;
+double					m_MLSRadius;
+unsigned int			m_MLSOrder;
+
 // restart file indicator
 bool					m_RestartFile;
 
 // image file names
 std::string				m_fixedFileName;
 std::string				m_movingFileName;
+int						m_MapImages; // 0 to read the images, 1 to map them, 2 to map them with huge pages
+int						m_SliceRange[2]; // first and last slice numbers of slice series
+double					m_SliceSpacing[3];
+unsigned long			m_RawSliceSize[2];
+double					m_CropMargin; // displacement margin around the mesh, -1 to keep the whole images
+double					m_CropMeshBounds[6]; // bounds of the mesh the images are cropped to
+bool					m_HasCropMeshBounds;
+std::string				m_CacheDirectory; // shared directory of the derived images, empty for no cache
+double					m_CacheSize; // size limit of the cache directory in GB
+MetaImageMapper< TFixedImage >	m_FixedImageMapper; // holds the mapped images
+MetaImageMapper< TMovingImage >	m_MovingImageMapper;
 std::string				m_meshFileName;
+double					m_GridSpacing; // structured grid node spacing, 0 to read the mesh file
+std::string				m_coarseMeshFileName;
+std::string				m_restartResultFileName;
+std::string				m_restartStage; // stage of a dvcr restart result, empty for the last result stage
 std::string				m_outputDirectory;
+std::string				m_OutputFormat;
+int						m_OutputCompression;
+unsigned int			m_OutputPieces;
+std::string				m_initialDVCArrays; // result file arrays, see DICMesh::SetResultArrays
+std::string				m_postInitialDVCArrays;
+std::string				m_secondaryDVCArrays;
+std::string				m_postSecondaryDVCArrays;
 
 // registration observer
 CommandIterationUpdate::Pointer m_observer;
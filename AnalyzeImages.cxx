@@ -65,17 +65,9 @@ int main(int argc, char **argv)
 	dvcMethod->WriteToLogfile( message );
 	
 	/** Read the input files */
-	message = "Reading fixed image.";
+	message = "Reading the fixed image, moving image and mesh file.";
 	dvcMethod->WriteToLogfile( message );
-	dvcMethod->ReadFixedImage();
-	
-	message = "Reading moving image.";
-	dvcMethod->WriteToLogfile( message );
-	dvcMethod->ReadMovingImage();
-	
-	message = "Reading mesh file.";
-	dvcMethod->WriteToLogfile( message );
-	dvcMethod->ReadMeshFile();
+	dvcMethod->ReadInputFiles();
 	
 	if ( !dvcMethod->RestartAnalysis() ){
 		// setup the global registration
@@ -87,6 +79,12 @@ int main(int argc, char **argv)
 		
 		// setup the initial DVC
 		dvcMethod->SetupInitialDVCRegistration();
+		// register the coarse mesh to give the starting displacements
+		if ( dvcMethod->PerformCoarseDVC() ){
+			dvcMethod->ExecuteCoarseDVC();
+			message = "Coarse DVC completed at: "+dvcMethod->GetTime();
+			dvcMethod->WriteToLogfile( message );
+		}
 		// perform the initial DVC
 		dvcMethod->ExecuteDIC();
 		message = "Initial DVC completed at: "+dvcMethod->GetTime();
@@ -106,9 +104,21 @@ int main(int argc, char **argv)
 	dvcMethod->WriteToLogfile( message );
 	dvcMethod->GetPrincipalStrains();
 	
-	message = "Writing initial DVC results image to "+dvcMethod->GetOutputDirectory()+"/InitialDVC.vtk";
+	message = "Writing initial DVC results image to "+dvcMethod->GetResultFileName( "InitialDVC" );
 	dvcMethod->WriteToLogfile( message );
-	dvcMethod->WriteMeshToVTKFile( dvcMethod->GetOutputDirectory()+"/InitialDVC.vtk" );
+	dvcMethod->WriteResultFile( "InitialDVC" );
+	
+	// refine the mesh where the initial DVC is poor and register the new points
+	if ( !dvcMethod->RestartAnalysis() && dvcMethod->PerformAdaptiveRefinement() ){
+		message = "Refining the mesh.";
+		dvcMethod->WriteToLogfile( message );
+		dvcMethod->ExecuteAdaptiveRefinement();
+		dvcMethod->GetPrincipalStrains();
+		
+		message = "Writing refined DVC results image to "+dvcMethod->GetResultFileName( "RefinedDVC" );
+		dvcMethod->WriteToLogfile( message );
+		dvcMethod->WriteResultFile( "RefinedDVC" );
+	}
 	
 	message = "Removing and replacing bad displacemnet data points.";
 	dvcMethod->WriteToLogfile( message );
@@ -126,9 +136,9 @@ int main(int argc, char **argv)
 	dvcMethod->WriteToLogfile( message );
 	dvcMethod->SmoothStrainAfterInitialDVC();	
 	
-	message = "Writing post processed initail DVC results image to "+dvcMethod->GetOutputDirectory()+"/PostProcessedInitialDVC.vtk";
+	message = "Writing post processed initail DVC results image to "+dvcMethod->GetResultFileName( "PostProcessedInitialDVC" );
 	dvcMethod->WriteToLogfile( message );
-	dvcMethod->WriteMeshToVTKFile( dvcMethod->GetOutputDirectory()+"/PostProcessedInitialDVC.vtk" );
+	dvcMethod->WriteResultFile( "PostProcessedInitialDVC" );
 	
 	// if no secondary DVC is requested, stop the analysis
 	if ( !dvcMethod->PerformSecondaryDVC() ) {
@@ -156,9 +166,9 @@ int main(int argc, char **argv)
 	dvcMethod->WriteToLogfile( message );
 	dvcMethod->GetPrincipalStrains();
 	
-	message = "Writing second round DVC results image to "+dvcMethod->GetOutputDirectory()+"/SecondDVC.vtk";
+	message = "Writing second round DVC results image to "+dvcMethod->GetResultFileName( "SecondDVC" );
 	dvcMethod->WriteToLogfile( message );
-	dvcMethod->WriteMeshToVTKFile( dvcMethod->GetOutputDirectory()+"/SecondDVC.vtk" );
+	dvcMethod->WriteResultFile( "SecondDVC" );
 	
 	message = "Removing and replacing bad displacemnet data points.";
 	dvcMethod->WriteToLogfile( message );
@@ -176,9 +186,9 @@ int main(int argc, char **argv)
 	dvcMethod->WriteToLogfile( message );
 	dvcMethod->SmoothStrainAfterSecondDVC();
 	
-	message = "Writing post processed initail DVC results image to "+dvcMethod->GetOutputDirectory()+"/PostProcessedSecondDVC.vtk";
+	message = "Writing post processed initail DVC results image to "+dvcMethod->GetResultFileName( "PostProcessedSecondDVC" );
 	dvcMethod->WriteToLogfile( message );
-	dvcMethod->WriteMeshToVTKFile( dvcMethod->GetOutputDirectory()+"/PostProcessedSecondDVC.vtk" );
+	dvcMethod->WriteResultFile( "PostProcessedSecondDVC" );
 	
 	message = "Analysis completed at: "+dvcMethod->GetTime();
 	dvcMethod->WriteToLogfile( message );
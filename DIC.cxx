@@ -595,9 +595,12 @@ std::string GetLogfileName()
 	return this->m_LogfileName;
 }
 
-/** A function to write string data to a log file. */
+/** A function to write string data to a log file.  It can be called 
+ * from several threads at once. */
 void WriteToLogfile( std::string characters )
 {
+	#pragma omp critical(logfile)
+	{
 	std::ofstream outFile;
 	outFile.open(this->m_LogfileName.c_str(), std::ofstream::app);
 	if(!outFile.is_open())
@@ -611,7 +614,7 @@ void WriteToLogfile( std::string characters )
 	outFile << characters << std::endl;
 
 	outFile.close();
-
+	}
 }
 
 /** A function to set the output directory .*/
@@ -20,23 +20,42 @@
 #ifndef DICMESH_H
 #define DICMESH_H
 
+#include <algorithm>
 #include <cstring>
 #include <ctime>
+#include <map>
 #include "DIC.cxx"
+#include "MeshNeighbourhood.cxx"
+#include "SparseWeightMatrix.cxx"
+#include "MeshFieldStore.cxx"
+#include "MeshOutlierDetector.cxx"
+#include "MeshMedianFilter.cxx"
+#include "MeshStrainCalculator.cxx"
+#include "MovingLeastSquaresStrain.cxx"
+#include "StructuredGrid.cxx"
+#include "MeshRefiner.cxx"
+#include "GmshReader.cxx"
+#include "VTUWriter.cxx"
+#include "ResultsContainer.cxx"
+#include "ImageCache.cxx"
+#include "SymmetricEigensolver.cxx"
 #include "itkMesh.h"
 #include "itkTetrahedronCell.h"
 #include <vtkDoubleArray.h>
+#include <vtkFloatArray.h>
 #include <vtkUnstructuredGrid.h>
 #include <vtkPoints.h>
 #include <vtkCellArray.h>
+#include <vtkCell.h>
 #include <vtkUnstructuredGridWriter.h>
 #include <vtkPointData.h>
 #include <vtkCellData.h>
 #include <vtkSmartPointer.h>
 #include <vtkPKdTree.h>
 #include <vtkIdList.h>
-#include <vtkCellDerivatives.h>
-#include <vtkCellDataToPointData.h>
+#include <vtkIdTypeArray.h>
+#include <vtkCellLocator.h>
+#include <vtkGenericCell.h>
 #include <vtkMath.h>
 #include <vtkImageGaussianSmooth.h>
 #include <vtkImageData.h>
@@ -71,6 +90,11 @@ typedef		vtkSmartPointer<vtkUnstructuredGrid>	DataImagePointer;
 typedef		vtkSmartPointer<vtkPoints>				DataImagePointsPointer;
 typedef		vtkSmartPointer<vtkDoubleArray>			DataImagePixelPointer;
 
+typedef		MeshNeighbourhood::NodeIdType			NodeIdType;
+typedef		std::pair< double, double >				WeightMatrixKeyType; // (sigma, mean)
+typedef		std::map< WeightMatrixKeyType, SparseWeightMatrix >	WeightMatrixCacheType;
+typedef		MeshMedianFilter::MedianModeType		MedianModeType;
+
 
 
 /* Methods. **/
@@ -86,6 +110,25 @@ DICMesh()
 	m_pointsList = vtkSmartPointer<vtkIdList>::New(); // the points list for analysis
 	m_maxMeticValue = -0.00; // TODO: make this setable using a method
 	m_GlobalRegDownsampleValue = 3; // This value is the default downsample when preforming the global registration.
+	m_GlobalFixedImageSource = 0;
+	m_GlobalMovingImageSource = 0;
+	m_GlobalFixedImageSourceTime = 0;
+	m_GlobalMovingImageSourceTime = 0;
+	m_FixedImageKeySource = 0; // the content keys are computed when the cache is first used
+	m_MovingImageKeySource = 0;
+	m_FixedImageKeySourceTime = 0;
+	m_MovingImageKeySourceTime = 0;
+	m_NumberOfThreads = 1; // threads used by the mesh filters
+	m_NumberOfImageThreads = 0; // the registration threads
+	m_StrainsAreRaw = false;
+	m_PrincipalStrainsAreCurrent = false;
+	m_UseMovingLeastSquaresStrain = false; // use the mesh cells for the strains
+	m_ResultFileExtension = "vtk"; // write legacy ASCII vtk files
+	m_OutputPieces = 0; // one piece per thread in partitioned files
+	m_OutputCompressionLevel = 1; // fastest zlib compression for the xml files
+	m_MovingLeastSquaresNeighbours = 20;
+	m_MovingLeastSquaresRadius = 0; // use the nearest neighbours
+	m_MovingLeastSquaresOrder = 1;
 }
 
 /** Destructor **/
@@ -112,10 +155,9 @@ void CalculateInitialMovingImageRegionList()
 double *GetMovingImageRegionLocationFromIndex( vtkIdType i)
 {
 	double *currentPoint	= new double[3];
-	double *currentValue	= new double[3];
+	double *currentValue	= this->m_Fields.GetDisplacement().GetTuplePointer( i );
 	double *currentLocation	= new double[3];
 	m_DataImage->GetPoint( i, currentPoint ); // get the current point location
-	this->m_DataImage->GetPointData()->GetArray("Displacement")->GetTuple( i, currentValue );
 	*currentLocation		= *currentPoint		+ *currentValue; // set the current point to the original local to the disp
 	*(currentLocation +1)	= *(currentPoint +1)+ *(currentValue +1);
 	*(currentLocation +2)	= *(currentPoint +2)+ *(currentValue +2);
@@ -140,171 +182,111 @@ void CalculateInitialFixedImageRegionList()
 	}
 }
 
-/** A function to read a gmsh file. */
+/** A function to read a gmsh file.  MSH 2 and MSH 4.1 files are read
+ * in ASCII or binary form and the linear and quadratic tets are kept.
+ * The points and cells are copied into the data image in bulk.
+ * see GmshReader */
 void ReadMeshFromGmshFile( std::string gmshFileName )
 {
 	std::stringstream msg("");
 	
-	std::ifstream gmshFileInput(gmshFileName.c_str());
-	//open file for reading
-	if (!gmshFileInput){
+	GmshReader< vtkIdType > reader;
+	if ( !reader.Read( gmshFileName, this->m_NumberOfThreads ) ){
 		msg.str(" ");
-		msg << "Cannot open Gmsh file for reading."<<std::endl <<
+		msg << reader.GetErrorMessage() << std::endl <<
 			"Please check the filename and try again.";
 		this->WriteToLogfile( msg.str() );
 		std::exit(1);
 	}
-	char str[255];
-	gmshFileInput.getline(str,255);
 	
-	// read in the nodes /
-	while ( strcmp(str,"$Nodes") ){
-		gmshFileInput.getline(str,255); // skip all lines until we get to "$Nodes"
+	// only note each unsupported element type once
+	const GmshReader< vtkIdType >::ElementCountType &skipped = reader.GetSkippedElements();
+	for ( GmshReader< vtkIdType >::ElementCountType::const_iterator it = skipped.begin(); it != skipped.end(); ++it ){
+		msg.str("");
+		msg << "Unsupported element types detected!"<<std::endl << "Unsupported type = "<<it->first<<", "<<it->second<<" elements skipped."<<std::endl <<
+			"Continuing with the file input.";
+		this->WriteToLogfile( msg.str() );
 	}
-	unsigned int numberOfNodes;
-	gmshFileInput >> numberOfNodes; // the next line will be the number of nodes
 	
-	// create the data image
+	// create the data image. The displacement and optimizer values are allocated when the image is set.
 	DataImagePointsPointer		points				= DataImagePointsPointer::New();
 	DataImagePointer			meshImage			= DataImagePointer::New();
-	DataImagePixelPointer		displacementData	= DataImagePixelPointer::New();
-	DataImagePixelPointer		optimizerData		= DataImagePixelPointer::New();
 	
+	const std::vector< double > &nodes = reader.GetPoints();
+	long numberOfNodes = nodes.size()/3;
+	points->SetDataTypeToFloat();
+	points->SetNumberOfPoints( numberOfNodes );
+	float *pointBuffer = static_cast< float* >( points->GetData()->GetVoidPointer( 0 ) );
+	#pragma omp parallel for num_threads(this->m_NumberOfThreads) schedule(static)
+	for ( long i = 0; i < 3*numberOfNodes; ++i ){
+		pointBuffer[i] = (float)nodes[i];
+	}
 	meshImage->SetPoints( points );
 	
-	displacementData->SetNumberOfComponents(3);
-	displacementData->SetName("Displacement");
-	meshImage->GetPointData()->AddArray( displacementData );
+	const std::vector< vtkIdType > &cells = reader.GetCells();
+	vtkSmartPointer<vtkIdTypeArray> cellBuffer = vtkSmartPointer<vtkIdTypeArray>::New();
+	cellBuffer->SetNumberOfValues( cells.size() );
+	if ( !cells.empty() ) std::memcpy( cellBuffer->GetPointer( 0 ), &cells[0], cells.size()*sizeof(vtkIdType) );
+	vtkSmartPointer<vtkCellArray> cellArray = vtkSmartPointer<vtkCellArray>::New();
+	cellArray->SetCells( reader.GetCellTypes().size(), cellBuffer );
+	std::vector< int > cellTypes( reader.GetCellTypes() );
+	meshImage->SetCells( cellTypes.empty() ? 0 : &cellTypes[0], cellArray );
 	
-	optimizerData->SetNumberOfComponents(1);
-	optimizerData->SetName("Optimizer Value");
-	meshImage->GetPointData()->AddArray( optimizerData );
-	
-	meshImage->GetPoints()->SetNumberOfPoints( (vtkIdType)numberOfNodes );
-	for (unsigned int i = 0; i < numberOfNodes; ++i){ // run through the number of nodes and put them in the pointset
-		unsigned int pointNumber;
-		float x, y, z;
-		gmshFileInput >> pointNumber >> x >> y >> z;
-		meshImage->GetPoints()->SetPoint(i,x,y,z);
-	}
-	
-	// read in the elements. /
-	while ( strcmp(str,"$Elements") ){
-		gmshFileInput.getline(str,255); // skip all lines until we get to "$Elements"
+	this->SetDataImage( meshImage );
+}
+
+/** A function to set the displacement of every node by interpolating
+ * the displacements of another mesh, e.g. the result of a coarse DVC.
+ * A node inside a cell of the source mesh gets the displacement at its
+ * parametric location in the cell (the barycentric weights for a tet).
+ * A node outside the source mesh gets the displacement of the closest
+ * point on the source mesh. */
+void InterpolateDisplacementFromMesh( vtkUnstructuredGrid *sourceImage )
+{
+	vtkDataArray *sourceDisplacement = sourceImage->GetPointData()->GetArray("Displacement");
+	if ( !sourceDisplacement || sourceDisplacement->GetNumberOfComponents() != 3 ){
+		std::stringstream msg("");
+		msg << "The source mesh has no displacements to interpolate.";
+		this->WriteToLogfile( msg.str() );
+		std::exit(1);
 	}
-	unsigned int numberOfElements;
-	gmshFileInput >> numberOfElements; // the next line will be the number of elements
 	
-	for ( unsigned int i = 0; i < numberOfElements; ++i ){
-		unsigned int elNo, elTyp;
-		gmshFileInput >> elNo >> elTyp;
-		
-		//~ if (elTyp == 1){ // 2 node line
-			//~ unsigned int elNTags;
-			//~ gmshFileInput >> elNTags;
-			//~ for (unsigned int j = 0; j < elNTags+1; ++j){
-				//~ gmshFileInput.ignore(255,' ');
-			//~ }
-			//~ int nodes[2];
-			//~ gmshFileInput >> nodes[0] >> nodes[1];
-			//~ vtkIdType ptIds[] = { nodes[0]-1, nodes[1]-1 };
-			//~ meshImage->InsertNextCell(3, 2, ptIds);
-		//~ }
-		
-		//~ if (elTyp == 2){ // 3 node triangle
-			//~ unsigned int elNTags;
-			//~ gmshFileInput >> elNTags;
-			//~ for (unsigned int j = 0; j < elNTags+1; ++j){
-				//~ gmshFileInput.ignore(255,' ');
-			//~ }
-			//~ int nodes[3];
-			//~ gmshFileInput >> nodes[0] >> nodes[1] >> nodes[2];
-			//~ vtkIdType ptIds[] = { nodes[0]-1, nodes[1]-1, nodes[2]-1 };
-			//~ meshImage->InsertNextCell(5, 3, ptIds);
-		//~ }
-		
-		if (elTyp == 4){ // linear tet element
-			unsigned int elNTags;
-			gmshFileInput >> elNTags;
-			for (unsigned int j = 0;j < elNTags+1; ++j){ // ignore tags
-				gmshFileInput.ignore(255,' ');
-			}
-			int nodes[4];
-			gmshFileInput >> nodes[0] >> nodes[1] >> nodes[2] >> nodes[3]; 
-			vtkIdType ptIds[] = { nodes[0]-1, nodes[1]-1, nodes[2]-1, nodes[3]-1 };
-			meshImage->InsertNextCell(10, 4, ptIds);
+	vtkSmartPointer<vtkCellLocator> locator = vtkSmartPointer<vtkCellLocator>::New();
+	locator->SetDataSet( sourceImage );
+	locator->BuildLocator();
+	vtkSmartPointer<vtkGenericCell> cell = vtkSmartPointer<vtkGenericCell>::New();
+	
+	MeshField &displacement = this->m_Fields.GetDisplacement();
+	vtkIdType nPoints = this->m_DataImage->GetNumberOfPoints();
+	vtkIdType nOutside = 0;
+	for ( vtkIdType i = 0; i < nPoints; ++i ){
+		double point[3], pcoords[3], weights[VTK_CELL_SIZE];
+		this->m_DataImage->GetPoint( i, point );
+		vtkIdType cellId = locator->FindCell( point, 0, cell, pcoords, weights );
+		if ( cellId < 0 ){
+			double closestPoint[3], dist2;
+			int subId;
+			locator->FindClosestPoint( point, closestPoint, cell, cellId, subId, dist2 );
+			if ( cellId < 0 ) continue;
+			cell->EvaluatePosition( closestPoint, 0, subId, pcoords, dist2, weights );
+			++nOutside;
 		}
 		
-		//~ if (elTyp == 8){ // quadratic line element
-			//~ std::stringstream msg("");
-			//~ msg << "Warning: Qadratic line element in gmsh file."<<std::endl << "Qadratic lines are not supported" <<std::endl <<
-				//~ "Continuing with the file input."<<std::endl; // not supported because they give bad jaboians in the strain calcs
-			//~ this->WriteToLogfile( msg.str() );
-			//~ gmshFileInput.ignore(255,'\n');
-			//~ continue;
-		//~ }
-		
-		//~ if (elTyp == 9){ //quadratic triangle element
-			//~ unsigned int elNTags;
-			//~ gmshFileInput >> elNTags;
-			//~ for (unsigned int j = 0; j< elNTags+1; ++j){ //ignore tags
-				//~ gmshFileInput.ignore(255,' ');
-			//~ }
-			//~ int nodes[6];
-			//~ gmshFileInput >> nodes[0] >> nodes[1] >> nodes[2] >> nodes[3] >> nodes[4] >> nodes[5];
-			//~ vtkIdType ptIds[] = { nodes[0]-1, nodes[1]-1, nodes[2]-1, nodes[3]-1, nodes[4]-1, nodes[5]-1};
-			//~ meshImage->InsertNextCell(22,6,ptIds);
-		//~ }
-		
-		if (elTyp == 11){ // quatratic tet element
-			unsigned int elNTags;
-			gmshFileInput >> elNTags;
-			for (unsigned int j = 0;j < elNTags+1; ++j){ // ignore tags
-				gmshFileInput.ignore(255,' ');
-			}
-			int nodes[10];//, node1, node2, node3, node4, node5, node6, node7, node8, node9;
-			gmshFileInput >> nodes[0] >> nodes[1] >> nodes[2] >> nodes[3] >> nodes[4] >> nodes[5] >> nodes[6] >> nodes[7] >> nodes[9] >> nodes[8]; // nodes[8] and modes[9] intensionally switched due to vtk/gmsh node numbering differences
-			vtkIdType ptIds[] = { nodes[0]-1, nodes[1]-1, nodes[2]-1, nodes[3]-1, nodes[4]-1, nodes[5]-1, nodes[6]-1, nodes[7]-1, nodes[8]-1, nodes[9]-1 };
-			meshImage->InsertNextCell(24, 10, ptIds);
+		double *value = displacement.GetTuplePointer( i );
+		value[0] = value[1] = value[2] = 0;
+		for ( vtkIdType j = 0; j < cell->GetNumberOfPoints(); ++j ){
+			double *sourceValue = sourceDisplacement->GetTuple3( cell->GetPointId( j ) );
+			value[0] = value[0] + weights[j]*sourceValue[0];
+			value[1] = value[1] + weights[j]*sourceValue[1];
+			value[2] = value[2] + weights[j]*sourceValue[2];
 		}
-		
-		//~ if (elTyp == 15){ // 3D vertex
-			//~ unsigned int elNTags;
-			//~ gmshFileInput >> elNTags;
-			//~ for (unsigned int j = 0; j< elNTags+1; ++j){ //ignore tags
-				//~ gmshFileInput.ignore(255,' ');
-			//~ }
-			//~ int nodes[1];
-			//~ gmshFileInput >> nodes[0];
-			//~ vtkIdType ptIds[] = { nodes[0]-1 };
-			//~ meshImage->InsertNextCell(1,1,ptIds);
-		//~ }
-		
-		//~ if (elTyp != 1 && elTyp != 2 && elTyp != 4 && elTyp != 8 && elTyp != 9 && elTyp != 11 && elTyp != 15){ // only support the above element types
-			//~ std::stringstream msg("");
-			//~ msg << "Unsupported element types detected!"<<std::endl << "Unsupported type = "<<elTyp<<std::endl <<
-				//~ "Continuing with the file input."<<std::endl;
-			//~ this->WriteToLogfile( msg.str() );
-			//~ gmshFileInput.ignore(255,'\n');
-			//~ continue;
-		//~ }
-		
-		if (elTyp != 4 && elTyp != 11){ // only support the above element types
-			std::stringstream msg("");
-			msg << "Unsupported element types detected!"<<std::endl << "Unsupported type = "<<elTyp<<std::endl <<
-				"Continuing with the file input.";
-			this->WriteToLogfile( msg.str() );
-			gmshFileInput.ignore(255,'\n');
-			continue;
-		}	
-	}
-		
-	for ( unsigned int i = 0; i < numberOfNodes; ++i ){
-		meshImage->GetPointData()->GetArray("Displacement")->InsertNextTuple3( 0, 0, 0 );
-		meshImage->GetPointData()->GetArray("Optimizer Value")->InsertNextTuple1( 0 );
 	}
 	
-	this->SetDataImage( meshImage );
+	if ( nOutside > 0 ){
+		std::stringstream msg("");
+		msg << nOutside << " of "<<nPoints<<" points are outside the source mesh and use the displacement of its closest point."<<std::endl;
+		this->WriteToLogfile( msg.str() );
+	}
 }
 
 /** A fucntion to read a vtk mesh file **/
@@ -316,37 +298,97 @@ void ReadVTKMesh(std::string meshFileName )
 		this->SetDataImage( vtkReader->GetOutput() );
 }
 
-/** A function to fill a mesh with an single value. */
-void SetMeshToSingleValue( double initialData[] )
+/** A function to generate a structured grid of nodes with the given 
+ * spacing over the box bounds (xmin, xmax, ymin, ymax, zmin, zmax)
+ * instead of reading a mesh.  The cells of the data image are the
+ * voxels of the grid.  The neighbours of the nodes come from the grid 
+ * stencil and the strains are calculated by finite differences.
+ * see StructuredGrid */
+void GenerateStructuredGrid( const double *bounds, double spacing )
 {
-	for ( unsigned int i = 0; i < this->m_DataImage->GetNumberOfPoints(); ++i ){
-		this->m_DataImage->GetPointData()->GetArray("Displacement")->SetTuple( i , initialData );
+	StructuredGrid grid;
+	grid.SetFromBounds( bounds, spacing );
+	const NodeIdType *dims = grid.GetDimensions();
+	
+	vtkSmartPointer<vtkPoints> nodes = vtkSmartPointer<vtkPoints>::New();
+	nodes->SetNumberOfPoints( grid.GetNumberOfNodes() );
+	for ( NodeIdType k = 0; k < dims[2]; ++k ){
+		for ( NodeIdType j = 0; j < dims[1]; ++j ){
+			for ( NodeIdType i = 0; i < dims[0]; ++i ){
+				double location[3];
+				grid.GetNodeLocation( i, j, k, location );
+				nodes->SetPoint( grid.GetNodeId( i, j, k ), location );
+			}
+		}
 	}
+	
+	DataImagePointer meshImage = DataImagePointer::New();
+	meshImage->SetPoints( nodes );
+	meshImage->Allocate( grid.GetNumberOfCells() );
+	for ( NodeIdType k = 0; k + 1 < dims[2]; ++k ){
+		for ( NodeIdType j = 0; j + 1 < dims[1]; ++j ){
+			for ( NodeIdType i = 0; i + 1 < dims[0]; ++i ){
+				NodeIdType cellNodes[8];
+				grid.GetCellNodes( i, j, k, cellNodes );
+				vtkIdType ptIds[8];
+				std::copy( cellNodes, cellNodes + 8, ptIds );
+				meshImage->InsertNextCell( VTK_VOXEL, 8, ptIds );
+			}
+		}
+	}
+	
+	this->SetDataImage( meshImage );
+	this->m_StructuredGrid = grid; // the generated spacing rather than the one found from the nodes
+	
+	std::stringstream msg("");
+	msg << "Generated a structured grid of "<<dims[0]<<" x "<<dims[1]<<" x "<<dims[2]<<" nodes with a spacing of "<<spacing<<"."<<std::endl;
+	this->WriteToLogfile( msg.str() );
+}
+
+/** Get the structured grid the nodes were generated on, empty if the
+ * mesh was read. */
+const StructuredGrid &GetStructuredGrid() const
+{
+	return this->m_StructuredGrid;
+}
+
+/** Set the structured grid of the nodes of the data image, e.g. when
+ * a grid mesh is set again with SetDataImage, which clears it. */
+void SetStructuredGrid( const StructuredGrid &grid )
+{
+	this->m_StructuredGrid = grid;
+	this->m_StrainDisplacements.clear();
+	this->m_PrincipalStrainsAreCurrent = false;
+}
 
+/** A function to fill a mesh with an single value. */
+void SetMeshToSingleValue( double initialData[] )
+{
+	this->m_Fields.GetDisplacement().Fill( initialData );
 }
 
 /** Get a pixel value from the mesh using an index */
 void GetMeshPixelValueFromIndex( vtkIdType index, double *pixel )
 {
-	this->m_DataImage->GetPointData()->GetArray("Displacement")->GetTuple( index, pixel );
+	this->m_Fields.GetDisplacement().GetTuple( index, pixel );
 }
 
 /** Get the value of the optimizer at a certain point. */
 void GetMeshPixelOptimizerFromIndex( vtkIdType index, double *opt )
 {
-	this->m_DataImage->GetPointData()->GetArray("Optimizer Value")->GetTuple( index, opt );
+	this->m_Fields.GetOptimizerValue().GetTuple( index, opt );
 }
 
 /** Set a pixel value in the mesh using an index */
 void SetMeshPixelValueFromIndex(vtkIdType index, double *pixel )
 {
-	this->m_DataImage->GetPointData()->GetArray("Displacement")->SetTuple( index, pixel );
+	this->m_Fields.GetDisplacement().SetTuple( index, pixel );
 }
 
 /** Set the value of the optimizer at a certain point. */
 void SetMeshPixelOptimizerFromIndex( vtkIdType index, double *opt )
 {
-	this->m_DataImage->GetPointData()->GetArray("Optimizer Value")->SetTuple( index, opt );
+	this->m_Fields.GetOptimizerValue().SetTuple( index, opt );
 }
 
 /** Get a point by index from the mesh. */
@@ -355,21 +397,179 @@ void GetMeshPointLocationFromIndex( vtkIdType index, double  *point )
 	this->m_DataImage->GetPoint(index,point);
 }
 
-/** Set the data Image. */
+/** Set the data Image. The displacement, optimizer value and strain 
+ * arrays of a new image are copied into the field store. */
 void SetDataImage( vtkUnstructuredGrid *initialDataImage )
 {
 	if (this->m_DataImage.GetPointer() != initialDataImage){
 		this->m_DataImage = initialDataImage;
+		this->UpdateFieldsFromDataImage();
 	}
 	this->KDTreeSetAndBuild();
+	
+	// the neighbourhood and weights only need to be rebuilt if the geometry has changed
+	if ( this->m_GeometryPoints.GetPointer() != this->m_DataImage->GetPoints() || this->m_GeometryCells.GetPointer() != this->m_DataImage->GetCells() ){
+		this->m_GeometryPoints = this->m_DataImage->GetPoints();
+		this->m_GeometryCells = this->m_DataImage->GetCells();
+		this->m_Neighbourhood.Clear();
+		this->m_NodeLocations.clear();
+		this->m_WeightMatrixCache.clear();
+		this->m_StrainCalculator.Clear();
+		this->m_MovingLeastSquaresStrain.Clear();
+		this->m_StructuredGrid.Clear();
+		this->FindStructuredGrid();
+		this->m_StrainDisplacements.clear();
+		this->m_PrincipalStrainsAreCurrent = false;
+	}
 }
 
-/** Get the pointer to the data image. */
+/** A function to find the structured grid of a data image whose nodes
+ * and voxels are those of a generated grid, e.g. a grid result read 
+ * again to restart the analysis, so that its neighbourhood and strains
+ * come from the grid again.  The structured grid is left empty for 
+ * other meshes. */
+void FindStructuredGrid()
+{
+	vtkIdType nCells = this->m_DataImage->GetNumberOfCells();
+	if ( nCells == 0 || this->m_DataImage->GetCellType( 0 ) != VTK_VOXEL ) return;
+	
+	vtkIdType nPoints = this->m_DataImage->GetNumberOfPoints();
+	std::vector< double > locations( 3*nPoints );
+	for ( vtkIdType i = 0; i < nPoints; ++i ) this->m_DataImage->GetPoint( i, &locations[3*i] );
+	StructuredGrid grid;
+	if ( !grid.SetFromNodes( &locations[0], nPoints ) || (vtkIdType)grid.GetNumberOfCells() != nCells ) return;
+	
+	// the voxels must be those of the grid in the grid order
+	const NodeIdType *dims = grid.GetDimensions();
+	vtkIdType cellId = 0;
+	for ( NodeIdType k = 0; k + 1 < dims[2]; ++k ){
+		for ( NodeIdType j = 0; j + 1 < dims[1]; ++j ){
+			for ( NodeIdType i = 0; i + 1 < dims[0]; ++i, ++cellId ){
+				if ( this->m_DataImage->GetCellType( cellId ) != VTK_VOXEL ) return;
+				vtkIdType nCellPoints, *cellPoints;
+				this->m_DataImage->GetCellPoints( cellId, nCellPoints, cellPoints );
+				NodeIdType cellNodes[8];
+				grid.GetCellNodes( i, j, k, cellNodes );
+				if ( nCellPoints != 8 || !std::equal( cellNodes, cellNodes + 8, cellPoints ) ) return;
+			}
+		}
+	}
+	
+	this->m_StructuredGrid = grid;
+	std::stringstream msg("");
+	msg << "Found a structured grid of "<<dims[0]<<" x "<<dims[1]<<" x "<<dims[2]<<" nodes in the mesh."<<std::endl;
+	this->WriteToLogfile( msg.str() );
+}
+
+/** Get the bounds of the data image.  Unlike GetDataImage the field 
+ * values are not copied into the image arrays.  Returns false if there
+ * is no data image. */
+bool GetDataImageBounds( double bounds[6] ) const
+{
+	if ( !this->m_DataImage ) return false;
+	this->m_DataImage->GetBounds( bounds );
+	return true;
+}
+
+/** Get the pointer to the data image.  The current field values are
+ * copied into the image arrays first. */
 DataImagePointer GetDataImage()
 {
+	this->UpdateDataImageFromFields();
 	return this->m_DataImage;
 }
 
+/** A function to copy the arrays of the data image into the field 
+ * store. Missing displacement and optimizer values are set to 0 and
+ * missing strains are left unallocated. */
+void UpdateFieldsFromDataImage()
+{
+	this->m_Fields.Initialize( this->m_DataImage->GetNumberOfPoints(), this->m_DataImage->GetNumberOfCells() );
+	this->CopyArrayToField( this->m_DataImage->GetPointData()->GetArray("Displacement"), this->m_Fields.GetDisplacement() );
+	this->CopyArrayToField( this->m_DataImage->GetPointData()->GetArray("Optimizer Value"), this->m_Fields.GetOptimizerValue() );
+	this->CopyStrainArrayToField( this->m_DataImage->GetPointData()->GetArray("Strain"), this->m_Fields.GetStrain() );
+	this->CopyStrainArrayToField( this->m_DataImage->GetCellData()->GetArray("Strain"), this->m_Fields.GetCellStrain() );
+	this->m_StrainsAreRaw = false;
+	this->m_PrincipalStrainsAreCurrent = false;
+}
+
+/** A function to copy the fields in the field store into the arrays of 
+ * the data image.  This is done only when the image is needed for
+ * output. */
+void UpdateDataImageFromFields()
+{
+	this->CopyFieldToArray( this->m_Fields.GetDisplacement(), "Displacement", this->m_DataImage->GetPointData() );
+	this->CopyFieldToArray( this->m_Fields.GetOptimizerValue(), "Optimizer Value", this->m_DataImage->GetPointData() );
+	this->CopyStrainFieldToArray( this->m_Fields.GetStrain(), this->m_DataImage->GetPointData() );
+	this->CopyStrainFieldToArray( this->m_Fields.GetCellStrain(), this->m_DataImage->GetCellData() );
+}
+
+/** A function to copy a vtk array into a field. If the array does not
+ * exist the field is unchanged. */
+void CopyArrayToField( vtkDataArray *array, MeshField &field )
+{
+	if ( !array ) {return;}
+	
+	vtkIdType nTuples = array->GetNumberOfTuples();
+	unsigned int nComponents = array->GetNumberOfComponents();
+	field.Allocate( nTuples, nComponents );
+	double *values = field.GetPointer();
+	for ( vtkIdType i = 0; i < nTuples; ++i ){
+		array->GetTuple( i, values + nComponents*i );
+	}
+}
+
+/** A function to copy a field into the named array of the point or cell
+ * data. The array is created if it does not exist. */
+void CopyFieldToArray( MeshField &field, const char *arrayName, vtkDataSetAttributes *data )
+{
+	if ( !field.IsAllocated() ) {return;}
+	
+	DataImagePixelPointer array = vtkDoubleArray::SafeDownCast( data->GetArray( arrayName ) );
+	if ( !array ){
+		data->RemoveArray( arrayName ); // an array of another type may exist
+		array = DataImagePixelPointer::New();
+		array->SetName( arrayName );
+		data->AddArray( array );
+	}
+	array->SetNumberOfComponents( field.GetNumberOfComponents() );
+	array->SetNumberOfTuples( field.GetNumberOfTuples() );
+	std::memcpy( array->GetPointer( 0 ), field.GetPointer(), field.GetNumberOfTuples()*field.GetNumberOfComponents()*sizeof(double) );
+	array->Modified();
+}
+
+/** A function to copy a 9 component "Strain" array into a strain field.
+ * If the array does not exist the field is unchanged. */
+void CopyStrainArrayToField( vtkDataArray *array, MeshStrainField &field )
+{
+	if ( !array || array->GetNumberOfComponents() != 9 ) {return;}
+	
+	vtkIdType nTuples = array->GetNumberOfTuples();
+	field.Allocate( nTuples, MeshStrainCalculator::NumberOfStrainComponents );
+	StrainValueType *values = field.GetPointer();
+	for ( vtkIdType i = 0; i < nTuples; ++i ){
+		double tensor[9];
+		array->GetTuple( i, tensor );
+		MeshStrainCalculator::ReduceStrain( tensor, values + MeshStrainCalculator::NumberOfStrainComponents*i );
+	}
+}
+
+/** A function to copy a strain field into the "Strain" array of the 
+ * point or cell data.  The tensors are expanded to 9 components. */
+void CopyStrainFieldToArray( MeshStrainField &field, vtkDataSetAttributes *data )
+{
+	if ( !field.IsAllocated() ) {return;}
+	
+	long nTuples = (long)field.GetNumberOfTuples();
+	double *tensors = this->GetOutputArray( data, "Strain", 9, nTuples );
+	const StrainValueType *values = field.GetPointer();
+	#pragma omp parallel for num_threads(this->m_NumberOfThreads) schedule(static)
+	for ( long i = 0; i < nTuples; ++i ){
+		MeshStrainCalculator::ExpandStrain( values + MeshStrainCalculator::NumberOfStrainComponents*i, tensors + 9*i );
+	}
+	data->GetArray( "Strain" )->Modified();
+}
+
 /** a function to execute the analysis. */
 void ExecuteDIC()
 {
@@ -502,21 +702,198 @@ void ExecuteDIC()
 			"Optimizer stop condition: " << this->m_Registration->GetOptimizer()->GetStopConditionDescription() << std::endl <<
 			"Final optimizer value: "<<*lastOpt<<std::endl;
 		this->WriteToLogfile( msg.str() );
-		std::string debugFile = this->m_OutputDirectory + "/debug.vtk";
-		this->WriteMeshToVTKFile( debugFile );
+		// the progress file is rewritten after every point, so it is kept out of the results container
+		if ( !this->m_ResultFileExtension.compare( "dvcr" ) ) this->WriteMeshToVTKFile( this->m_OutputDirectory + "/debug.vtu" );
+		else this->WriteResultFile( "debug" );
 	}
 }
 
-/** A function to write the mesh data to a VTK ASCII file. */
+/** A function to write the mesh data to a VTK file.  A file name 
+ * ending in .vtu is written as a binary VTK XML file, compressed if the
+ * compression level is not 0, a file name ending in .pvtu as a set of 
+ * such files written concurrently, and other files as legacy ASCII vtk.
+ * see VTUWriter */
 void WriteMeshToVTKFile(std::string outFile)
 {
+	this->UpdateDataImageFromFields();
+	this->WriteImageToVTKFile( outFile, this->m_DataImage );
+}
+
+/** A function to write an image sharing the mesh of the data image to
+ * a VTK file, in the format given by the file name as for 
+ * WriteMeshToVTKFile. */
+void WriteImageToVTKFile( std::string outFile, vtkUnstructuredGrid *image )
+{
+	if ( outFile.size() > 3 && !outFile.compare( outFile.size()-3, 3, "vtu" ) ){
+		VTUWriter writer;
+		writer.SetCompressionLevel( this->m_OutputCompressionLevel );
+		writer.SetNumberOfThreads( this->m_NumberOfThreads );
+		bool written;
+		if ( outFile.size() > 4 && !outFile.compare( outFile.size()-4, 4, "pvtu" ) ){
+			written = writer.WritePieces( outFile, image, 
+				this->m_OutputPieces > 0 ? this->m_OutputPieces : this->m_NumberOfThreads );
+		}
+		else written = writer.Write( outFile, image );
+		if ( !written ){
+			std::stringstream msg("");
+			msg << "Cannot write the results file "<<outFile<<"."<<std::endl;
+			this->WriteToLogfile( msg.str() );
+		}
+		return;
+	}
+	
 	vtkSmartPointer<vtkUnstructuredGridWriter>	writer = vtkSmartPointer<vtkUnstructuredGridWriter>::New();
 	writer->SetFileName( outFile.c_str() );
 	writer->SetFileTypeToASCII();
-	writer->SetInput( this->m_DataImage );
+	writer->SetInput( image );
 	writer->Update();
 }
 
+/** A function to write a result file, named by GetResultFileName, with
+ * the arrays chosen for it by SetResultArrays.  In the dvcr format the
+ * arrays are appended to the results container as the stage name, the
+ * container being created anew by the first result of the run.  If the
+ * results cannot be appended they are written to a vtu file instead.
+ * see ResultsContainer */
+void WriteResultFile( std::string name )
+{
+	this->UpdateDataImageFromFields();
+	DataImagePointer outputImage = this->m_DataImage;
+	std::map< std::string, std::string >::const_iterator arrays = this->m_ResultArrays.find( name );
+	if ( arrays != this->m_ResultArrays.end() ) outputImage = this->GetOutputImage( arrays->second );
+	
+	if ( !this->m_ResultFileExtension.compare( "dvcr" ) ){
+		std::string fileName = this->GetResultFileName( name );
+		ResultsContainer container;
+		container.SetNumberOfThreads( this->m_NumberOfThreads );
+		// the results of an earlier run into the same folder are replaced
+		if ( this->m_ResultContainerFileName != fileName && container.Create( fileName ) ){
+			this->m_ResultContainerFileName = fileName;
+		}
+		if ( this->m_ResultContainerFileName == fileName && container.AppendStage( fileName, name, outputImage ) ) return;
+		std::string vtuFileName = this->m_OutputDirectory + "/" + name + ".vtu";
+		std::stringstream msg("");
+		msg << "Cannot append the results to "<<fileName<<", they are written to "<<vtuFileName<<"."<<std::endl;
+		std::cout<<msg.str();
+		this->WriteToLogfile( msg.str() );
+		this->WriteImageToVTKFile( vtuFileName, outputImage );
+		return;
+	}
+	this->WriteImageToVTKFile( this->GetResultFileName( name ), outputImage );
+}
+
+/** A function to choose the arrays written to the named result file.
+ * The arrays are a comma separated list; every entry selects the point
+ * and cell arrays whose names begin with it, or only the point or the
+ * cell arrays if it is prefixed with point: or cell:.  The entry all 
+ * selects every array (the default) and the entry float writes the 
+ * double arrays in single precision, e.g. 
+ * "point:Displacement,cell:Strain,float". */
+void SetResultArrays( std::string name, std::string arrays )
+{
+	this->m_ResultArrays[ name ] = arrays;
+}
+
+/** A function to make an image that shares the points and cells of the
+ * data image and holds the chosen arrays, see SetResultArrays.  The
+ * arrays are shared unless they are converted to single precision. */
+DataImagePointer GetOutputImage( std::string arrays )
+{
+	// parse the entries, an empty name selects every array
+	std::vector< std::string > pointNames, cellNames;
+	bool singlePrecision = false;
+	std::stringstream entries( arrays );
+	std::string entry;
+	while ( std::getline( entries, entry, ',' ) ){
+		std::size_t first = entry.find_first_not_of( " \t" );
+		if ( first == std::string::npos ) continue;
+		entry = entry.substr( first, entry.find_last_not_of( " \t" ) - first + 1 );
+		if ( !entry.compare( "float" ) ) {singlePrecision = true; continue;}
+		bool point = true, cell = true;
+		if ( !entry.compare( 0, 6, "point:" ) ) {entry.erase( 0, 6 ); cell = false;}
+		else if ( !entry.compare( 0, 5, "cell:" ) ) {entry.erase( 0, 5 ); point = false;}
+		if ( !entry.compare( "all" ) ) entry.clear();
+		if ( point ) pointNames.push_back( entry );
+		if ( cell ) cellNames.push_back( entry );
+	}
+	if ( pointNames.empty() && cellNames.empty() ){
+		pointNames.push_back( "" );
+		cellNames.push_back( "" );
+	}
+	
+	DataImagePointer outputImage = DataImagePointer::New();
+	outputImage->CopyStructure( this->m_DataImage );
+	this->CopyOutputArrays( this->m_DataImage->GetPointData(), pointNames, singlePrecision, outputImage->GetPointData() );
+	this->CopyOutputArrays( this->m_DataImage->GetCellData(), cellNames, singlePrecision, outputImage->GetCellData() );
+	return outputImage;
+}
+
+/** A function to add the arrays whose names begin with one of the names
+ * to the output data, converting the double arrays to float if asked. */
+void CopyOutputArrays( vtkDataSetAttributes *data, const std::vector< std::string > &names, bool singlePrecision, vtkDataSetAttributes *outputData )
+{
+	for ( int i = 0; i < data->GetNumberOfArrays(); ++i ){
+		vtkDataArray *array = data->GetArray( i );
+		if ( !array || !array->GetName() ) continue;
+		std::string arrayName = array->GetName();
+		bool selected = false;
+		for ( std::size_t j = 0; j < names.size() && !selected; ++j ){
+			selected = !arrayName.compare( 0, names[j].size(), names[j] );
+		}
+		if ( !selected ) continue;
+		
+		vtkDoubleArray *doubleArray = vtkDoubleArray::SafeDownCast( array );
+		if ( !singlePrecision || !doubleArray ){
+			outputData->AddArray( array );
+			continue;
+		}
+		vtkSmartPointer<vtkFloatArray> floatArray = vtkSmartPointer<vtkFloatArray>::New();
+		floatArray->SetName( array->GetName() );
+		floatArray->SetNumberOfComponents( array->GetNumberOfComponents() );
+		floatArray->SetNumberOfTuples( array->GetNumberOfTuples() );
+		long nValues = (long)array->GetNumberOfTuples()*array->GetNumberOfComponents();
+		const double *values = doubleArray->GetPointer( 0 );
+		float *floatValues = floatArray->GetPointer( 0 );
+		#pragma omp parallel for num_threads(this->m_NumberOfThreads) schedule(static)
+		for ( long j = 0; j < nValues; ++j ){
+			floatValues[j] = (float)values[j];
+		}
+		outputData->AddArray( floatArray );
+	}
+}
+
+/** A function to choose the format of the result files by their 
+ * extension: vtk for legacy ASCII files (the default), vtu for binary 
+ * VTK XML files, pvtu for partitioned VTK XML files or dvcr for one 
+ * results container holding every result. */
+void SetOutputFormat( std::string format )
+{
+	this->m_ResultFileExtension = format;
+}
+
+/** A function to set the number of pieces of the partitioned (.pvtu)
+ * result files, 0 for one piece per thread. */
+void SetNumberOfOutputPieces( unsigned int nPieces )
+{
+	this->m_OutputPieces = nPieces;
+}
+
+/** A function to set the zlib compression level of the VTK XML result 
+ * files, 0 for no compression to 9 for the smallest files. */
+void SetOutputCompressionLevel( int level )
+{
+	this->m_OutputCompressionLevel = level;
+}
+
+/** A function to get the full name of a result file in the output 
+ * directory, with the extension of the output format.  All the results
+ * share the Results.dvcr file in the dvcr format. */
+std::string GetResultFileName( std::string name )
+{
+	if ( !this->m_ResultFileExtension.compare( "dvcr" ) ) return this->m_OutputDirectory + "/Results.dvcr";
+	return this->m_OutputDirectory + "/" + name + "." + this->m_ResultFileExtension;
+}
+
 /** A function to build the KDTree locator from the data image.  This method
  * is called when the data image is set. */
 void KDTreeSetAndBuild()
@@ -525,6 +902,142 @@ void KDTreeSetAndBuild()
 	this->m_KDTree->BuildLocatorFromPoints( this->m_DataImage->GetPoints() );
 }
 
+/** A function to set the number of threads used by the mesh filters. */
+void SetNumberOfThreads( unsigned int nThreads )
+{
+	this->m_NumberOfThreads = nThreads > 0 ? nThreads : 1;
+}
+
+/** A function to choose between the strains from the mesh cells (the 
+ * default) and the strains from a moving least squares fit to the
+ * neighbours of every node. see DICMesh::GetStrains */
+void SetUseMovingLeastSquaresStrain( bool useMovingLeastSquares )
+{
+	this->m_UseMovingLeastSquaresStrain = useMovingLeastSquares;
+}
+
+/** A function to set the neighbours used by the moving least squares 
+ * strains.  If radius is greater than 0 the nodes within radius are 
+ * used, otherwise the nNeighbours nearest nodes are used.  order is 1
+ * for a linear fit or 2 for a quadratic fit. */
+void SetMovingLeastSquaresParameters( unsigned int nNeighbours, double radius, unsigned int order )
+{
+	if ( nNeighbours != this->m_MovingLeastSquaresNeighbours || radius != this->m_MovingLeastSquaresRadius || order != this->m_MovingLeastSquaresOrder ){
+		this->m_MovingLeastSquaresStrain.Clear();
+	}
+	this->m_MovingLeastSquaresNeighbours = nNeighbours;
+	this->m_MovingLeastSquaresRadius = radius;
+	this->m_MovingLeastSquaresOrder = order;
+}
+
+/** A function to get the number of threads used by the mesh filters. */
+unsigned int GetNumberOfThreads()
+{
+	return this->m_NumberOfThreads;
+}
+
+/** A function to set the number of threads of the parallel loops over
+ * the voxels of the input images, e.g. hashing them for the cache, 0 
+ * (the default) for the number of registration threads. */
+void SetNumberOfImageThreads( unsigned int nThreads )
+{
+	this->m_NumberOfImageThreads = nThreads;
+}
+
+/** A function to get the number of threads of the parallel loops over
+ * the voxels of the input images. */
+unsigned int GetNumberOfImageThreads()
+{
+	return this->m_NumberOfImageThreads > 0 ? this->m_NumberOfImageThreads : this->m_Registration->GetNumberOfThreads();
+}
+
+/** A function to build the neighbourhood of every node from the cells
+ * of the data image.  Two nodes are neighbours if they are the end 
+ * points of a cell edge.  A quadratic tet is treated as the eight
+ * linear tets formed by its corner and mid-edge nodes, so every node
+ * is connected to the nodes at the mesh spacing around it.  The 
+ * neighbours of the nodes of a structured grid come from its stencil 
+ * without visiting the cells.  This method is called the first time the 
+ * neighbourhood is needed after the geometry of the data image changes. */
+void BuildNeighbourhood()
+{
+	vtkIdType nPoints = this->m_DataImage->GetNumberOfPoints();
+	vtkIdType nCells = this->m_DataImage->GetNumberOfCells();
+	
+	if ( !this->m_StructuredGrid.IsEmpty() ){
+		this->m_StructuredGrid.BuildNeighbourhood( this->m_Neighbourhood );
+		nCells = 0;
+	}
+	
+	MeshNeighbourhood::NodePairListType pairs;
+	pairs.reserve( 6*nCells );
+	for ( vtkIdType i = 0; i < nCells; ++i ){
+		int cellType = this->m_DataImage->GetCellType( i );
+		vtkIdType nCellPoints;
+		vtkIdType *cellPoints;
+		this->m_DataImage->GetCellPoints( i, nCellPoints, cellPoints );
+		
+		if ( cellType == VTK_TETRA ){ // every pair of corners of a tet is an edge
+			for ( int j = 0; j < 4; ++j ){
+				for ( int k = j+1; k < 4; ++k ){
+					pairs.push_back( MeshNeighbourhood::NodePairType( cellPoints[j], cellPoints[k] ) );
+				}
+			}
+			continue;
+		}
+		if ( cellType == VTK_QUADRATIC_TETRA ){
+			// corners to their mid-edge nodes, mid-edge nodes on a common face and the three diagonals of the inner octahedron
+			static const int quadraticTetEdges[27][2] = { {0,4}, {1,4}, {1,5}, {2,5}, {2,6}, {0,6}, {0,7}, {3,7}, {1,8}, {3,8}, {2,9}, {3,9},
+				{4,5}, {5,6}, {6,4}, {4,7}, {7,8}, {8,4}, {5,8}, {8,9}, {9,5}, {6,7}, {7,9}, {9,6},
+				{4,9}, {5,7}, {6,8} };
+			for ( int j = 0; j < 27; ++j ){
+				pairs.push_back( MeshNeighbourhood::NodePairType( cellPoints[ quadraticTetEdges[j][0] ], cellPoints[ quadraticTetEdges[j][1] ] ) );
+			}
+			continue;
+		}
+		
+		// other cells are visited through their edges
+		vtkCell *cell = this->m_DataImage->GetCell( i );
+		for ( int j = 0; j < cell->GetNumberOfEdges(); ++j ){
+			vtkCell *edge = cell->GetEdge( j );
+			pairs.push_back( MeshNeighbourhood::NodePairType( edge->GetPointId(0), edge->GetPointId(1) ) );
+		}
+	}
+	if ( this->m_StructuredGrid.IsEmpty() ){
+		this->m_Neighbourhood.Build( nPoints, pairs );
+	}
+	
+	// keep a double precision copy of the node locations for the weight calculations
+	this->m_NodeLocations.resize( 3*nPoints );
+	for ( vtkIdType i = 0; i < nPoints; ++i ){
+		this->m_DataImage->GetPoint( i, &this->m_NodeLocations[3*i] );
+	}
+}
+
+/** A function to get the neighbourhood of every node. */
+const MeshNeighbourhood& GetNeighbourhood()
+{
+	if ( this->m_Neighbourhood.IsEmpty() ){
+		this->BuildNeighbourhood();
+	}
+	return this->m_Neighbourhood;
+}
+
+/** A function to get the Gaussian weight matrix used by the weighted
+ * moving average filters for a given sigma and mean.  The matrix is
+ * built the first time it is requested and cached until the geometry
+ * of the data image changes.
+ * see SparseWeightMatrix::BuildGaussian */
+const SparseWeightMatrix& GetGaussianWeightMatrix( double sigma, double mean )
+{
+	SparseWeightMatrix &weights = this->m_WeightMatrixCache[ WeightMatrixKeyType( sigma, mean ) ];
+	if ( weights.IsEmpty() ){
+		const MeshNeighbourhood &neighbourhood = this->GetNeighbourhood();
+		weights.BuildGaussian( neighbourhood, &this->m_NodeLocations[0], sigma, mean, this->m_NumberOfThreads );
+	}
+	return weights;
+}
+
 /** A function to find the values that are outside a given bounds 
  * compared to their connected neighbours. */
 void CreateNewRegionListFromBadPixels()
@@ -533,113 +1046,319 @@ void CreateNewRegionListFromBadPixels()
 	this->m_MovingImageRegionList.clear();
 	this->m_pointsList->Reset(); // clear the point list
 	
-	DataImagePointer tempImage = DataImagePointer::New(); // make a copy of the image to work with
-	tempImage->DeepCopy(this->m_DataImage);
+	// find the bad points and apply a smoothed value to the mesh to be used in the next evaluation
+	NodeBitmap badPixels;
+	this->FindBadDisplacementPixels( badPixels );
+	std::vector< NodeIdType > badPixelList;
+	badPixels.GetNodes( badPixelList );
+	this->ReplacePixelsWithWeightedAverage( this->m_Fields.GetDisplacement(), 2, 0, badPixelList );
 	
-	// visit every point in the image
-	unsigned int numberOfPoints = tempImage->GetNumberOfPoints();
-	for( unsigned int i = 0; i < numberOfPoints; ++i ){
+	// calculate the new regions
+	for( unsigned int j = 0; j < badPixelList.size(); ++j ){
+		vtkIdType i = badPixelList[j];
 		
-		// find connected points
-		vtkSmartPointer<vtkIdList> pointList = vtkSmartPointer<vtkIdList>::New();
-		this->GetNeighbouringPoints( i, pointList );
-
-		// calc the average and standard deviabtions of the displacements stored in the neighbourhood points
-		double averageValue[3] = {0,0,0};
-		double averageMag = 0;
-		double stDevValue[3] = {0,0,0};
-		double stDevMag = 0;
-		this->GetDisplacementStats(i, pointList, averageValue, averageMag, stDevValue, stDevMag, tempImage );
+		double *movingImageCenterLocation = new double[3];
+		movingImageCenterLocation = this->GetMovingImageRegionLocationFromIndex( i ); // new moving image centre
 		
-		// get the displacement value stored in the current point
-		double *currentValue = new double[3];
-		currentValue = tempImage->GetPointData()->GetArray("Displacement")->GetTuple( i );
-	
-		// check if there the pixel is valid - if any component is out of value it is considered invalid
-		if( !DisplacementValid(currentValue, averageValue, averageMag, stDevValue, stDevMag ) ){
-			
-			double *averagedDisplacement = new double[3];
-			averagedDisplacement = CalculateDisplacementWeightedMovingAverage( 2, 0, i, tempImage );
-			this->m_DataImage->GetPointData()->GetArray("Displacement")->SetTuple( i, averagedDisplacement );  // apply a smoothed value to the mesh to be used in the next evaluation		
-				
-			double *movingImageCenterLocation = new double[3];
-			movingImageCenterLocation = this->GetMovingImageRegionLocationFromIndex( i ); // new moving image centre
-			
-			MovingImageRegionType *currentMovingRegion = new MovingImageRegionType;
-			this->GetMovingImageRegionFromLocation( currentMovingRegion, movingImageCenterLocation );
-			this->PushRegionOntoMovingImageRegionList( currentMovingRegion ); // new moving image
-			
-			FixedImageRegionType *currentFixedRegion = new FixedImageRegionType;  // calculated the new fixed region
-			this->GetFixedImageRegionFromLocation( currentFixedRegion, this->m_DataImage->GetPoint( i ) );
-			this->PushRegionOntoFixedImageRegionList( currentFixedRegion );
-			
-			this->m_pointsList->InsertNextId( i ); // add the current point to the next round of evaluation
-		}
+		MovingImageRegionType *currentMovingRegion = new MovingImageRegionType;
+		this->GetMovingImageRegionFromLocation( currentMovingRegion, movingImageCenterLocation );
+		this->PushRegionOntoMovingImageRegionList( currentMovingRegion ); // new moving image
+		
+		FixedImageRegionType *currentFixedRegion = new FixedImageRegionType;  // calculated the new fixed region
+		this->GetFixedImageRegionFromLocation( currentFixedRegion, this->m_DataImage->GetPoint( i ) );
+		this->PushRegionOntoFixedImageRegionList( currentFixedRegion );
+		
+		this->m_pointsList->InsertNextId( i ); // add the current point to the next round of evaluation
 	}
 }
 
-/** A function to calcluate the component and mangnitued averages of point
- * values from a list of point IDs. 
- * rPoint = reference point
- * points = list of points for stats calculation
- * vectorAverage = average value of each component (eg, vectorAverage[0] = average(x_displacement) 
- * magAverage = average magnitude of vectorAverage
- * vectorStDev = standard deviation of each component
- * magStDev = magnitude of the standard deviations
- * image = pointer to an unstructured grid image */ 
-void GetDisplacementStats(vtkIdType rPoint, vtkSmartPointer<vtkIdList> points, double vectorAverage[3], double &magAverage, double vectorStDev[3], double &magStDev, DataImagePointer image)
+/** A function to set the region lists to the given points only, so
+ * the next ExecuteDIC registers just those points. */
+void CreateRegionListFromPoints( const std::vector< NodeIdType > &pointIds )
 {
-	// visit each point in the list and calculate the average
-	unsigned int nPoints = points->GetNumberOfIds();
-	int denominator = 0;
-	for( unsigned int i = 0; i < nPoints; ++i){
-		
-		vtkIdType pointId = points->GetId( i );
-		if ( pointId == rPoint) continue; // don't include the current point in the average.
-		denominator++; // increment the denominator only once passed the current point check
+	this->m_FixedImageRegionList.clear();
+	this->m_MovingImageRegionList.clear();
+	this->m_pointsList->Reset();
+	
+	for( unsigned int j = 0; j < pointIds.size(); ++j ){
+		vtkIdType i = pointIds[j];
 		
-		double *cPoint = new double[3];
-		image->GetPointData()->GetArray("Displacement")->GetTuple( pointId, cPoint ); // get the current point value
+		double *movingImageCenterLocation = this->GetMovingImageRegionLocationFromIndex( i );
+		MovingImageRegionType *currentMovingRegion = new MovingImageRegionType;
+		this->GetMovingImageRegionFromLocation( currentMovingRegion, movingImageCenterLocation );
+		this->PushRegionOntoMovingImageRegionList( currentMovingRegion );
 		
-		vectorAverage[0] = vectorAverage[0] + cPoint[0];
-		vectorAverage[1] = vectorAverage[1] + cPoint[1];
-		vectorAverage[2] = vectorAverage[2] + cPoint[2];
+		FixedImageRegionType *currentFixedRegion = new FixedImageRegionType;
+		this->GetFixedImageRegionFromLocation( currentFixedRegion, this->m_DataImage->GetPoint( i ) );
+		this->PushRegionOntoFixedImageRegionList( currentFixedRegion );
 		
-		magAverage = magAverage + std::sqrt( std::pow(cPoint[0],2) + std::pow(cPoint[1],2) + std::pow(cPoint[2],2) );
+		this->m_pointsList->InsertNextId( i );
+	}
+}
+
+/** A function to choose the tets to refine.  The tets are ranked by 
+ * the number of their nodes with a bad displacement or strain, then by
+ * the strain variation over the tet, the largest difference between
+ * the strain of a node and the strain of the tet.  The given fraction 
+ * of the tets is returned, highest ranked first, leaving out tets with
+ * no bad nodes and no variation.  The strains must be current.
+ * see DICMesh::RefineMesh */
+void FindCellsToRefine( double fraction, std::vector< NodeIdType > &cells )
+{
+	NodeBitmap badDisplacements;
+	NodeBitmap badStrains;
+	this->FindBadDisplacementPixels( badDisplacements );
+	this->FindBadStrainPixels( badStrains );
+	
+	const unsigned int nComponents = MeshStrainCalculator::NumberOfStrainComponents;
+	const StrainValueType *strains = this->m_Fields.GetStrain().GetPointer();
+	const StrainValueType *cellStrains = this->m_Fields.GetCellStrain().GetPointer();
+	long nCells = (long)this->m_DataImage->GetNumberOfCells();
+	
+	// rank by (bad nodes, variation), negated so an ascending sort puts the highest first
+	typedef std::pair< std::pair< int, double >, NodeIdType >	RankType;
+	std::vector< RankType > ranks( nCells, RankType( std::pair< int, double >( 0, 0 ), 0 ) );
+	#pragma omp parallel for num_threads(this->m_NumberOfThreads) schedule(static)
+	for ( long c = 0; c < nCells; ++c ){
+		ranks[c].second = c;
+		if ( this->m_DataImage->GetCellType( c ) != VTK_TETRA ) continue;
+		vtkIdType nCellPoints;
+		vtkIdType *cellPoints;
+		this->m_DataImage->GetCellPoints( c, nCellPoints, cellPoints );
+		int nBad = 0;
+		double variation = 0;
+		for ( vtkIdType n = 0; n < nCellPoints; ++n ){
+			if ( badDisplacements.Test( cellPoints[n] ) || badStrains.Test( cellPoints[n] ) ) ++nBad;
+			double difference = 0;
+			for ( unsigned int k = 0; k < nComponents; ++k ){
+				double d = strains[ nComponents*cellPoints[n] + k ] - cellStrains[ nComponents*c + k ];
+				difference = difference + ( k < 3 ? d*d : 2*d*d ); // the shear terms appear twice in the tensor
+			}
+			variation = std::max( variation, difference );
+		}
+		ranks[c].first = std::pair< int, double >( -nBad, -variation );
+	}
+	std::sort( ranks.begin(), ranks.end() );
+	
+	cells.clear();
+	std::size_t nRefine = (std::size_t)std::ceil( fraction*nCells );
+	for ( std::size_t i = 0; i < ranks.size() && cells.size() < nRefine; ++i ){
+		if ( ranks[i].first.first == 0 && ranks[i].first.second == 0 ) break;
+		cells.push_back( ranks[i].second );
+	}
+}
+
+/** A function to refine the mesh by bisecting the longest edge of the
+ * given tets, adding at most maxNewPoints nodes (0 for no limit).  The
+ * tets sharing a bisected edge are split too so the mesh stays 
+ * conforming.  The existing nodes keep their ids and values and every
+ * new node starts from the average displacement of the edge it 
+ * bisects.  The region lists are set to the new nodes, so the next 
+ * ExecuteDIC only registers them.  Only linear tet meshes are refined.
+ * Returns the number of new nodes.
+ * see MeshRefiner */
+NodeIdType RefineMesh( const std::vector< NodeIdType > &cells, NodeIdType maxNewPoints )
+{
+	NodeIdType nPoints = this->m_DataImage->GetNumberOfPoints();
+	NodeIdType nCells = this->m_DataImage->GetNumberOfCells();
+	std::vector< NodeIdType > tets( 4*nCells );
+	for ( NodeIdType i = 0; i < nCells; ++i ){
+		if ( this->m_DataImage->GetCellType( i ) != VTK_TETRA ){
+			std::stringstream msg("");
+			msg << "Only meshes of linear tets can be refined, the mesh is not refined."<<std::endl;
+			this->WriteToLogfile( msg.str() );
+			return 0;
+		}
+		vtkIdType nCellPoints;
+		vtkIdType *cellPoints;
+		this->m_DataImage->GetCellPoints( i, nCellPoints, cellPoints );
+		std::copy( cellPoints, cellPoints + 4, tets.begin() + 4*i );
 	}
 	
-	vectorAverage[0] = vectorAverage[0]/denominator;
-	vectorAverage[1] = vectorAverage[1]/denominator;
-	vectorAverage[2] = vectorAverage[2]/denominator; 
-	magAverage = magAverage/denominator;
+	std::vector< double > points( 3*nPoints );
+	for ( NodeIdType i = 0; i < nPoints; ++i ){
+		this->m_DataImage->GetPoint( i, &points[3*i] );
+	}
 	
-	double vectDiff[3] = {0, 0, 0};
-	double magDiff = 0;
-	denominator = 0;
-	for( unsigned int i = 0; i <nPoints; ++i){
-		
-		vtkIdType pointId = points->GetId( i );
-		if ( pointId == rPoint) continue; // don't include the current point in the average.
-		denominator++; // increment the denominator only once passed the current point check
-		
-		double *cPoint = new double[3];
-		image->GetPointData()->GetArray("Displacement")->GetTuple( pointId, cPoint ); // get the current point value
-		
-		double cMag = std::sqrt( std::pow(cPoint[0],2) + std::pow(cPoint[1],2) + std::pow(cPoint[2],2) );
+	MeshRefiner refiner;
+	refiner.Initialize( nPoints, points.empty() ? 0 : &points[0], tets );
+	NodeIdType nNewPoints = refiner.RefineTets( cells, maxNewPoints );
+	if ( nNewPoints == 0 ) return 0;
+	
+	// the refined mesh with the current values, interpolated onto the new nodes
+	NodeIdType nRefinedPoints = refiner.GetNumberOfPoints();
+	vtkSmartPointer<vtkPoints> refinedPoints = vtkSmartPointer<vtkPoints>::New();
+	refinedPoints->SetNumberOfPoints( nRefinedPoints );
+	DataImagePixelPointer displacement = DataImagePixelPointer::New();
+	displacement->SetName( "Displacement" );
+	displacement->SetNumberOfComponents( 3 );
+	displacement->SetNumberOfTuples( nRefinedPoints );
+	DataImagePixelPointer optimizerValue = DataImagePixelPointer::New();
+	optimizerValue->SetName( "Optimizer Value" );
+	optimizerValue->SetNumberOfComponents( 1 );
+	optimizerValue->SetNumberOfTuples( nRefinedPoints );
+	const MeshField &currentDisplacement = this->m_Fields.GetDisplacement();
+	for ( NodeIdType i = 0; i < nRefinedPoints; ++i ){
+		refinedPoints->SetPoint( i, &refiner.GetPoints()[3*i] );
+		double value[3];
+		double optimizer = 0;
+		if ( i < nPoints ){
+			currentDisplacement.GetTuple( i, value );
+			this->m_Fields.GetOptimizerValue().GetTuple( i, &optimizer );
+		}
+		else{
+			const MeshRefiner::EdgeType &parents = refiner.GetParents( i );
+			double *first = displacement->GetTuple3( parents.first ); // parents always have lower ids
+			double firstValue[3] = { first[0], first[1], first[2] };
+			double *second = displacement->GetTuple3( parents.second );
+			for ( unsigned int d = 0; d < 3; ++d ){
+				value[d] = 0.5*( firstValue[d] + second[d] );
+			}
+		}
+		displacement->SetTuple( i, value );
+		optimizerValue->SetTuple( i, &optimizer );
+	}
+	
+	DataImagePointer refinedImage = DataImagePointer::New();
+	refinedImage->SetPoints( refinedPoints );
+	NodeIdType nRefinedCells = refiner.GetTets().size()/4;
+	refinedImage->Allocate( nRefinedCells );
+	for ( NodeIdType i = 0; i < nRefinedCells; ++i ){
+		vtkIdType ptIds[4];
+		std::copy( &refiner.GetTets()[4*i], &refiner.GetTets()[4*i] + 4, ptIds );
+		refinedImage->InsertNextCell( VTK_TETRA, 4, ptIds );
+	}
+	refinedImage->GetPointData()->AddArray( displacement );
+	refinedImage->GetPointData()->AddArray( optimizerValue );
+	this->SetDataImage( refinedImage );
+	
+	std::vector< NodeIdType > newPoints;
+	for ( NodeIdType i = nPoints; i < nRefinedPoints; ++i ){
+		newPoints.push_back( i );
+	}
+	this->CreateRegionListFromPoints( newPoints );
+	
+	std::stringstream msg("");
+	msg << "Refined the mesh at "<<cells.size()<<" cells, adding "<<nNewPoints<<" points and "<<nRefinedCells-nCells<<" cells."<<std::endl;
+	this->WriteToLogfile( msg.str() );
+	return nNewPoints;
+}
+
+/** A function to find the points whose displacement is considered 
+ * erronious compared to their connected neighbours.  The 
+ * displacementErrorTollerance is used to tell the number of standard
+ * deviations from the mean that are permitted for each componenent.
+ * The bad points are returned in badPixels.  If pointsToTest is given
+ * only those points are tested.
+ * see MeshOutlierDetector */
+void FindBadDisplacementPixels( NodeBitmap &badPixels, const NodeBitmap *pointsToTest = 0 )
+{
+	MeshOutlierDetector detector;
+	detector.SetTolerance( this->m_displacementErrorTolerance );
+	detector.SetNumberOfThreads( this->m_NumberOfThreads );
+	detector.FindOutliers( this->GetNeighbourhood(), this->m_Fields.GetDisplacement().GetPointer(), 3, badPixels, pointsToTest );
+}
+
+/** A function to find the points whose strain is considered erronious
+ * compared to their connected neighbours.  The strainErrorTollerance 
+ * is used to tell the number of standard deviations from the mean that
+ * are permitted for each componenent.  The bad points are returned in
+ * badPixels.  If pointsToTest is given only those points are tested.
+ * see MeshOutlierDetector */
+void FindBadStrainPixels( NodeBitmap &badPixels, const NodeBitmap *pointsToTest = 0 )
+{
+	MeshOutlierDetector detector;
+	detector.SetTolerance( this->m_strainErrorTolerance );
+	detector.SetNumberOfThreads( this->m_NumberOfThreads );
+	detector.FindOutliers( this->GetNeighbourhood(), this->m_Fields.GetStrain().GetPointer(), MeshStrainCalculator::NumberOfStrainComponents, badPixels, pointsToTest );
+}
+
+/** A function to replace the values of a field at the listed points by
+ * the weighted moving average of their neighbourhoods.  Every average
+ * is calculated from the values before replacement. sigma must not be
+ * 0. */
+template< typename TField >
+void ReplacePixelsWithWeightedAverage( TField &field, double sigma, double mean, const std::vector< NodeIdType > &pointIds )
+{
+	typedef typename TField::ValueType	ValueType;
+	const SparseWeightMatrix &weights = this->GetGaussianWeightMatrix( sigma, mean );
+	unsigned int nComponents = field.GetNumberOfComponents();
+	const ValueType *currentValues = field.GetPointer();
+	ValueType *newValues = field.GetWritePointer();
+	
+	long nIds = (long)pointIds.size();
+	#pragma omp parallel for num_threads(this->m_NumberOfThreads) schedule(static)
+	for ( long j = 0; j < nIds; ++j ){
+		weights.MultiplyRow( pointIds[j], currentValues, newValues + nComponents*pointIds[j], nComponents );
+	}
+	for ( long j = 0; j < nIds; ++j ){
+		field.CommitTuple( pointIds[j] );
+	}
+}
+
+/** A function to median filter a field over the neighbourhood of every
+ * point.  The result is written to the write buffer and then made 
+ * current. see MeshMedianFilter */
+template< typename TField >
+void ApplyMedianFilter( TField &field, MedianModeType mode )
+{
+	MeshMedianFilter filter;
+	filter.SetMode( mode );
+	filter.SetNumberOfThreads( this->m_NumberOfThreads );
+	filter.Apply( this->GetNeighbourhood(), field.GetPointer(), field.GetWritePointer(), field.GetNumberOfComponents() );
+	field.Swap();
+}
+
+/** A function to repeatedly find and replace the bad values of a field.
+ * The first sweep tests every point.  After that only the points whose
+ * neighbourhood has changed (the replaced points and their neighbours)
+ * are tested again, so a cluster of bad points is not left averaged
+ * from other bad points.  The sweeps stop when no point is replaced or
+ * after maxSweeps sweeps.  Every point replaced in any sweep is 
+ * returned in replacedPoints and the number of sweeps is returned.
+ * see DICMesh::ReplacePixelsWithWeightedAverage */
+template< typename TField >
+unsigned int ReplaceBadPixelsUntilConverged( TField &field, double tolerance, double sigma, double mean, unsigned int maxSweeps, std::vector< NodeIdType > &replacedPoints )
+{
+	const MeshNeighbourhood &neighbourhood = this->GetNeighbourhood();
+	NodeIdType nPoints = neighbourhood.GetNumberOfNodes();
+	
+	MeshOutlierDetector detector;
+	detector.SetTolerance( tolerance );
+	detector.SetNumberOfThreads( this->m_NumberOfThreads );
+	
+	NodeBitmap pointsToTest;
+	NodeBitmap badPixels;
+	NodeBitmap replacedPixels;
+	pointsToTest.SetNumberOfNodes( nPoints );
+	pointsToTest.Fill();
+	replacedPixels.SetNumberOfNodes( nPoints );
+	
+	unsigned int sweep = 0;
+	std::vector< NodeIdType > badPixelList;
+	while ( sweep < maxSweeps ){
+		detector.FindOutliers( neighbourhood, field.GetPointer(), field.GetNumberOfComponents(), badPixels, sweep == 0 ? 0 : &pointsToTest );
+		badPixels.GetNodes( badPixelList );
+		if ( badPixelList.empty() ) break;
+		++sweep;
 		
-		// the sum of all the squared distances from the mean
-		vectDiff[0] = vectDiff[0] + std::pow( (cPoint[0]-vectorAverage[0]), 2);
-		vectDiff[1] = vectDiff[1] + std::pow( (cPoint[1]-vectorAverage[1]), 2);
-		vectDiff[2] = vectDiff[2] + std::pow( (cPoint[2]-vectorAverage[2]), 2);
+		this->ReplacePixelsWithWeightedAverage( field, sigma, mean, badPixelList );
 		
-		magDiff = magDiff + std::pow( (cMag - magAverage), 2);
+		// the replaced points and their neighbours are tested in the next sweep
+		pointsToTest.Clear();
+		for ( unsigned int j = 0; j < badPixelList.size(); ++j ){
+			NodeIdType i = badPixelList[j];
+			replacedPixels.Set( i );
+			pointsToTest.Set( i );
+			const NodeIdType *neighbours = neighbourhood.GetNeighbours( i );
+			for ( NodeIdType k = 0; k < neighbourhood.GetNumberOfNeighbours( i ); ++k ){
+				pointsToTest.Set( neighbours[k] );
+			}
+		}
 	}
 	
-	vectorStDev[0] = std::sqrt(vectDiff[0]/denominator);
-	vectorStDev[1] = std::sqrt(vectDiff[1]/denominator);
-	vectorStDev[2] = std::sqrt(vectDiff[2]/denominator);
-	
-	magStDev = std::sqrt(magDiff/denominator);
+	replacedPixels.GetNodes( replacedPoints );
+	return sweep;
 }
 
 /** A function to find and replace bad displacement values. Displacements
@@ -647,67 +1366,32 @@ void GetDisplacementStats(vtkIdType rPoint, vtkSmartPointer<vtkIdList> points, d
  * tested for validity.  If the displacement is found to be outside the
  * valid region, it is replaced by a weighted average of its neighbours.
  * The weighting parameters are given by sigma and mean and a list of
- * replaced pixels is returned in replacedList.
- * see DICMesh::DisplacementWeightedMovingAverageFilter */
-void ReplaceBadDisplacementPixels( double sigma, double mean, vtkIdList *replacedList)
+ * replaced pixels is returned in replacedList. If maxSweeps is greater
+ * than 1 the replacement is repeated on the points whose neighbourhood
+ * changed until no bad points are left or maxSweeps is reached.
+ * see DICMesh::DisplacementWeightedMovingAverageFilter
+ * see DICMesh::ReplaceBadPixelsUntilConverged */
+void ReplaceBadDisplacementPixels( double sigma, double mean, vtkIdList *replacedList, unsigned int maxSweeps = 1 )
 {
+	// empty the list of replaced points
+	replacedList->Reset();
+	
 	// if sigma = 0, there's nothing to do
 	if ( sigma == 0) {return;}
 	
-	// create a duplicate of the data image
-	DataImagePointer tempImage = DataImagePointer::New();
-	tempImage->DeepCopy(this->m_DataImage);
-	
-	// empty the list of replaced points
-	replacedList->Reset();
+	// find the bad points and replace them
+	std::vector< NodeIdType > replacedPoints;
+	unsigned int nSweeps = this->ReplaceBadPixelsUntilConverged( this->m_Fields.GetDisplacement(), this->m_displacementErrorTolerance, sigma, mean, maxSweeps, replacedPoints );
 	
-	// visit every point in the image
-	unsigned int numberOfPoints = tempImage->GetNumberOfPoints();
-	for( unsigned int i = 0; i < numberOfPoints; ++i ){
-
-		// get connected points
-		vtkSmartPointer<vtkIdList> pointList = vtkSmartPointer<vtkIdList>::New();		
-		this->GetNeighbouringPoints( i, pointList );
-
-		// calc the average and stDev of the points in the list
-		double vectorAverage[3] = { 0 };
-		double magAverage = 0;
-		double vectorStDev[3] = { 0 };
-		double magStDev = 0;		
-		this->GetDisplacementStats( i, pointList, vectorAverage, magAverage, vectorStDev, magStDev, tempImage );
-			
-		// get the value of the current point
-		double *currentValue = new double[3];
-		tempImage->GetPointData()->GetArray("Displacement")->GetTuple( i, currentValue );
-		
-		// check if there the pixel is valid - if any component is out of value it is considered invalid
-		if( !this->DisplacementValid( currentValue, vectorAverage, magAverage, vectorStDev, magStDev ) ){	
-			double *newDisplacement = new double[3];
-			newDisplacement = CalculateDisplacementWeightedMovingAverage( sigma, mean, i, tempImage );
-			this->m_DataImage->GetPointData()->GetArray("Displacement")->SetTuple( i, newDisplacement );  // apply pixel value to the mesh
-			replacedList->InsertNextId( i );
-		}
+	for ( unsigned int j = 0; j < replacedPoints.size(); ++j ){
+		replacedList->InsertNextId( replacedPoints[j] );
 	}
-}
-
-/** A function to test if a displacement vector is to be considered 
- * erronious or not. The displacementErrorTollerance is used to tell the
- * number of standard deviations from the mean that are permitted for
- * each componenent.*/
-bool DisplacementValid(double value[3], double vectorAverage[3], double &magAverage, double vectorStDev[3], double &magStDev)
-{
-		if (
-		std::fabs(value[0] - vectorAverage[0]) > this->m_displacementErrorTolerance * vectorStDev[0] ||
-		std::fabs(value[1] - vectorAverage[1]) > this->m_displacementErrorTolerance * vectorStDev[1] ||
-		std::fabs(value[2] - vectorAverage[2]) > this->m_displacementErrorTolerance * vectorStDev[2] )
-		{
-			return false;
-		}
-		else
-		{
-			return true;
-		}
 	
+	if ( maxSweeps > 1 ){
+		std::stringstream msg("");
+		msg << "Displacement replacement finished after "<<nSweeps<<" of at most "<<maxSweeps<<" sweeps.";
+		this->WriteToLogfile( msg.str() );
+	}
 }
 
 /** A function to find and replace bad strain values. Strain
@@ -715,609 +1399,437 @@ bool DisplacementValid(double value[3], double vectorAverage[3], double &magAver
  * tested for validity.  If the strain is found to be outside the
  * valid region, it is replaced by a weighted average of its neighbours.
  * The weighting parameters are given by sigma and mean and a list of
- * replaced pixels is returned in replacedList.
- * see DICMesh::StrainWeightedMovingAverageFilter */
-void ReplaceBadStrainPixels( double sigma, double mean, vtkIdList *replacedList)
+ * replaced pixels is returned in replacedList. If maxSweeps is greater
+ * than 1 the replacement is repeated on the points whose neighbourhood
+ * changed until no bad points are left or maxSweeps is reached.
+ * see DICMesh::StrainWeightedMovingAverageFilter
+ * see DICMesh::ReplaceBadPixelsUntilConverged */
+void ReplaceBadStrainPixels( double sigma, double mean, vtkIdList *replacedList, unsigned int maxSweeps = 1 )
 {
+	// empty the list of replaced points
+	replacedList->Reset(); 
+	
 	// if sigma = 0, there's nothing to do
 	if ( sigma == 0) {return;}
 	
-	// create a duplicate of the data image
-	DataImagePointer tempImage = DataImagePointer::New();
-	tempImage->DeepCopy(this->m_DataImage);
+	// find the bad points and replace them
+	std::vector< NodeIdType > replacedPoints;
+	unsigned int nSweeps = this->ReplaceBadPixelsUntilConverged( this->m_Fields.GetStrain(), this->m_strainErrorTolerance, sigma, mean, maxSweeps, replacedPoints );
+	if ( !replacedPoints.empty() ) this->m_StrainsAreRaw = false;
 	
-	// empty the list of replaced points
-	replacedList->Reset(); 
+	for ( unsigned int j = 0; j < replacedPoints.size(); ++j ){
+		replacedList->InsertNextId( replacedPoints[j] );
+	}
 	
-	// visit every point in the image
-	unsigned int numberOfPoints = tempImage->GetNumberOfPoints();
-	for( unsigned int i = 0; i < numberOfPoints; ++i ){
-
-		// get connected points
-		vtkSmartPointer<vtkIdList> pointList = vtkSmartPointer<vtkIdList>::New();		
-		this->GetNeighbouringPoints( i, pointList );
-
-		// calc the average and stDev of the points in the list
-		double averageValue[9] = { 0 };
-		double stDevValue[9] = { 0 };
-		this->GetStrainStats(i, pointList, averageValue, stDevValue );
-		
-		// get the value of the current point
-		double *currentValue = new double[9];
-		currentValue = tempImage->GetPointData()->GetArray("Strain")->GetTuple( i );
-		
-		// check if there the pixel is valid - if any component is out of value it is considered invalid
-		if( !this->StrainValid(currentValue, averageValue, stDevValue) ){	
-			double *newStrain = new double[9];
-			newStrain = CalculateStrainWeightedMovingAverage( sigma, mean, i, tempImage );
-			this->m_DataImage->GetPointData()->GetArray("Strain")->SetTuple( i, newStrain );  // apply pixel value to the mesh
-			replacedList->InsertNextId( i );
-		}
+	if ( maxSweeps > 1 ){
+		std::stringstream msg("");
+		msg << "Strain replacement finished after "<<nSweeps<<" of at most "<<maxSweeps<<" sweeps.";
+		this->WriteToLogfile( msg.str() );
 	}
 }
 
-void GetStrainStats( vtkIdType c_point, vtkSmartPointer<vtkIdList> points, double vectorAverage[9], double vectorStDev[9] )
+/** A function to build the strain calculator from the cells of the
+ * data image.  This method is called the first time the strains are
+ * calculated after the geometry of the data image changes. */
+void BuildStrainCalculator()
 {
-	unsigned int nPoints = points->GetNumberOfIds();
-	int denominator = 0;
-	for( unsigned int i = 0; i < nPoints; ++i){
-		vtkIdType pointId = points->GetId( i );
-		if ( pointId == c_point) continue; // don't include the current point in the average.
-		denominator++;
-		double *cPoint = new double[9];
-		this->m_DataImage->GetPointData()->GetArray("Strain")->GetTuple( pointId, cPoint );
-		
-		vectorAverage[0] = vectorAverage[0] + cPoint[0];
-		vectorAverage[1] = vectorAverage[1] + cPoint[1];
-		vectorAverage[2] = vectorAverage[2] + cPoint[2];
-		vectorAverage[3] = vectorAverage[3] + cPoint[3];
-		vectorAverage[4] = vectorAverage[4] + cPoint[4];
-		vectorAverage[5] = vectorAverage[5] + cPoint[5];
-		vectorAverage[6] = vectorAverage[6] + cPoint[6];
-		vectorAverage[7] = vectorAverage[7] + cPoint[7];
-		vectorAverage[8] = vectorAverage[8] + cPoint[8];
-	}
-	
-	vectorAverage[0] = vectorAverage[0]/denominator;
-	vectorAverage[1] = vectorAverage[1]/denominator;
-	vectorAverage[2] = vectorAverage[2]/denominator;
-	vectorAverage[3] = vectorAverage[3]/denominator;
-	vectorAverage[4] = vectorAverage[4]/denominator;
-	vectorAverage[5] = vectorAverage[5]/denominator;
-	vectorAverage[6] = vectorAverage[6]/denominator;
-	vectorAverage[7] = vectorAverage[7]/denominator;
-	vectorAverage[8] = vectorAverage[8]/denominator;
-	
-	double vectDiff[9] = { 0 };
-	denominator = 0;
-	for( unsigned int i = 0; i <nPoints; ++i){
-		vtkIdType pointId = points->GetId( i );
-		if ( pointId == c_point) continue; // don't include the current point in the average.
-		denominator++;
-		double *cPoint = new double[9];
-		this->m_DataImage->GetPointData()->GetArray("Strain")->GetTuple( pointId, cPoint );
+	vtkIdType nPoints = this->m_DataImage->GetNumberOfPoints();
+	vtkIdType nCells = this->m_DataImage->GetNumberOfCells();
+	
+	std::vector< MeshStrainCalculator::CellTypeType > cellTypes( nCells, MeshStrainCalculator::UnsupportedCell );
+	std::vector< MeshStrainCalculator::OffsetType > cellOffsets( nCells + 1, 0 );
+	std::vector< NodeIdType > cellNodes;
+	cellNodes.reserve( 10*nCells );
+	for ( vtkIdType i = 0; i < nCells; ++i ){
+		int cellType = this->m_DataImage->GetCellType( i );
+		vtkIdType nCellPoints;
+		vtkIdType *cellPoints;
+		this->m_DataImage->GetCellPoints( i, nCellPoints, cellPoints );
 		
-		vectDiff[0] = vectDiff[0] + std::pow( (cPoint[0] - vectorAverage[0]), 2);
-		vectDiff[1] = vectDiff[1] + std::pow( (cPoint[1] - vectorAverage[1]), 2);
-		vectDiff[2] = vectDiff[2] + std::pow( (cPoint[2] - vectorAverage[2]), 2);
-		vectDiff[3] = vectDiff[3] + std::pow( (cPoint[3] - vectorAverage[3]), 2);
-		vectDiff[4] = vectDiff[4] + std::pow( (cPoint[4] - vectorAverage[4]), 2);
-		vectDiff[5] = vectDiff[5] + std::pow( (cPoint[5] - vectorAverage[5]), 2);
-		vectDiff[6] = vectDiff[6] + std::pow( (cPoint[6] - vectorAverage[6]), 2);
-		vectDiff[7] = vectDiff[7] + std::pow( (cPoint[7] - vectorAverage[7]), 2);
-		vectDiff[8] = vectDiff[8] + std::pow( (cPoint[8] - vectorAverage[8]), 2);
-	}
-	
-	vectorStDev[0] = std::sqrt( vectDiff[0]/denominator );
-	vectorStDev[1] = std::sqrt( vectDiff[1]/denominator );
-	vectorStDev[2] = std::sqrt( vectDiff[2]/denominator );
-	vectorStDev[3] = std::sqrt( vectDiff[3]/denominator );
-	vectorStDev[4] = std::sqrt( vectDiff[4]/denominator );
-	vectorStDev[5] = std::sqrt( vectDiff[5]/denominator );
-	vectorStDev[6] = std::sqrt( vectDiff[6]/denominator );
-	vectorStDev[7] = std::sqrt( vectDiff[7]/denominator );
-	vectorStDev[8] = std::sqrt( vectDiff[8]/denominator );
-}
-
-bool StrainValid(double currentValue[9], double averageValue[9], double stDevValue[9])
-{
-	if (std::fabs(currentValue[0] - averageValue[0]) > this->m_strainErrorTolerance * stDevValue[0] ||
-		std::fabs(currentValue[1] - averageValue[1]) > this->m_strainErrorTolerance * stDevValue[1] ||
-		std::fabs(currentValue[2] - averageValue[2]) > this->m_strainErrorTolerance * stDevValue[2] ||
-		std::fabs(currentValue[3] - averageValue[3]) > this->m_strainErrorTolerance * stDevValue[3] ||
-		std::fabs(currentValue[4] - averageValue[4]) > this->m_strainErrorTolerance * stDevValue[4] ||
-		std::fabs(currentValue[5] - averageValue[5]) > this->m_strainErrorTolerance * stDevValue[5] ||
-		std::fabs(currentValue[6] - averageValue[6]) > this->m_strainErrorTolerance * stDevValue[6] ||
-		std::fabs(currentValue[7] - averageValue[7]) > this->m_strainErrorTolerance * stDevValue[7] ||
-		std::fabs(currentValue[8] - averageValue[8]) > this->m_strainErrorTolerance * stDevValue[8] )
-		{
-			return false;
+		if ( cellType == VTK_TETRA ){
+			cellTypes[i] = MeshStrainCalculator::LinearTetrahedron;
+			cellNodes.insert( cellNodes.end(), cellPoints, cellPoints + 4 );
 		}
-		else
-		{
-			return true;
+		else if ( cellType == VTK_QUADRATIC_TETRA ){
+			cellTypes[i] = MeshStrainCalculator::QuadraticTetrahedron;
+			cellNodes.insert( cellNodes.end(), cellPoints, cellPoints + 10 );
 		}
-}
-
-/** A function to calculate the strains. */
-void GetStrains()
-{
-	// calculate derivatives
-	vtkCellDerivatives *derivativeCalculator = vtkCellDerivatives::New();
-	derivativeCalculator->SetInput( this->m_DataImage );
-	derivativeCalculator->SetTensorModeToComputeStrain();
-	derivativeCalculator->SetVectorModeToComputeGradient();
+		cellOffsets[i+1] = cellNodes.size();
+	}
 	
-	derivativeCalculator->SetInputArrayToProcess(1,0,0,0,"Displacement"); // the CellDerivatives calculator sets the array idx to 0 for scalars and 1 for vector inputs. We want it to operate on vectors, so idx is set to 1.  Further, giving it the name of the array allows it to verify that it is operating on the correct array.
-	derivativeCalculator->Update();
-	this->SetDataImage( derivativeCalculator->GetUnstructuredGridOutput() );
+	std::vector< double > points( 3*nPoints );
+	for ( vtkIdType i = 0; i < nPoints; ++i ){
+		this->m_DataImage->GetPoint( i, &points[3*i] );
+	}
 	
-	// move the data from cells to nodes
-	vtkCellDataToPointData	*dataTransformer = vtkCellDataToPointData::New();
-	dataTransformer->SetInput( this->m_DataImage );
-	dataTransformer->PassCellDataOn();
-	dataTransformer->SetInputArrayToProcess(0,0,0,1,"Strain");// Strain is on array zero of the cells in m_DataImage. The 4th is an enum to tell the algorithm the data is stored in cells, the last in the name of the array.
-	dataTransformer->Update();
+	this->m_StrainCalculator.Build( nPoints, points.empty() ? 0 : &points[0], cellTypes, cellOffsets, cellNodes, this->m_NumberOfThreads );
 	
-	this->SetDataImage( dataTransformer->GetUnstructuredGridOutput() );
+	if ( this->m_StrainCalculator.GetNumberOfUnsupportedCells() > 0 ){
+		std::stringstream msg("");
+		msg << this->m_StrainCalculator.GetNumberOfUnsupportedCells() << " cells are not tetrahedra, their strain is set to 0."<<std::endl;
+		this->WriteToLogfile( msg.str() );
+	}
 }
 
-/** A function to calculate the principal strains. */
-void GetPrincipalStrains()
+/** A function to build the moving least squares strain calculator.  
+ * The neighbours of every node are found with the kd-tree. */
+void BuildMovingLeastSquaresStrain()
 {
-	vtkSmartPointer<vtkMath>		mathAlgorithm = vtkSmartPointer<vtkMath>::New();
-	// First find the principal strains for the point data
-	vtkIdType nPoints = this->m_DataImage->GetPointData()->GetArray("Strain")->GetNumberOfTuples();
+	vtkIdType nPoints = this->m_DataImage->GetNumberOfPoints();
+	std::vector< MovingLeastSquaresStrain::OffsetType > offsets( nPoints + 1, 0 );
+	std::vector< NodeIdType > neighbours;
+	vtkSmartPointer<vtkIdList> pointList = vtkSmartPointer<vtkIdList>::New();
+	for ( vtkIdType i = 0; i < nPoints; ++i ){
+		double cPoint[3];
+		this->m_DataImage->GetPoint( i, cPoint );
+		if ( this->m_MovingLeastSquaresRadius > 0 ){
+			this->m_KDTree->FindPointsWithinRadius( this->m_MovingLeastSquaresRadius, cPoint, pointList );
+		}
+		else{
+			this->m_KDTree->FindClosestNPoints( this->m_MovingLeastSquaresNeighbours + 1, cPoint, pointList ); // the point itself is found too
+		}
+		for ( vtkIdType j = 0; j < pointList->GetNumberOfIds(); ++j ){
+			neighbours.push_back( pointList->GetId( j ) );
+		}
+		offsets[i+1] = neighbours.size();
+	}
 	
-	DataImagePixelPointer V0;
-	DataImagePixelPointer V1;
-	DataImagePixelPointer V2;
-	DataImagePixelPointer val0;
-	DataImagePixelPointer val1;
-	DataImagePixelPointer val2;
+	this->GetNeighbourhood(); // makes sure the node locations are available
+	this->m_MovingLeastSquaresStrain.Build( &this->m_NodeLocations[0], offsets, neighbours, this->m_MovingLeastSquaresOrder, this->m_NumberOfThreads );
 	
-	// create the eigenvector containers if they don't exist
-	if ( this->m_DataImage->GetPointData()->GetArray("Principal Strain Vector 1") ){
-		V0 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetPointData()->GetArray( "Principal Strain Vector 1" ) );
-
-	}
-	else{
-		V0 = DataImagePixelPointer::New();
-		V0->SetNumberOfComponents(3);
-		V0->SetName("Principal Strain Vector 1");
-		V0->Allocate(nPoints);
-		V0->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetPointData()->AddArray( V0 );
-	}
-	if ( this->m_DataImage->GetPointData()->GetArray("Principal Strain Vector 2") ){
-		V1 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetPointData()->GetArray( "Principal Strain Vector 2" ) );
-	}
-	else{
-		V1 = DataImagePixelPointer::New();
-		V1->SetNumberOfComponents(3);
-		V1->SetName("Principal Strain Vector 2");
-		V1->Allocate(nPoints);
-		V1->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetPointData()->AddArray( V1 );
-	}
-	if ( this->m_DataImage->GetPointData()->GetArray("Principal Strain Vector 3") ){
-		V2 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetPointData()->GetArray( "Principal Strain Vector 3" ) );
+	std::stringstream msg("");
+	if ( this->m_MovingLeastSquaresStrain.GetNumberOfReducedNodes() > 0 ){
+		msg << "A linear fit was used at "<< this->m_MovingLeastSquaresStrain.GetNumberOfReducedNodes() <<" points with too few neighbours for a quadratic fit."<<std::endl;
 	}
-	else{
-		V2 = DataImagePixelPointer::New();
-		V2->SetNumberOfComponents(3);
-		V2->SetName("Principal Strain Vector 3");
-		V2->Allocate(nPoints);
-		V2->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetPointData()->AddArray( V2 );
+	if ( this->m_MovingLeastSquaresStrain.GetNumberOfFailedNodes() > 0 ){
+		msg << this->m_MovingLeastSquaresStrain.GetNumberOfFailedNodes() <<" points have too few neighbours for a fit, their strain is set to 0."<<std::endl;
 	}
+	if ( !msg.str().empty() ) this->WriteToLogfile( msg.str() );
+}
 
-	// create the eigenvalue containers if they don't exist
-	if ( this->m_DataImage->GetPointData()->GetArray("Principal Strain Value 1") ){
-		val0 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetPointData()->GetArray( "Principal Strain Value 1" ) );
+/** A function to calculate the strains.  The strain of every cell is
+ * calculated from the displacements and the strain of every point is 
+ * the volume weighted average of the strains of its cells.  If moving
+ * least squares strains are used, the strain of every point is found
+ * from a fit to its neighbours and the strain of every cell is the
+ * average of the strains of its points.  The strains of a structured 
+ * grid are calculated by finite differences, or moving least squares, 
+ * and the strain of every voxel is the average of its points.  The 
+ * strains are put in the field store, replacing any filtered strains.
+ * The calculated strains and the displacements they came from are kept
+ * so the next call only recalculates the cells that use a point whose
+ * displacement has changed, and the points of those cells.
+ * see MeshStrainCalculator */
+void GetStrains()
+{
+	if ( this->m_StrainCalculator.IsEmpty() && this->m_StructuredGrid.IsEmpty() ){
+		this->BuildStrainCalculator();
 	}
-	else{
-		val0 = DataImagePixelPointer::New();
-		val0->SetNumberOfComponents(1);
-		val0->SetName("Principal Strain Value 1");
-		val0->Allocate(nPoints);
-		val0->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetPointData()->AddArray( val0 );
+	
+	const unsigned int nComponents = MeshStrainCalculator::NumberOfStrainComponents;
+	const MeshField::TupleIdType nPoints = this->m_Fields.GetNumberOfPoints();
+	const MeshField::TupleIdType nCells = this->m_Fields.GetNumberOfCells();
+	MeshStrainField &strain = this->m_Fields.GetStrain();
+	MeshStrainField &cellStrain = this->m_Fields.GetCellStrain();
+	if ( strain.GetNumberOfTuples() != nPoints || strain.GetNumberOfComponents() != nComponents ){
+		strain.Allocate( nPoints, nComponents );
 	}
-	if ( this->m_DataImage->GetPointData()->GetArray("Principal Strain Value 2") ){
-		val1 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetPointData()->GetArray("Principal Strain Value 2") );
+	if ( cellStrain.GetNumberOfTuples() != nCells || cellStrain.GetNumberOfComponents() != nComponents ){
+		cellStrain.Allocate( nCells, nComponents );
 	}
-	else{
-		val1 = DataImagePixelPointer::New();
-		val1->SetNumberOfComponents(1);
-		val1->SetName("Principal Strain Value 2");
-		val1->Allocate(nPoints);
-		val1->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetPointData()->AddArray( val1 );
+	
+	const double *displacements = this->m_Fields.GetDisplacement().GetPointer();
+	if ( this->m_UseMovingLeastSquaresStrain || !this->m_StructuredGrid.IsEmpty() ){
+		if ( this->m_UseMovingLeastSquaresStrain ){
+			if ( this->m_MovingLeastSquaresStrain.IsEmpty() ){
+				this->BuildMovingLeastSquaresStrain();
+			}
+			this->m_MovingLeastSquaresStrain.CalculatePointStrains( displacements, strain.GetPointer(), this->m_NumberOfThreads );
+		}
+		else{
+			this->m_StructuredGrid.CalculatePointStrains( displacements, strain.GetPointer(), this->m_NumberOfThreads );
+		}
+		if ( this->m_StructuredGrid.IsEmpty() ){
+			this->m_StrainCalculator.CalculateCellStrainsFromPoints( strain.GetPointer(), cellStrain.GetPointer(), this->m_NumberOfThreads );
+		}
+		else{
+			this->m_StructuredGrid.CalculateCellStrains( strain.GetPointer(), cellStrain.GetPointer(), this->m_NumberOfThreads );
+		}
+		this->m_StrainDisplacements.clear(); // the incremental update only applies to the cell strains
+		this->m_PrincipalStrainsAreCurrent = false;
+		this->m_StrainsAreRaw = true;
+		return;
 	}
-	if ( this->m_DataImage->GetPointData()->GetArray("Principal Strain Value 3") ){
-		val2 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetPointData()->GetArray("Principal Strain Value 3") );
+	
+	if ( this->m_StrainDisplacements.size() != 3*nPoints ){
+		// no previous strains, calculate everything
+		this->m_RawStrain.resize( nComponents*nPoints );
+		this->m_RawCellStrain.resize( nComponents*nCells );
+		this->m_StrainCalculator.CalculateCellStrains( displacements, this->GetRawCellStrainPointer(), this->m_NumberOfThreads );
+		this->m_StrainCalculator.CalculatePointStrains( displacements, this->GetRawCellStrainPointer(), this->GetRawStrainPointer(), this->m_NumberOfThreads );
+		this->m_ChangedStrainPoints.SetNumberOfNodes( nPoints );
+		this->m_ChangedStrainCells.SetNumberOfNodes( nCells );
+		this->m_PrincipalStrainsAreCurrent = false;
 	}
 	else{
-		val2 = DataImagePixelPointer::New();
-		val2->SetNumberOfComponents(1);
-		val2->SetName("Principal Strain Value 3");
-		val2->Allocate(nPoints);
-		val2->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetPointData()->AddArray( val2 );
-	}	
-	
-	for ( unsigned int i = 0; i < nPoints; ++i ){
-		// Get the point tensor
-		double *cTensorRaw = this->m_DataImage->GetPointData()->GetArray("Strain")->GetTuple( i );
-		// reform tensor into an appropreate array
-		double *cTensor[3];
-		double cT0[3];
-		double cT1[3];
-		double cT2[3];
-
-		cTensor[0] = cT0; cTensor[1] = cT1; cTensor[2] = cT2;
-
-		cT0[0] = *cTensorRaw;
-		cT0[1] = *(cTensorRaw+1);
-		cT0[2] = *(cTensorRaw+2);	
-		cT1[0] = *(cTensorRaw+3);
-		cT1[1] = *(cTensorRaw+4);
-		cT1[2] = *(cTensorRaw+5);
-		cT2[0] = *(cTensorRaw+6);
-		cT2[1] = *(cTensorRaw+7);
-		cT2[2] = *(cTensorRaw+8);
-				
-		// Get the eigen-values and -vectors
-		double eigenValues[3]; // The Eigenvalues
-		double *eigenVectors[3]; // vector of pointers to eigenvectors
-		double v0[3]; // eigen vector 1
-		double v1[3]; // eigen vector 2
-		double v2[3]; // eigen vector 3
-		eigenVectors[0] = v0; eigenVectors[1] = v1; eigenVectors[2] = v2;
+		// recalculate the cells of the moved points, then the points of those cells
+		NodeBitmap movedPoints;
+		NodeBitmap changedCells;
+		NodeBitmap changedPoints;
+		this->FindMovedPoints( movedPoints );
+		this->m_StrainCalculator.FindCellsOfNodes( movedPoints, changedCells );
+		this->m_StrainCalculator.FindNodesOfCells( changedCells, changedPoints );
 		
-		// perform the calculation of the principal strains
-		mathAlgorithm->Jacobi(cTensor,eigenValues,eigenVectors);
+		std::vector< NodeIdType > ids;
+		changedCells.GetNodes( ids );
+		this->m_StrainCalculator.CalculateCellStrains( displacements, this->GetRawCellStrainPointer(), ids, this->m_NumberOfThreads );
+		std::stringstream msg("");
+		msg << "Strains recalculated in "<<ids.size()<<" of "<<nCells<<" cells";
+		changedPoints.GetNodes( ids );
+		this->m_StrainCalculator.CalculatePointStrains( displacements, this->GetRawCellStrainPointer(), this->GetRawStrainPointer(), ids, this->m_NumberOfThreads );
+		msg << " and "<<ids.size()<<" of "<<nPoints<<" points."<<std::endl;
+		this->WriteToLogfile( msg.str() );
 		
-		// save the values and vectors into the data image
-		V0->SetTuple( i, eigenVectors[0] );
-		val0->SetTuple( i, &eigenValues[0] );
-		V1->SetTuple( i, eigenVectors[1] );
-		val1->SetTuple( i, &eigenValues[1] );
-		V2->SetTuple( i, eigenVectors[2] );
-		val2->SetTuple( i, &eigenValues[2] );
+		this->m_ChangedStrainPoints.Union( changedPoints );
+		this->m_ChangedStrainCells.Union( changedCells );
 	}
 	
-	// next find the principal strains for the cell data
-	nPoints = this->m_DataImage->GetCellData()->GetArray("Strain")->GetNumberOfTuples();
-	
-	// create the eigenvector containers if they don't exist
-	if ( this->m_DataImage->GetCellData()->GetArray("Principal Strain Vector 1") ){
-		V0 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetCellData()->GetArray("Principal Strain Vector 1") );
-	}
-	else{
-		V0 = DataImagePixelPointer::New();
-		V0->SetNumberOfComponents(3);
-		V0->SetName("Principal Strain Vector 1");
-		V0->Allocate(nPoints);
-		V0->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetCellData()->AddArray( V0 );
-	}
-	if ( this->m_DataImage->GetCellData()->GetArray("Principal Strain Vector 2") ){
-		V1 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetCellData()->GetArray("Principal Strain Vector 2") );
-	}
-	else{
-		V1 = DataImagePixelPointer::New();
-		V1->SetNumberOfComponents(3);
-		V1->SetName("Principal Strain Vector 2");
-		V1->Allocate(nPoints);
-		V1->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetCellData()->AddArray( V1 );
-	}
-	if ( this->m_DataImage->GetCellData()->GetArray("Principal Strain Vector 3") ){
-		V2 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetCellData()->GetArray("Principal Strain Vector 3") );
-	}
-	else{
-		V2 = DataImagePixelPointer::New();
-		V2->SetNumberOfComponents(3);
-		V2->SetName("Principal Strain Vector 3");
-		V2->Allocate(nPoints);
-		V2->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetCellData()->AddArray( V2 );
+	this->m_StrainDisplacements.assign( displacements, displacements + 3*nPoints );
+	if ( nPoints > 0 ) std::memcpy( strain.GetPointer(), this->GetRawStrainPointer(), nComponents*nPoints*sizeof(StrainValueType) );
+	if ( nCells > 0 ) std::memcpy( cellStrain.GetPointer(), this->GetRawCellStrainPointer(), nComponents*nCells*sizeof(StrainValueType) );
+	this->m_StrainsAreRaw = true;
+}
+
+/** A function to find the points whose displacement differs from the
+ * displacement used for the last strain calculation. */
+void FindMovedPoints( NodeBitmap &movedPoints )
+{
+	NodeIdType nPoints = this->m_Fields.GetNumberOfPoints();
+	const double *displacements = this->m_Fields.GetDisplacement().GetPointer();
+	const double *previous = this->m_StrainDisplacements.empty() ? 0 : &this->m_StrainDisplacements[0];
+	movedPoints.SetNumberOfNodes( nPoints );
+	long nWords = (long)movedPoints.GetNumberOfWords();
+	
+	// each thread fills whole words of the bitmap so no locking is needed
+	#pragma omp parallel for num_threads(this->m_NumberOfThreads) schedule(static)
+	for ( long w = 0; w < nWords; ++w ){
+		NodeBitmap::WordType word = 0;
+		for ( unsigned int b = 0; b < NodeBitmap::BitsPerWord; ++b ){
+			NodeIdType i = (NodeIdType)w*NodeBitmap::BitsPerWord + b;
+			if ( i >= nPoints ) break;
+			if ( std::memcmp( displacements + 3*i, previous + 3*i, 3*sizeof(double) ) ){
+				word |= (NodeBitmap::WordType)1 << b;
+			}
+		}
+		movedPoints.SetWord( w, word );
 	}
+}
 
-	// create the eigenvalue containers if they don't exist
-	if ( this->m_DataImage->GetCellData()->GetArray("Principal Strain Value 1") ){
-		val0 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetCellData()->GetArray("Principal Strain Value 1") );
+/** Get a pointer to the last calculated point strains. */
+StrainValueType *GetRawStrainPointer()
+{
+	return this->m_RawStrain.empty() ? 0 : &this->m_RawStrain[0];
+}
+
+/** Get a pointer to the last calculated cell strains. */
+StrainValueType *GetRawCellStrainPointer()
+{
+	return this->m_RawCellStrain.empty() ? 0 : &this->m_RawCellStrain[0];
+}
+
+/** A function to calculate the principal strains of every point and
+ * cell.  The points and cells are processed together in one parallel 
+ * pass and the results are written directly into the "Principal 
+ * Strain Vector 1-3" and "Principal Strain Value 1-3" arrays of the
+ * data image, ordered from the largest to the smallest principal 
+ * strain.  If the strains have only been recalculated by GetStrains
+ * since the last call, only the points and cells whose strain changed
+ * are recalculated. see SymmetricEigensolver */
+void GetPrincipalStrains()
+{
+	vtkIdType nPoints = this->m_Fields.GetStrain().GetNumberOfTuples();
+	vtkIdType nCells = this->m_Fields.GetCellStrain().GetNumberOfTuples();
+	const StrainValueType *pointStrains = this->m_Fields.GetStrain().GetPointer();
+	const StrainValueType *cellStrains = this->m_Fields.GetCellStrain().GetPointer();
+	
+	// the previous principal strains can be kept if they come from the same strains and are still in the data image
+	bool onlyChanged = this->m_StrainsAreRaw && this->m_PrincipalStrainsAreCurrent;
+	double *pointVectors[3], *pointValues[3], *cellVectors[3], *cellValues[3];
+	for ( int j = 0; j < 3; ++j ){
+		std::stringstream vectorName(""), valueName("");
+		vectorName << "Principal Strain Vector " << j+1;
+		valueName << "Principal Strain Value " << j+1;
+		onlyChanged = onlyChanged && this->HasOutputArray( this->m_DataImage->GetPointData(), vectorName.str().c_str(), 3, nPoints ) && this->HasOutputArray( this->m_DataImage->GetPointData(), valueName.str().c_str(), 1, nPoints );
+		onlyChanged = onlyChanged && this->HasOutputArray( this->m_DataImage->GetCellData(), vectorName.str().c_str(), 3, nCells ) && this->HasOutputArray( this->m_DataImage->GetCellData(), valueName.str().c_str(), 1, nCells );
+		pointVectors[j] = this->GetOutputArray( this->m_DataImage->GetPointData(), vectorName.str().c_str(), 3, nPoints );
+		pointValues[j] = this->GetOutputArray( this->m_DataImage->GetPointData(), valueName.str().c_str(), 1, nPoints );
+		cellVectors[j] = this->GetOutputArray( this->m_DataImage->GetCellData(), vectorName.str().c_str(), 3, nCells );
+		cellValues[j] = this->GetOutputArray( this->m_DataImage->GetCellData(), valueName.str().c_str(), 1, nCells );
 	}
-	else{
-		val0 = DataImagePixelPointer::New();
-		val0->SetNumberOfComponents(1);
-		val0->SetName("Principal Strain Value 1");
-		val0->Allocate(nPoints);
-		val0->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetCellData()->AddArray( val0 );
+	
+	std::vector< NodeIdType > pointIds;
+	std::vector< NodeIdType > cellIds;
+	if ( onlyChanged ){
+		this->m_ChangedStrainPoints.GetNodes( pointIds );
+		this->m_ChangedStrainCells.GetNodes( cellIds );
 	}
-	if ( this->m_DataImage->GetCellData()->GetArray("Principal Strain Value 2") ){
-		val1 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetCellData()->GetArray("Principal Strain Value 2") );
+	long nPointTensors = onlyChanged ? (long)pointIds.size() : (long)nPoints;
+	long nCellTensors = onlyChanged ? (long)cellIds.size() : (long)nCells;
+	
+	long nTensors = nPointTensors + nCellTensors;
+	#pragma omp parallel for num_threads(this->m_NumberOfThreads) schedule(static)
+	for ( long i = 0; i < nTensors; ++i ){
+		bool isPoint = i < nPointTensors;
+		long t = isPoint ? i : i - nPointTensors;
+		long k = !onlyChanged ? t : ( isPoint ? pointIds[t] : cellIds[t] ); // the index of the point or cell
+		double *const *vectors = isPoint ? pointVectors : cellVectors;
+		double *const *values = isPoint ? pointValues : cellValues;
+		
+		double tensor[9];
+		double eigenValues[3];
+		double eigenVectors[9];
+		MeshStrainCalculator::ExpandStrain( ( isPoint ? pointStrains : cellStrains ) + MeshStrainCalculator::NumberOfStrainComponents*k, tensor );
+		SymmetricEigensolver::Compute( tensor, eigenValues, eigenVectors );
+		for ( int j = 0; j < 3; ++j ){
+			values[j][k] = eigenValues[j];
+			vectors[j][3*k] = eigenVectors[3*j];
+			vectors[j][3*k+1] = eigenVectors[3*j+1];
+			vectors[j][3*k+2] = eigenVectors[3*j+2];
+		}
 	}
-	else{
-		val1 = DataImagePixelPointer::New();
-		val1->SetNumberOfComponents(1);
-		val1->SetName("Principal Strain Value 2");
-		val1->Allocate(nPoints);
-		val1->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetCellData()->AddArray( val1 );
+	
+	this->m_ChangedStrainPoints.Clear();
+	this->m_ChangedStrainCells.Clear();
+	this->m_PrincipalStrainsAreCurrent = this->m_StrainsAreRaw;
+}
+
+/** A function to check that the point or cell data has a double array
+ * with the given name and size. */
+bool HasOutputArray( vtkDataSetAttributes *data, const char *name, int nComponents, vtkIdType nTuples )
+{
+	vtkDoubleArray *array = vtkDoubleArray::SafeDownCast( data->GetArray( name ) );
+	return array && array->GetNumberOfComponents() == nComponents && array->GetNumberOfTuples() == nTuples;
+}
+
+/** A function to get a pointer to the values of a double array of the
+ * data image, creating or resizing the array as needed. */
+double *GetOutputArray( vtkDataSetAttributes *data, const char *name, int nComponents, vtkIdType nTuples )
+{
+	vtkDoubleArray *array = vtkDoubleArray::SafeDownCast( data->GetArray( name ) );
+	if ( !array ){
+		if ( data->GetArray( name ) ) data->RemoveArray( name );
+		DataImagePixelPointer newArray = DataImagePixelPointer::New();
+		newArray->SetName( name );
+		data->AddArray( newArray );
+		array = newArray;
 	}
-	if ( this->m_DataImage->GetCellData()->GetArray("Principal Strain Value 3") ){
-		val2 = vtkDoubleArray::SafeDownCast( this->m_DataImage->GetCellData()->GetArray("Principal Strain Value 3") );
+	if ( array->GetNumberOfComponents() != nComponents || array->GetNumberOfTuples() != nTuples ){
+		array->SetNumberOfComponents( nComponents );
+		array->SetNumberOfTuples( nTuples );
 	}
-	else{
-		val2 = DataImagePixelPointer::New();
-		val2->SetNumberOfComponents(1);
-		val2->SetName("Principal Strain Value 3");
-		val2->Allocate(nPoints);
-		val2->SetNumberOfTuples(nPoints);
-		this->m_DataImage->GetCellData()->AddArray( val2 );
-	}
-	
-	for ( unsigned int i = 0; i < nPoints; ++i ){
-		// Get the point tensor
-		double *cTensorRaw = this->m_DataImage->GetCellData()->GetArray("Strain")->GetTuple( i );
-
-		// reform tensor into an appropreate array
-		double *cTensor[3];
-		double cT0[3];
-		double cT1[3];
-		double cT2[3];
-
-		cTensor[0] = cT0; cTensor[1] = cT1; cTensor[2] = cT2;
-
-		cT0[0] = *cTensorRaw;
-		cT0[1] = *(cTensorRaw+1);
-		cT0[2] = *(cTensorRaw+2);	
-		cT1[0] = *(cTensorRaw+3);
-		cT1[1] = *(cTensorRaw+4);
-		cT1[2] = *(cTensorRaw+5);
-		cT2[0] = *(cTensorRaw+6);
-		cT2[1] = *(cTensorRaw+7);
-		cT2[2] = *(cTensorRaw+8);
-
-		// Get the eigen-values and -vectors
-		double eigenValues[3]; // The Eigenvalues
-		double *eigenVectors[3]; // vector of pointers to eigenvectors
-		double v0[3]; // eigen vector 1
-		double v1[3]; // eigen vector 2
-		double v2[3]; // eigen vector 3
-		eigenVectors[0] = v0; eigenVectors[1] = v1; eigenVectors[2] = v2;
-
-		// perform the calculation of the principal strains
-		mathAlgorithm->Jacobi(cTensor,eigenValues,eigenVectors);
-
-		// save the values and vectors into the data image
-		V0->SetTuple( i, eigenVectors[0] );
-		val0->SetTuple( i, &eigenValues[0] );
-		V1->SetTuple( i, eigenVectors[1] );
-		val1->SetTuple( i, &eigenValues[1] );
-		V2->SetTuple( i, eigenVectors[2] );
-		val2->SetTuple( i, &eigenValues[2] );
-	}
-	
-}
-
-/** A function to smooth the mesh image.  This method takes the N closest 
- * points (includeing the point in question) and takes the point with the
- * median magnitude as the value. N must be odd or 1 will be added to it.
- * NOTE: This filter has been replaced by "ReplaceBadDisplacementPixels"
- * and "ReplaceBadStrainPixels." It has not been updated or debugged - 
- * USE AT YOUR OWN RISK (or update and debug). */
-void MedianImageFilter(unsigned int N)
-{
-	// if N is even, add one
-	N = (N % 2 == 1) ? N += 1 : N;
-	// create a duplicate of the data image
-	DataImagePointer tempImage = DataImagePointer::New();
-	tempImage->DeepCopy(this->m_DataImage);
-	// loop through the points of both the images
-	unsigned int nPoints = tempImage->GetNumberOfPoints();
-	for( unsigned int i = 0; i < nPoints; ++i ){
-		double *cPoint = tempImage->GetPoint( i );
-		// find the 7 closest points to the position of each point
-		vtkSmartPointer<vtkIdList> pointList = vtkSmartPointer<vtkIdList>::New();
-		//~ this->m_KDTree->FindClosestNPoints( N, cPoint, pointList );
-		this->GetNeighbouringPoints( i, pointList );
-		// calculate magnitudes
-		double neighbourhoodMagnitudes[N];
-		std::vector<double> sortingArray; // array for magnitude sorting
-		for( unsigned int j = 0; j < N; ++j){
-			vtkIdType cId = pointList->GetId( j );
-			double *tempPixel = tempImage->GetPointData()->GetArray("Displacement")->GetTuple( cId );
-			double cMag = sqrt( pow(*tempPixel,2) + pow(*(tempPixel+1),2) + pow(*(tempPixel+2),2) );
-			neighbourhoodMagnitudes[j] = cMag ;
-			sortingArray.push_back( cMag );
-		}
-		// sort the magnitudes
-		std::sort( sortingArray.begin(),sortingArray.end() );
-		double medianMag = sortingArray[ (N >> 1) ];
-		// find the magnitude in the neighbourhoodMagnitudes
-		unsigned int j = 0;
-		while( neighbourhoodMagnitudes[j] != medianMag ) ++j;
-		// set the data image pixel to the value of the temp image
-		vtkIdType medianPoint = pointList->GetId( j );
-		double *medianPixel = tempImage->GetPointData()->GetArray("Displacement")->GetTuple( medianPoint );
-		this->m_DataImage->GetPointData()->GetArray("Displacement")->SetTuple( i, medianPixel );
+	return array->GetPointer( 0 );
+}
+
+/** A function to median filter the displacements.  Each point is
+ * filtered over itself and its connected neighbours.  The mode is either
+ * MeshMedianFilter::ComponentMedian (the median of each component) or
+ * MeshMedianFilter::MagnitudeMedian (the displacement with the median 
+ * magnitude). see MeshMedianFilter */
+void DisplacementMedianFilter( MedianModeType mode = MeshMedianFilter::ComponentMedian )
+{
+	this->ApplyMedianFilter( this->m_Fields.GetDisplacement(), mode );
+}
+
+/** A function to median filter the strains.  The strains must be
+ * calculated first. see DICMesh::DisplacementMedianFilter */
+void StrainMedianFilter( MedianModeType mode = MeshMedianFilter::ComponentMedian )
+{
+	MeshStrainField &strain = this->m_Fields.GetStrain();
+	if ( !strain.IsAllocated() ){
+		std::stringstream msg("");
+		msg << "Strains must be calculated before they can be median filtered." << std::endl;
+		this->WriteToLogfile( msg.str() );
+		return;
 	}
+	this->ApplyMedianFilter( strain, mode );
+	this->m_StrainsAreRaw = false;
 }
 
 /** A function to smooth the image using a weighted moving average using
- * a Gaussian kernel for weight calculation. The function is given R, 
- * the radius of points to consider; sigma, the standard deviation of the
- * of the Gaussian kernel; and mean, the mean of the Gaussian kernel in
- * terms of distance from the point being averaged (this will in 99.99%
- * of cases need to be set to 0).*/
+ * a Gaussian kernel for weight calculation. The function is given sigma,
+ * the standard deviation of the of the Gaussian kernel; and mean, the 
+ * mean of the Gaussian kernel in terms of distance from the point being
+ * averaged (this will in 99.99% of cases need to be set to 0). The 
+ * average is taken over each point and its connected neighbours.
+ * see DICMesh::GetGaussianWeightMatrix */
 void DisplacementWeightedMovingAverageFilter( double sigma, double mean )
 {
 	// if sigma = 0, there's nothing to do
 	if ( sigma == 0) {return;}
 	
-	// create a duplicate of the data image
-	DataImagePointer tempImage = DataImagePointer::New();
-	tempImage->DeepCopy(this->m_DataImage);
-	
-	// visit each point of the temp image, replace values in m_DataImage
-	unsigned int nPoints = tempImage->GetNumberOfPoints();
-	for( unsigned int i = 0; i < nPoints; ++i ){
-		
-		double *newPixel = new double[3];
-		newPixel = CalculateDisplacementWeightedMovingAverage( sigma, mean, i, tempImage );
-		
-		// set the data image pixel to the value of the new pixel
-		this->m_DataImage->GetPointData()->GetArray("Displacement")->SetTuple( i, newPixel );
-	}
+	// apply the weights of every point to the current values, then make the new values current
+	MeshField &displacement = this->m_Fields.GetDisplacement();
+	const SparseWeightMatrix &weights = this->GetGaussianWeightMatrix( sigma, mean );
+	weights.Multiply( displacement.GetPointer(), displacement.GetWritePointer(), 3, this->m_NumberOfThreads );
+	displacement.Swap();
 }
 
 /** A function to calculate the weighted average of the displacement 
  * stored in a pixel. This fucntion takes the standard deviation, sigma,
  * and the mean distance, mean, of the gaussian kernel that will be used
  * to caluculated the weights for the weighting function. It also take 
- * the mesh point ID, pointId and a pointer to the data image that 
+ * the mesh point ID, pointId and a pointer to the displacements that 
  * should be used to caluclate the average. The point with ID pointID is
- * included in the calculation of the average. */ 
-double* CalculateDisplacementWeightedMovingAverage( double sigma, double mean, unsigned int pointId, DataImagePointer image )
+ * included in the calculation of the average. The result is put in 
+ * newPixel. */ 
+void CalculateDisplacementWeightedMovingAverage( double sigma, double mean, unsigned int pointId, const double *displacements, double *newPixel )
 {
 	if (sigma == 0) {
-		return image->GetPointData()->GetArray("Displacement")->GetTuple( pointId );
-	}
-	
-	vtkSmartPointer<vtkIdList> pointList = vtkSmartPointer<vtkIdList>::New(); 
-	this->GetNeighbouringPoints( pointId, pointList); // get connected points
-	
-	// Initialize variables for the loop
-	double totalNumerator[3] = { 0 };
-	double totalDenominator = 0;
-	
-	double *rPoint = new double[3];
-	image->GetPoint( pointId, rPoint ); // reference point location	
-	
-	// visit each points in the list and use them to calculate the new point value
-	for( unsigned int j = 0; j <= pointList->GetNumberOfIds(); ++j){
-		vtkIdType cId = j == pointList->GetNumberOfIds() ? pointId : pointList->GetId( j ); // include the reference point at the very end
-			
-		double *cPoint = new double[3];
-		image->GetPoint( cId, cPoint ); // current point location
-
-		double distance = sqrt( pow(rPoint[0]-cPoint[0],2) + pow(rPoint[1]-cPoint[1],2) + pow(rPoint[2]-cPoint[2],2) );
-		double weight = 1/(2.50662827*sigma)*pow(2.718281828,-pow((distance-mean),2)/(2*sigma*sigma)); // 1/(sqrt(2*pi)*sigma)*e^(-(X-mean)^2/(2*sigma^2)) (the Gaussian distribution)
-		
-		// add the weight to the total denominator
-		totalDenominator = totalDenominator + weight;
-		
-		// add to the numerators
-		double *tempPixel = new double[3];
-		image->GetPointData()->GetArray("Displacement")->GetTuple( cId, tempPixel ); // the original data in the current point
-		totalNumerator[0] = totalNumerator[0] + weight * tempPixel[0];
-		totalNumerator[1] = totalNumerator[1] + weight * tempPixel[1];
-		totalNumerator[2] = totalNumerator[2] + weight * tempPixel[2];
+		std::memcpy( newPixel, displacements + 3*pointId, 3*sizeof(double) );
+		return;
 	}
-	// use the total numerators and denominator to calculate the new pixel
-	double *newPixel = new double[3];
-	newPixel[0] = totalNumerator[0] / totalDenominator;
-	newPixel[1] = totalNumerator[1] / totalDenominator;
-	newPixel[2] = totalNumerator[2] / totalDenominator;
 	
-	return newPixel;
+	this->GetGaussianWeightMatrix( sigma, mean ).MultiplyRow( pointId, displacements, newPixel, 3 );
 }
 
 /** A function to smooth the image using a weighted moving average using
- * a Gaussian kernel for weight calculation. The function is given R, 
- * the radius of points to consider; sigma, the standard deviation of the
- * of the Gaussian kernel; and mean, the mean of the Gaussian kernel in
- * terms of distance from the point being averaged (this will in 99.99%
- * of cases need to be set to 0). Given a raduis of 0, the default value
- * of 3*sigma will be used*/
+ * a Gaussian kernel for weight calculation. The function is given sigma,
+ * the standard deviation of the of the Gaussian kernel; and mean, the 
+ * mean of the Gaussian kernel in terms of distance from the point being
+ * averaged (this will in 99.99% of cases need to be set to 0). The 
+ * average is taken over each point and its connected neighbours.
+ * see DICMesh::GetGaussianWeightMatrix */
 void StrainWeightedMovingAverageFilter( double sigma, double mean )
 {
 	// if sigma = 0, there's nothing to do
 	if ( sigma == 0) {return;}
 	
-	// create a duplicate of the data image
-	DataImagePointer tempImage = DataImagePointer::New();
-	tempImage->DeepCopy(this->m_DataImage);
-	
-	// loop through the points of both the images
-	unsigned int nPoints = tempImage->GetNumberOfPoints();
-	for( unsigned int i = 0; i < nPoints; ++i ){
-		
-		double *newPixel = new double[9];
-		newPixel = CalculateStrainWeightedMovingAverage( sigma, mean, i, tempImage );
-		
-		// set the data image pixel to the value of the new pixel
-		this->m_DataImage->GetPointData()->GetArray("Strain")->SetTuple( i, newPixel );
-	}
+	// apply the weights of every point to the current values, then make the new values current
+	MeshStrainField &strain = this->m_Fields.GetStrain();
+	const SparseWeightMatrix &weights = this->GetGaussianWeightMatrix( sigma, mean );
+	weights.Multiply( strain.GetPointer(), strain.GetWritePointer(), MeshStrainCalculator::NumberOfStrainComponents, this->m_NumberOfThreads );
+	strain.Swap();
+	this->m_StrainsAreRaw = false;
 }
 
 /** A function to calculate the weighted average of the strain 
  * stored in a pixel. This fucntion takes the standard deviation, sigma,
  * and the mean distance, mean, of the gaussian kernel that will be used
  * to caluculated the weights for the weighting function. It also take 
- * the mesh point ID, pointId and a pointer to the data image that 
- * should be used to caluclate the average. The point with ID pointID is
- * included in the calculation of the average. */
-double* CalculateStrainWeightedMovingAverage( double sigma, double mean, unsigned int pointId, DataImagePointer image )
+ * the mesh point ID, pointId and a pointer to the strains that should
+ * be used to caluclate the average. The point with ID pointID is
+ * included in the calculation of the average. The strains are given as
+ * 6 values per point (see MeshFieldStore) and the result is put in 
+ * newPixel. */
+void CalculateStrainWeightedMovingAverage( double sigma, double mean, unsigned int pointId, const StrainValueType *strains, StrainValueType *newPixel )
 {
+	const unsigned int nComponents = MeshStrainCalculator::NumberOfStrainComponents;
 	if ( sigma == 0){
-		return image->GetPointData()->GetArray("Stain")->GetTuple( pointId );
+		std::memcpy( newPixel, strains + nComponents*pointId, nComponents*sizeof(StrainValueType) );
+		return;
 	}
 	
-	// get connected points
-	vtkSmartPointer<vtkIdList> pointList = vtkSmartPointer<vtkIdList>::New(); // id list to hold ids of the closest points
-	this->GetNeighbouringPoints( pointId, pointList );
-	
-	// Initialize vaiables for the loop
-	double totalNumerator[9] = { 0 };
-	double totalDenominator = 0;
-	
-	double *rPoint = new double[3]; // get reference point location
-	image->GetPoint(pointId, rPoint );
-	
-	// visit each connected point in the list and use them to calculate the new point value
-	for( unsigned int j = 0; j <= pointList->GetNumberOfIds(); ++j){
-		vtkIdType cId = j == pointList->GetNumberOfIds() ? pointId : pointList->GetId( j ); // include the reference point at the very end
-
-		double *cPoint = new double[3]; // get current point location
-		image->GetPoint( cId, cPoint );
-		
-		double distance = sqrt( pow(*cPoint-*rPoint,2) + pow(*(cPoint+1)-*(rPoint+1),2) + pow(*(cPoint+2)-*(rPoint+2),2) );  //vector distance between the two
-		double weight = 1/(2.50662827*sigma)*pow(2.718281828,-pow((distance-mean),2)/(2*sigma*sigma)); // 1/(sigma*sqrt(2*pi))*e^(-(X-mean)^2/(2*sigma^2)) (the Gaussian distribution)
-
-		totalDenominator = totalDenominator + weight; // add the weight to the total denominator
-		
-		// add to the numerators
-		double *tempPixel = image->GetPointData()->GetArray("Strain")->GetTuple( cId ); // the original data in the current point
-		totalNumerator[0] = totalNumerator[0] + weight * tempPixel[0];
-		totalNumerator[1] = totalNumerator[1] + weight * tempPixel[1];
-		totalNumerator[2] = totalNumerator[2] + weight * tempPixel[2];
-		totalNumerator[3] = totalNumerator[3] + weight * tempPixel[3];
-		totalNumerator[4] = totalNumerator[4] + weight * tempPixel[4];
-		totalNumerator[5] = totalNumerator[5] + weight * tempPixel[5];
-		totalNumerator[6] = totalNumerator[6] + weight * tempPixel[6];
-		totalNumerator[7] = totalNumerator[7] + weight * tempPixel[7];
-		totalNumerator[8] = totalNumerator[8] + weight * tempPixel[8];
-	}
-	
-	// use the total numerators and denominator to calculate the new pixel
-	double *newPixel = new double[9];
-	newPixel[0] = totalNumerator[0] / totalDenominator;
-	newPixel[1] = totalNumerator[1] / totalDenominator;
-	newPixel[2] = totalNumerator[2] / totalDenominator;
-	newPixel[3] = totalNumerator[3] / totalDenominator;
-	newPixel[4] = totalNumerator[4] / totalDenominator;
-	newPixel[5] = totalNumerator[5] / totalDenominator;
-	newPixel[6] = totalNumerator[6] / totalDenominator;
-	newPixel[7] = totalNumerator[7] / totalDenominator;
-	newPixel[8] = totalNumerator[8] / totalDenominator;
-	
-	return newPixel;
+	this->GetGaussianWeightMatrix( sigma, mean ).MultiplyRow( pointId, strains, newPixel, nComponents );
 }
 
 /** This function will use the image registration method inherited from 
@@ -1328,34 +1840,21 @@ double* CalculateStrainWeightedMovingAverage( double sigma, double mean, unsigne
  * to downsample the images is stored in m_GlobalRegDownsampleValue*/
 void GlobalRegistration()
 {
-	// Use an ShrinkImageFilter to blur and downsample fixed and moving images to improve radius of convergance
-	typedef itk::ShrinkImageFilter< FixedImageType, FixedImageType > FixedResamplerType;
-	typename FixedResamplerType::Pointer	fixedResampler = FixedResamplerType::New();
-	typedef itk::ShrinkImageFilter< MovingImageType, MovingImageType > MovingResamplerType;
-	typename MovingResamplerType::Pointer	movingResampler = MovingResamplerType::New();
-		
-	fixedResampler->SetInput( this->m_FixedImage );
-	movingResampler->SetInput( this->m_MovingImage );
-	
-	fixedResampler->SetShrinkFactors( this->m_GlobalRegDownsampleValue );
-	movingResampler->SetShrinkFactors( this->m_GlobalRegDownsampleValue );
-	
-	fixedResampler->SetNumberOfThreads( this->m_Registration->GetNumberOfThreads() );
-	movingResampler->SetNumberOfThreads( this->m_Registration->GetNumberOfThreads() );
-	
-	std::stringstream msg(""); // note the current action in the logfile
-	msg <<"Resampling for global registration"<<std::endl;
-	this->WriteToLogfile( msg.str() );
-	
-	fixedResampler->Update();
-	movingResampler->Update();
+	// the images may have been shrunk while the other inputs were read
+	if ( !this->m_GlobalFixedImage || !IsSameImage( this->m_FixedImage, this->m_GlobalFixedImageSource, this->m_GlobalFixedImageSourceTime ) ){
+		this->ShrinkFixedImageForGlobalRegistration();
+	}
+	if ( !this->m_GlobalMovingImage || !IsSameImage( this->m_MovingImage, this->m_GlobalMovingImageSource, this->m_GlobalMovingImageSourceTime ) ){
+		this->ShrinkMovingImageForGlobalRegistration();
+	}
+	std::stringstream msg("");
 	
 	// global registration - rotation is centred on the body
-	this->m_Registration->SetFixedImage( fixedResampler->GetOutput() );
-	this->m_Registration->SetMovingImage( movingResampler->GetOutput() );
+	this->m_Registration->SetFixedImage( this->m_GlobalFixedImage );
+	this->m_Registration->SetMovingImage( this->m_GlobalMovingImage );
 	this->SetTransformToIdentity();
-	this->m_TransformInitializer->SetFixedImage( fixedResampler->GetOutput() );
-	this->m_TransformInitializer->SetMovingImage( movingResampler->GetOutput() );
+	this->m_TransformInitializer->SetFixedImage( this->m_GlobalFixedImage );
+	this->m_TransformInitializer->SetMovingImage( this->m_GlobalMovingImage );
 	this->m_TransformInitializer->SetTransform( this->m_Transform );
 	this->m_TransformInitializer->GeometryOn();
 	this->m_TransformInitializer->InitializeTransform();
@@ -1374,9 +1873,9 @@ void GlobalRegistration()
 	meshSize[2] = meshBBox[5]-meshBBox[4];
 		
 	typename FixedImageType::IndexType fixedImageROIStart;
-	fixedResampler->GetOutput()->TransformPhysicalPointToIndex(meshMinPt,fixedImageROIStart); // convert min point to start index
+	this->m_GlobalFixedImage->TransformPhysicalPointToIndex(meshMinPt,fixedImageROIStart); // convert min point to start index
 	
-	typename FixedImageType::SpacingType fixedSpacing = fixedResampler->GetOutput()->GetSpacing(); // convert dimensinos to size in pixels
+	typename FixedImageType::SpacingType fixedSpacing = this->m_GlobalFixedImage->GetSpacing(); // convert dimensinos to size in pixels
 	
 	typename FixedImageType::SizeType fixedImageROILengths;
 	fixedImageROILengths[0] = (int)std::floor(meshSize[0]/fixedSpacing[0]);
@@ -1390,6 +1889,37 @@ void GlobalRegistration()
 	this->m_Registration->SetFixedImageRegion( fixedAnalysisRegion ); // set the limited analysis region
 	this->m_Registration->SetFixedImageRegionDefined( true );
 	
+	// a previous run on the same images with the same settings has the result
+	ImageCache::KeyType cacheKey = 0;
+	std::vector< double > cachedParameters;
+	if ( this->m_Cache.IsEnabled() ){
+		cacheKey = ImageCache::Combine( this->GetFixedImageKey(), std::string( "globalregistration" ) );
+		cacheKey = ImageCache::Combine( cacheKey, this->GetMovingImageKey() );
+		cacheKey = ImageCache::Combine( cacheKey, this->m_GlobalRegDownsampleValue );
+		for ( unsigned int i = 0; i < 6; ++i ) cacheKey = ImageCache::Combine( cacheKey, meshBBox[i] );
+		cacheKey = ImageCache::Combine( cacheKey, this->m_Optimizer->GetMaximumStepLength() );
+		cacheKey = ImageCache::Combine( cacheKey, this->m_Optimizer->GetMinimumStepLength() );
+		cacheKey = ImageCache::Combine( cacheKey, this->m_Optimizer->GetRelaxationFactor() );
+		cacheKey = ImageCache::Combine( cacheKey, this->m_Optimizer->GetGradientMagnitudeTolerance() );
+		cacheKey = ImageCache::Combine( cacheKey, this->m_Optimizer->GetNumberOfIterations() );
+		for ( unsigned int i = 0; i < this->m_Optimizer->GetScales().Size(); ++i ){
+			cacheKey = ImageCache::Combine( cacheKey, (double)this->m_Optimizer->GetScales()[i] );
+		}
+		cacheKey = ImageCache::Combine( cacheKey, std::string( this->m_Registration->GetMetric()->GetNameOfClass() ) );
+		cacheKey = ImageCache::Combine( cacheKey, std::string( this->m_Registration->GetInterpolator()->GetNameOfClass() ) );
+		if ( this->m_Cache.LoadValues( cacheKey, cachedParameters ) && 
+			cachedParameters.size() == this->m_Transform->GetNumberOfParameters() ){
+			RegistrationParametersType	finalParameters( cachedParameters.size() );
+			for ( unsigned int i = 0; i < cachedParameters.size(); ++i ) finalParameters[i] = cachedParameters[i];
+			this->m_Registration->SetFixedImageRegionDefined( false );
+			msg.str("");
+			msg << "Global registration read from the cache"<<std::endl<< "Final Params:"<< finalParameters;
+			this->WriteToLogfile( msg.str() );
+			this->SetMeshToGobalRegistrationResult( finalParameters );
+			return;
+		}
+	}
+	
 	msg.str("");
 	msg << "Global registration in progress"<<std::endl;
 	this->WriteToLogfile( msg.str() );
@@ -1401,6 +1931,10 @@ void GlobalRegistration()
 	this->WriteToLogfile( msg.str() );
 
 	RegistrationParametersType	finalParameters = this->m_Registration->GetLastTransformParameters();
+	if ( this->m_Cache.IsEnabled() ){
+		cachedParameters.assign( finalParameters.begin(), finalParameters.end() );
+		this->m_Cache.StoreValues( cacheKey, cachedParameters );
+	}
 	msg.str("");
 	msg << "Final Params:"<< finalParameters;
 	this->WriteToLogfile( msg.str() );
@@ -1408,6 +1942,78 @@ void GlobalRegistration()
 	this->SetMeshToGobalRegistrationResult( finalParameters );
 }
 
+/** A function to blur and downsample the fixed image for the global 
+ * registration with the ITK shrink image filter.  It can be called as
+ * soon as the fixed image is set, e.g. while the moving image is still
+ * being read, otherwise GlobalRegistration calls it. */
+void ShrinkFixedImageForGlobalRegistration()
+{
+	typedef itk::ShrinkImageFilter< FixedImageType, FixedImageType > FixedResamplerType;
+	typename FixedResamplerType::Pointer	fixedResampler = FixedResamplerType::New();
+	fixedResampler->SetInput( this->m_FixedImage );
+	fixedResampler->SetShrinkFactors( this->m_GlobalRegDownsampleValue );
+	fixedResampler->SetNumberOfThreads( this->m_Registration->GetNumberOfThreads() );
+	
+	std::stringstream msg(""); // note the current action in the logfile
+	ImageCache::KeyType cacheKey = 0;
+	if ( this->m_Cache.IsEnabled() ){
+		cacheKey = ImageCache::Combine( this->GetFixedImageKey(), std::string( "shrink" ) );
+		cacheKey = ImageCache::Combine( cacheKey, this->m_GlobalRegDownsampleValue );
+		if ( this->m_Cache.LoadImage( cacheKey, this->m_GlobalFixedImageMapper ) ){
+			msg <<"Mapped the resampled fixed image from the cache"<<std::endl;
+			this->WriteToLogfile( msg.str() );
+			this->m_GlobalFixedImage = this->m_GlobalFixedImageMapper.GetOutput();
+			this->m_GlobalFixedImageSource = this->m_FixedImage.GetPointer();
+			this->m_GlobalFixedImageSourceTime = this->m_FixedImage->GetMTime();
+			return;
+		}
+	}
+	
+	msg <<"Resampling the fixed image for global registration"<<std::endl;
+	this->WriteToLogfile( msg.str() );
+	
+	fixedResampler->Update();
+	this->m_GlobalFixedImage = fixedResampler->GetOutput();
+	this->m_GlobalFixedImageSource = this->m_FixedImage.GetPointer();
+	this->m_GlobalFixedImageSourceTime = this->m_FixedImage->GetMTime();
+	if ( this->m_Cache.IsEnabled() ) this->m_Cache.StoreImage( cacheKey, this->m_GlobalFixedImage.GetPointer() );
+}
+
+/** A function to blur and downsample the moving image for the global
+ * registration, see ShrinkFixedImageForGlobalRegistration. */
+void ShrinkMovingImageForGlobalRegistration()
+{
+	typedef itk::ShrinkImageFilter< MovingImageType, MovingImageType > MovingResamplerType;
+	typename MovingResamplerType::Pointer	movingResampler = MovingResamplerType::New();
+	movingResampler->SetInput( this->m_MovingImage );
+	movingResampler->SetShrinkFactors( this->m_GlobalRegDownsampleValue );
+	movingResampler->SetNumberOfThreads( this->m_Registration->GetNumberOfThreads() );
+	
+	std::stringstream msg(""); // note the current action in the logfile
+	ImageCache::KeyType cacheKey = 0;
+	if ( this->m_Cache.IsEnabled() ){
+		cacheKey = ImageCache::Combine( this->GetMovingImageKey(), std::string( "shrink" ) );
+		cacheKey = ImageCache::Combine( cacheKey, this->m_GlobalRegDownsampleValue );
+		if ( this->m_Cache.LoadImage( cacheKey, this->m_GlobalMovingImageMapper ) ){
+			msg <<"Mapped the resampled moving image from the cache"<<std::endl;
+			this->WriteToLogfile( msg.str() );
+			this->m_GlobalMovingImage = this->m_GlobalMovingImageMapper.GetOutput();
+			this->m_GlobalMovingImageSource = this->m_MovingImage.GetPointer();
+			this->m_GlobalMovingImageSourceTime = this->m_MovingImage->GetMTime();
+			return;
+		}
+	}
+	
+	msg <<"Resampling the moving image for global registration"<<std::endl;
+	this->WriteToLogfile( msg.str() );
+	
+	movingResampler->Update();
+	this->m_GlobalMovingImage = movingResampler->GetOutput();
+	this->m_GlobalMovingImageSource = this->m_MovingImage.GetPointer();
+	this->m_GlobalMovingImageSourceTime = this->m_MovingImage->GetMTime();
+	if ( this->m_Cache.IsEnabled() ) this->m_Cache.StoreImage( cacheKey, this->m_GlobalMovingImage.GetPointer() );
+}
+
 /** A method that takes a transformation (generally from the global
  * registration) and calculates and each point in the mesh image what
  * the pure translation is of that point. */
@@ -1424,11 +2030,10 @@ void SetMeshToGobalRegistrationResult(RegistrationParametersType GlobalRegistrat
 		this->GetRegistrationMethod()->GetTransform()->SetParameters( GlobalRegistrationResult );
 		typename TransformType::OutputPointType outPoint = this->GetRegistrationMethod()->GetTransform()->TransformPoint( inPoint );
 		
-		double *currentData = new double[3];
+		double *currentData = this->m_Fields.GetDisplacement().GetTuplePointer( i );
 		*currentData = outPoint[0]-inPoint[0];
 		*(currentData+1) = outPoint[1]-inPoint[1];
-		*(currentData+2) = outPoint[2]-inPoint[2];	
-		this->m_DataImage->GetPointData()->GetArray("Displacement")->SetTuple( i , currentData );
+		*(currentData+2) = outPoint[2]-inPoint[2];
 	}
 	
 }
@@ -1439,6 +2044,8 @@ void SetGlobalRegistrationDownsampleValue( unsigned int value )
 {
 	if (m_GlobalRegDownsampleValue != value){
 		this->m_GlobalRegDownsampleValue = value;
+		this->m_GlobalFixedImage = 0; // shrink again
+		this->m_GlobalMovingImage = 0;
 	}
 }
 
@@ -1449,6 +2056,55 @@ unsigned int GetGlobalRegistrationDownsampleValue()
 	return this->m_GlobalRegDownsampleValue;
 }
 
+/** Set a directory to keep the resampled images and the result of the
+ * global registration in, so later runs on the same images with the 
+ * same settings map them instead of computing them again.  The 
+ * artifacts are found by the content of the images, see ImageCache.  
+ * An empty directory turns the cache off, the default. */
+void SetCacheDirectory( const std::string &directory )
+{
+	this->m_Cache.SetDirectory( directory );
+}
+
+/** Set the size in bytes the cache directory is kept to by deleting
+ * the least recently used artifacts. */
+void SetCacheSizeLimit( double bytes )
+{
+	this->m_Cache.SetSizeLimit( bytes );
+}
+
+/** Check that an image is the one something was computed from: the
+ * same object, not modified since.  The modified time also tells a new
+ * image apart from a freed one that had the same address. */
+static bool IsSameImage( const itk::Object *image, const itk::Object *source, unsigned long sourceTime )
+{
+	return image && image == source && image->GetMTime() == sourceTime;
+}
+
+/** Get the key of the content of the fixed image, hashed again only
+ * when a new fixed image is set. */
+ImageCache::KeyType GetFixedImageKey()
+{
+	if ( !IsSameImage( this->m_FixedImage, this->m_FixedImageKeySource, this->m_FixedImageKeySourceTime ) ){
+		this->m_FixedImageKey = ImageCache::Hash( this->m_FixedImage.GetPointer(), this->GetNumberOfImageThreads() );
+		this->m_FixedImageKeySource = this->m_FixedImage.GetPointer();
+		this->m_FixedImageKeySourceTime = this->m_FixedImage->GetMTime();
+	}
+	return this->m_FixedImageKey;
+}
+
+/** Get the key of the content of the moving image, see 
+ * GetFixedImageKey. */
+ImageCache::KeyType GetMovingImageKey()
+{
+	if ( !IsSameImage( this->m_MovingImage, this->m_MovingImageKeySource, this->m_MovingImageKeySourceTime ) ){
+		this->m_MovingImageKey = ImageCache::Hash( this->m_MovingImage.GetPointer(), this->GetNumberOfImageThreads() );
+		this->m_MovingImageKeySource = this->m_MovingImage.GetPointer();
+		this->m_MovingImageKeySourceTime = this->m_MovingImage->GetMTime();
+	}
+	return this->m_MovingImageKey;
+}
+
 /** A function to set the error tolerance in units of standard 
  * deviations from the average of the connected pixels. If a pixel is 
  * found to be farther from the mean than the value set, it will be
@@ -1518,27 +2174,12 @@ void GetNeighbouringPoints( vtkIdType id, vtkSmartPointer<vtkIdList> idList )
 {
 	idList->Reset(); // reset the ID list to avoid mistakes
 	
-	// Get the cell IDs that 'id' is part of
-	vtkSmartPointer<vtkIdList> cCellList = vtkSmartPointer<vtkIdList>::New();
-	this->m_DataImage->GetPointCells( id, cCellList );
-	
-	// visit each cell
-	for( unsigned int i = 0; i < cCellList->GetNumberOfIds(); ++i ){
-		
-		// visit each line in each cell
-		for ( int j = 0; j < this->m_DataImage->GetCell( cCellList->GetId( i ) )->GetNumberOfEdges(); ++j){
-			
-			// if 'id' is the first in the line, save the second id as a unique id
-			if( this->m_DataImage->GetCell(cCellList->GetId(i))->GetEdge(j)->GetPointId(0) == id ){
-				idList->InsertUniqueId( this->m_DataImage->GetCell(cCellList->GetId(i))->GetEdge(j)->GetPointId(1) );
-				continue;
-			}
-			// if 'id' is the second in the line, save the first id as a unique id
-			if( this->m_DataImage->GetCell(cCellList->GetId(i))->GetEdge(j)->GetPointId(1) == id ){
-				idList->InsertUniqueId( this->m_DataImage->GetCell(cCellList->GetId(i))->GetEdge(j)->GetPointId(0) );
-				continue;
-			}
-		}
+	const MeshNeighbourhood &neighbourhood = this->GetNeighbourhood();
+	const NodeIdType *neighbours = neighbourhood.GetNeighbours( id );
+	NodeIdType nNeighbours = neighbourhood.GetNumberOfNeighbours( id );
+	idList->SetNumberOfIds( nNeighbours );
+	for ( NodeIdType i = 0; i < nNeighbours; ++i ){
+		idList->SetId( i, neighbours[i] );
 	}
 }
 
@@ -1553,6 +2194,58 @@ double						m_maxMeticValue; // this because I'm using the normalized x-correlat
 vtkSmartPointer<vtkIdList>	m_pointsList;
 RegistrationParametersType	m_GlobalRegistrationParameters;
 unsigned int				m_GlobalRegDownsampleValue;
+FixedImagePointer			m_GlobalFixedImage; // the shrunk images and the images they were shrunk from
+MovingImagePointer			m_GlobalMovingImage;
+const FixedImageType		*m_GlobalFixedImageSource;
+const MovingImageType		*m_GlobalMovingImageSource;
+unsigned long				m_GlobalFixedImageSourceTime; // the modified times of the images they were shrunk from
+unsigned long				m_GlobalMovingImageSourceTime;
+MetaImageMapper< FixedImageType >	m_GlobalFixedImageMapper; // hold the shrunk images mapped from the cache
+MetaImageMapper< MovingImageType >	m_GlobalMovingImageMapper;
+ImageCache					m_Cache;
+ImageCache::KeyType			m_FixedImageKey; // the content keys of the images and the images they were computed from
+ImageCache::KeyType			m_MovingImageKey;
+const FixedImageType		*m_FixedImageKeySource;
+const MovingImageType		*m_MovingImageKeySource;
+unsigned long				m_FixedImageKeySourceTime;
+unsigned long				m_MovingImageKeySourceTime;
+unsigned int				m_NumberOfThreads;
+unsigned int				m_NumberOfImageThreads;
+
+// geometry dependent data, rebuilt when the geometry of m_DataImage changes
+vtkSmartPointer<vtkPoints>		m_GeometryPoints;
+vtkSmartPointer<vtkCellArray>	m_GeometryCells;
+MeshNeighbourhood			m_Neighbourhood;
+std::vector<double>			m_NodeLocations;
+WeightMatrixCacheType		m_WeightMatrixCache;
+MeshStrainCalculator		m_StrainCalculator;
+MovingLeastSquaresStrain	m_MovingLeastSquaresStrain;
+StructuredGrid				m_StructuredGrid; // empty unless the nodes were generated on a grid
+
+// the last calculated strains and the displacements they came from, for incremental updates
+std::vector<double>				m_StrainDisplacements;
+std::vector<StrainValueType>	m_RawStrain;
+std::vector<StrainValueType>	m_RawCellStrain;
+NodeBitmap					m_ChangedStrainPoints; // strains changed since the principal strains were calculated
+NodeBitmap					m_ChangedStrainCells;
+bool						m_StrainsAreRaw; // the strain fields hold the calculated strains, unfiltered
+bool						m_PrincipalStrainsAreCurrent; // the principal strains match the calculated strains, except the changed ones
+
+// moving least squares strain parameters
+bool						m_UseMovingLeastSquaresStrain;
+unsigned int				m_MovingLeastSquaresNeighbours;
+double						m_MovingLeastSquaresRadius;
+unsigned int				m_MovingLeastSquaresOrder;
+
+// result file format
+std::string					m_ResultFileExtension;
+int							m_OutputCompressionLevel;
+unsigned int				m_OutputPieces;
+std::map< std::string, std::string >	m_ResultArrays; // the arrays of each result file
+std::string					m_ResultContainerFileName; // the results container created by this run
+
+// the point and cell fields, copied into m_DataImage for output
+MeshFieldStore				m_Fields;
 	
 }; // end class DICMesh
 
@@ -0,0 +1,589 @@
+//      GmshReader.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef GMSHREADER_H
+#define GMSHREADER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+#include "MappedFile.cxx"
+
+/** A class to read the nodes and the tetrahedra of a gmsh mesh file.
+ * MSH 2 and MSH 4.1 files are read in ASCII and binary form.  The file
+ * is mapped into memory, the lines of the ASCII sections are found in
+ * parallel and every node and element is parsed in parallel straight
+ * into the output buffers.  Linear and quadratic tets are kept, in the
+ * vtk node order, and other elements are skipped and counted by type. 
+ * The cells are stored as the number of nodes followed by the node ids,
+ * the layout of a vtkCellArray, so TIdType should be vtkIdType. */
+template< typename TIdType >
+class GmshReader
+{
+public:
+
+typedef TIdType								IdType;
+typedef std::map< int, unsigned long >		ElementCountType;
+
+/** Constructor **/
+GmshReader() {}
+
+/** Destructor **/
+~GmshReader() {}
+
+/** Read the file with nThreads threads.  Returns false and sets the
+ * error message if the file cannot be read. */
+bool Read( const std::string &fileName, unsigned int nThreads )
+{
+	m_Points.clear();
+	m_CellTypes.clear();
+	m_Cells.clear();
+	m_SkippedElements.clear();
+	m_ErrorMessage.clear();
+	m_NumberOfThreads = nThreads > 0 ? nThreads : 1;
+	
+	MappedFile file;
+	if ( !file.Open( fileName ) ) return this->Fail( "Cannot open Gmsh file for reading." );
+	m_Begin = file.GetData();
+	m_End = m_Begin + file.GetSize();
+	
+	if ( !this->ReadFormat() ) return false;
+	std::vector< long > tags;
+	if ( !this->ReadNodes( tags ) ) return false;
+	if ( !this->BuildNodeIndex( tags ) ) return false;
+	return this->ReadElements();
+}
+
+/** Get the node locations, 3 coordinates per node. */
+const std::vector< double > &GetPoints() const
+{
+	return m_Points;
+}
+
+/** Get the vtk cell type of every cell. */
+const std::vector< int > &GetCellTypes() const
+{
+	return m_CellTypes;
+}
+
+/** Get the cells in the vtkCellArray layout. */
+const std::vector< IdType > &GetCells() const
+{
+	return m_Cells;
+}
+
+/** Get the number of skipped elements of every gmsh element type. */
+const ElementCountType &GetSkippedElements() const
+{
+	return m_SkippedElements;
+}
+
+/** Get the reason the last read failed. */
+const std::string &GetErrorMessage() const
+{
+	return m_ErrorMessage;
+}
+
+private:
+
+// the way the node tags of an element are stored
+enum TagFormatType { AsciiTags, IntTags, SizeTags };
+
+// an element found in the file, its nodes are parsed later
+struct ElementRecord
+{
+	const char	*nodes;
+	int			type;
+};
+
+bool Fail( const std::string &message )
+{
+	m_ErrorMessage = message;
+	return false;
+}
+
+/** The number of nodes of the gmsh element types, 0 if unknown. */
+static unsigned int GetNumberOfElementNodes( int type )
+{
+	static const unsigned int nodes[32] = { 0, 2, 3, 4, 4, 8, 6, 5, 3, 6, 9, 10, 27, 18, 14, 1, 8, 20, 15, 13, 9, 10, 12, 15, 15, 21, 4, 5, 6, 20, 35, 56 };
+	return type > 0 && type < 32 ? nodes[type] : 0;
+}
+
+/** The vtk cell type of the gmsh element types that are kept, 0 for the
+ * others. */
+static int GetVTKCellType( int type )
+{
+	if ( type == 4 ) return 10; // linear tet, VTK_TETRA
+	if ( type == 11 ) return 24; // quadratic tet, VTK_QUADRATIC_TETRA
+	return 0;
+}
+
+static long ParseLong( const char *&p )
+{
+	char *end;
+	long value = std::strtol( p, &end, 10 );
+	p = end;
+	return value;
+}
+
+static double ParseDouble( const char *&p )
+{
+	char *end;
+	double value = std::strtod( p, &end );
+	p = end;
+	return value;
+}
+
+template< typename TValue >
+static TValue ReadBinary( const char *&p )
+{
+	TValue value;
+	std::memcpy( &value, p, sizeof(TValue) );
+	p = p + sizeof(TValue);
+	return value;
+}
+
+static const char *NextLine( const char *p, const char *end )
+{
+	const char *newline = static_cast< const char* >( std::memchr( p, '\n', end - p ) );
+	return newline ? newline + 1 : end;
+}
+
+/** Find the line "$name" and return its start, or 0. */
+const char *FindLine( const char *from, const std::string &name ) const
+{
+	std::string key = "$" + name;
+	const char *p = from;
+	while ( true ){
+		p = std::search( p, m_End, key.begin(), key.end() );
+		if ( p == m_End ) return 0;
+		const char *after = p + key.size();
+		if ( ( p == m_Begin || p[-1] == '\n' ) && ( after == m_End || *after == '\n' || *after == '\r' ) ){
+			return p;
+		}
+		p = after;
+	}
+}
+
+/** Find the line "$name" and return the start of the next line, or 0. */
+const char *FindSection( const char *from, const std::string &name ) const
+{
+	const char *p = this->FindLine( from, name );
+	return p ? NextLine( p, m_End ) : 0;
+}
+
+/** Find the start of every line between begin and end in parallel. */
+void FindLineStarts( const char *begin, const char *end, std::vector< const char* > &starts ) const
+{
+	const long nChunks = m_NumberOfThreads;
+	const long size = end - begin;
+	std::vector< long > counts( nChunks + 1, 0 );
+	
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+	for ( long c = 0; c < nChunks; ++c ){
+		const char *chunkEnd = begin + size*(c+1)/nChunks;
+		for ( const char *p = begin + size*c/nChunks; p < chunkEnd; ++p ){
+			if ( *p == '\n' && p + 1 < end ) ++counts[c+1];
+		}
+	}
+	for ( long c = 0; c < nChunks; ++c ){
+		counts[c+1] = counts[c+1] + counts[c];
+	}
+	
+	starts.resize( counts[nChunks] + 1 );
+	starts[0] = begin;
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+	for ( long c = 0; c < nChunks; ++c ){
+		long line = counts[c] + 1;
+		const char *chunkEnd = begin + size*(c+1)/nChunks;
+		for ( const char *p = begin + size*c/nChunks; p < chunkEnd; ++p ){
+			if ( *p == '\n' && p + 1 < end ) starts[ line++ ] = p + 1;
+		}
+	}
+}
+
+/** Read the version and file type. */
+bool ReadFormat()
+{
+	const char *p = this->FindSection( m_Begin, "MeshFormat" );
+	if ( !p ) return this->Fail( "The Gmsh file has no $MeshFormat section." );
+	double version = ParseDouble( p );
+	long fileType = ParseLong( p );
+	long dataSize = ParseLong( p );
+	m_Version = (int)version;
+	m_Binary = fileType == 1;
+	
+	if ( m_Version != 2 && !( version > 4.05 && m_Version == 4 ) ){
+		std::stringstream msg("");
+		msg << "Unsupported Gmsh file version "<<version<<", only MSH 2 and MSH 4.1 are read.";
+		return this->Fail( msg.str() );
+	}
+	if ( m_Binary ){
+		if ( m_Version == 4 && dataSize != (long)sizeof(std::size_t) ){
+			return this->Fail( "The binary Gmsh file has a different size_t than this machine." );
+		}
+		p = NextLine( p, m_End );
+		if ( p + sizeof(int) > m_End || ReadBinary< int >( p ) != 1 ){
+			return this->Fail( "The binary Gmsh file has a different byte order than this machine." );
+		}
+	}
+	return true;
+}
+
+/** Read the node tags and locations. */
+bool ReadNodes( std::vector< long > &tags )
+{
+	const char *begin = this->FindSection( m_Begin, "Nodes" );
+	const char *end = begin ? this->FindLine( begin, "EndNodes" ) : 0;
+	if ( !begin || !end ) return this->Fail( "The Gmsh file has no $Nodes section." );
+	m_SectionEnd = end;
+	
+	if ( m_Binary ){
+		return m_Version == 2 ? this->ReadBinaryNodes2( begin, tags ) : this->ReadBinaryNodes4( begin, tags );
+	}
+	std::vector< const char* > lines;
+	this->FindLineStarts( begin, end, lines );
+	return m_Version == 2 ? this->ReadAsciiNodes2( lines, tags ) : this->ReadAsciiNodes4( lines, tags );
+}
+
+bool ReadAsciiNodes2( const std::vector< const char* > &lines, std::vector< long > &tags )
+{
+	const char *p = lines[0];
+	long nNodes = ParseLong( p );
+	if ( nNodes < 0 || (std::size_t)nNodes + 1 > lines.size() ) return this->Fail( "The $Nodes section of the Gmsh file is too short." );
+	tags.resize( nNodes );
+	m_Points.resize( 3*nNodes );
+	
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+	for ( long i = 0; i < nNodes; ++i ){
+		const char *q = lines[i+1];
+		tags[i] = ParseLong( q );
+		m_Points[3*i] = ParseDouble( q );
+		m_Points[3*i+1] = ParseDouble( q );
+		m_Points[3*i+2] = ParseDouble( q );
+	}
+	return true;
+}
+
+bool ReadAsciiNodes4( const std::vector< const char* > &lines, std::vector< long > &tags )
+{
+	const char *p = lines[0];
+	long nBlocks = ParseLong( p );
+	long nNodes = ParseLong( p );
+	tags.resize( nNodes );
+	m_Points.resize( 3*nNodes );
+	
+	std::size_t line = 1;
+	long index = 0;
+	for ( long b = 0; b < nBlocks; ++b ){
+		if ( line >= lines.size() ) return this->Fail( "The $Nodes section of the Gmsh file is too short." );
+		p = lines[line++];
+		ParseLong( p ); // entity dimension
+		ParseLong( p ); // entity tag
+		ParseLong( p ); // parametric, the parametric coordinates follow x y z and are not read
+		long n = ParseLong( p );
+		if ( n < 0 || index + n > nNodes || line + 2*n > lines.size() ) return this->Fail( "The $Nodes section of the Gmsh file is too short." );
+		
+		#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+		for ( long i = 0; i < n; ++i ){
+			const char *q = lines[ line + i ];
+			tags[ index + i ] = ParseLong( q );
+			q = lines[ line + n + i ];
+			m_Points[ 3*( index + i ) ] = ParseDouble( q );
+			m_Points[ 3*( index + i ) + 1 ] = ParseDouble( q );
+			m_Points[ 3*( index + i ) + 2 ] = ParseDouble( q );
+		}
+		line = line + 2*n;
+		index = index + n;
+	}
+	return true;
+}
+
+bool ReadBinaryNodes2( const char *p, std::vector< long > &tags )
+{
+	long nNodes = ParseLong( p );
+	p = NextLine( p, m_SectionEnd );
+	const std::size_t recordSize = sizeof(int) + 3*sizeof(double);
+	if ( nNodes < 0 || p + nNodes*recordSize > m_SectionEnd ) return this->Fail( "The $Nodes section of the Gmsh file is too short." );
+	tags.resize( nNodes );
+	m_Points.resize( 3*nNodes );
+	
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+	for ( long i = 0; i < nNodes; ++i ){
+		const char *q = p + i*recordSize;
+		tags[i] = ReadBinary< int >( q );
+		std::memcpy( &m_Points[3*i], q, 3*sizeof(double) );
+	}
+	return true;
+}
+
+bool ReadBinaryNodes4( const char *p, std::vector< long > &tags )
+{
+	if ( p + 4*sizeof(std::size_t) > m_SectionEnd ) return this->Fail( "The $Nodes section of the Gmsh file is too short." );
+	std::size_t nBlocks = ReadBinary< std::size_t >( p );
+	std::size_t nNodes = ReadBinary< std::size_t >( p );
+	p = p + 2*sizeof(std::size_t); // the minimum and maximum tags
+	tags.resize( nNodes );
+	m_Points.resize( 3*nNodes );
+	
+	std::size_t index = 0;
+	for ( std::size_t b = 0; b < nBlocks; ++b ){
+		if ( p + 3*sizeof(int) + sizeof(std::size_t) > m_SectionEnd ) return this->Fail( "The $Nodes section of the Gmsh file is too short." );
+		int dimension = ReadBinary< int >( p );
+		ReadBinary< int >( p ); // entity tag
+		int parametric = ReadBinary< int >( p );
+		long n = (long)ReadBinary< std::size_t >( p );
+		const std::size_t nValues = 3 + ( parametric ? dimension : 0 );
+		if ( index + n > nNodes || p + n*( sizeof(std::size_t) + nValues*sizeof(double) ) > m_SectionEnd ) return this->Fail( "The $Nodes section of the Gmsh file is too short." );
+		
+		const char *coordinates = p + n*sizeof(std::size_t);
+		#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+		for ( long i = 0; i < n; ++i ){
+			const char *q = p + i*sizeof(std::size_t);
+			tags[ index + i ] = (long)ReadBinary< std::size_t >( q );
+			std::memcpy( &m_Points[ 3*( index + i ) ], coordinates + i*nValues*sizeof(double), 3*sizeof(double) );
+		}
+		p = coordinates + n*nValues*sizeof(double);
+		index = index + n;
+	}
+	return true;
+}
+
+/** Build the lookup from node tags to the node ids, in file order. */
+bool BuildNodeIndex( const std::vector< long > &tags )
+{
+	long maxTag = 0;
+	for ( std::size_t i = 0; i < tags.size(); ++i ){
+		if ( tags[i] < 0 ) return this->Fail( "The Gmsh file has a negative node tag." );
+		maxTag = std::max( maxTag, tags[i] );
+	}
+	m_NodeIndex.assign( maxTag + 1, -1 );
+	for ( std::size_t i = 0; i < tags.size(); ++i ){
+		m_NodeIndex[ tags[i] ] = (IdType)i;
+	}
+	return true;
+}
+
+/** Read the elements: find every element and its type, then parse the
+ * nodes of the kept elements in parallel. */
+bool ReadElements()
+{
+	const char *begin = this->FindSection( m_Begin, "Elements" );
+	const char *end = begin ? this->FindLine( begin, "EndElements" ) : 0;
+	if ( !begin || !end ) return this->Fail( "The Gmsh file has no $Elements section." );
+	m_SectionEnd = end;
+	
+	std::vector< ElementRecord > records;
+	TagFormatType format = AsciiTags;
+	bool found;
+	if ( m_Binary ){
+		format = m_Version == 2 ? IntTags : SizeTags;
+		found = m_Version == 2 ? this->FindBinaryElements2( begin, records ) : this->FindBinaryElements4( begin, records );
+	}
+	else{
+		std::vector< const char* > lines;
+		this->FindLineStarts( begin, end, lines );
+		found = m_Version == 2 ? this->FindAsciiElements2( lines, records ) : this->FindAsciiElements4( lines, records );
+	}
+	if ( !found ) return false;
+	
+	// the place of every kept element in the cell array
+	const long nRecords = records.size();
+	std::vector< std::size_t > offsets( nRecords + 1, 0 );
+	std::vector< std::size_t > cellIndex( nRecords, 0 );
+	std::size_t nCells = 0;
+	for ( long i = 0; i < nRecords; ++i ){
+		offsets[i+1] = offsets[i];
+		cellIndex[i] = nCells;
+		if ( GetVTKCellType( records[i].type ) ){
+			offsets[i+1] = offsets[i+1] + GetNumberOfElementNodes( records[i].type ) + 1;
+			++nCells;
+		}
+		else{
+			++m_SkippedElements[ records[i].type ];
+		}
+	}
+	m_Cells.resize( offsets[nRecords] );
+	m_CellTypes.resize( nCells );
+	
+	long nBadNodes = 0;
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static) reduction(+:nBadNodes)
+	for ( long i = 0; i < nRecords; ++i ){
+		int cellType = GetVTKCellType( records[i].type );
+		if ( !cellType ) continue;
+		const unsigned int nNodes = GetNumberOfElementNodes( records[i].type );
+		IdType *cell = &m_Cells[ offsets[i] ];
+		cell[0] = nNodes;
+		const char *q = records[i].nodes;
+		for ( unsigned int n = 0; n < nNodes; ++n ){
+			long tag;
+			if ( format == AsciiTags ) tag = ParseLong( q );
+			else if ( format == IntTags ) tag = ReadBinary< int >( q );
+			else tag = (long)ReadBinary< std::size_t >( q );
+			if ( tag < 0 || tag >= (long)m_NodeIndex.size() || m_NodeIndex[tag] < 0 ){
+				++nBadNodes;
+				tag = 0;
+			}
+			cell[n+1] = m_NodeIndex.empty() ? 0 : m_NodeIndex[tag];
+		}
+		if ( records[i].type == 11 ) std::swap( cell[9], cell[10] ); // the last two mid-edge nodes of gmsh and vtk are switched
+		m_CellTypes[ cellIndex[i] ] = cellType;
+	}
+	if ( nBadNodes > 0 ){
+		std::stringstream msg("");
+		msg << "The Gmsh file has "<<nBadNodes<<" element nodes that are not in the $Nodes section.";
+		return this->Fail( msg.str() );
+	}
+	return true;
+}
+
+bool FindAsciiElements2( const std::vector< const char* > &lines, std::vector< ElementRecord > &records )
+{
+	const char *p = lines[0];
+	long nElements = ParseLong( p );
+	if ( nElements < 0 || (std::size_t)nElements + 1 > lines.size() ) return this->Fail( "The $Elements section of the Gmsh file is too short." );
+	records.resize( nElements );
+	
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+	for ( long i = 0; i < nElements; ++i ){
+		const char *q = lines[i+1];
+		ParseLong( q ); // element tag
+		records[i].type = (int)ParseLong( q );
+		long nTags = ParseLong( q );
+		for ( long t = 0; t < nTags; ++t ){
+			ParseLong( q );
+		}
+		records[i].nodes = q;
+	}
+	return true;
+}
+
+bool FindAsciiElements4( const std::vector< const char* > &lines, std::vector< ElementRecord > &records )
+{
+	const char *p = lines[0];
+	long nBlocks = ParseLong( p );
+	long nElements = ParseLong( p );
+	records.resize( nElements );
+	
+	std::size_t line = 1;
+	long index = 0;
+	for ( long b = 0; b < nBlocks; ++b ){
+		if ( line >= lines.size() ) return this->Fail( "The $Elements section of the Gmsh file is too short." );
+		p = lines[line++];
+		ParseLong( p ); // entity dimension
+		ParseLong( p ); // entity tag
+		int type = (int)ParseLong( p );
+		long n = ParseLong( p );
+		if ( n < 0 || index + n > nElements || line + n > lines.size() ) return this->Fail( "The $Elements section of the Gmsh file is too short." );
+		
+		#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+		for ( long i = 0; i < n; ++i ){
+			const char *q = lines[ line + i ];
+			ParseLong( q ); // element tag
+			records[ index + i ].type = type;
+			records[ index + i ].nodes = q;
+		}
+		line = line + n;
+		index = index + n;
+	}
+	return true;
+}
+
+bool FindBinaryElements2( const char *p, std::vector< ElementRecord > &records )
+{
+	long nElements = ParseLong( p );
+	p = NextLine( p, m_SectionEnd );
+	records.reserve( nElements );
+	while ( (long)records.size() < nElements ){
+		if ( p + 3*sizeof(int) > m_SectionEnd ) return this->Fail( "The $Elements section of the Gmsh file is too short." );
+		int type = ReadBinary< int >( p );
+		int n = ReadBinary< int >( p );
+		int nTags = ReadBinary< int >( p );
+		unsigned int nNodes = GetNumberOfElementNodes( type );
+		if ( nNodes == 0 ){
+			std::stringstream msg("");
+			msg << "The binary Gmsh file has the unknown element type "<<type<<".";
+			return this->Fail( msg.str() );
+		}
+		const std::size_t recordSize = ( 1 + nTags + nNodes )*sizeof(int);
+		if ( n < 0 || p + n*recordSize > m_SectionEnd ) return this->Fail( "The $Elements section of the Gmsh file is too short." );
+		for ( int i = 0; i < n; ++i ){
+			ElementRecord record;
+			record.type = type;
+			record.nodes = p + i*recordSize + ( 1 + nTags )*sizeof(int);
+			records.push_back( record );
+		}
+		p = p + n*recordSize;
+	}
+	return true;
+}
+
+bool FindBinaryElements4( const char *p, std::vector< ElementRecord > &records )
+{
+	if ( p + 4*sizeof(std::size_t) > m_SectionEnd ) return this->Fail( "The $Elements section of the Gmsh file is too short." );
+	std::size_t nBlocks = ReadBinary< std::size_t >( p );
+	std::size_t nElements = ReadBinary< std::size_t >( p );
+	p = p + 2*sizeof(std::size_t); // the minimum and maximum tags
+	records.reserve( nElements );
+	for ( std::size_t b = 0; b < nBlocks; ++b ){
+		if ( p + 3*sizeof(int) + sizeof(std::size_t) > m_SectionEnd ) return this->Fail( "The $Elements section of the Gmsh file is too short." );
+		ReadBinary< int >( p ); // entity dimension
+		ReadBinary< int >( p ); // entity tag
+		int type = ReadBinary< int >( p );
+		std::size_t n = ReadBinary< std::size_t >( p );
+		unsigned int nNodes = GetNumberOfElementNodes( type );
+		if ( nNodes == 0 ){
+			std::stringstream msg("");
+			msg << "The binary Gmsh file has the unknown element type "<<type<<".";
+			return this->Fail( msg.str() );
+		}
+		const std::size_t recordSize = ( 1 + nNodes )*sizeof(std::size_t);
+		if ( p + n*recordSize > m_SectionEnd ) return this->Fail( "The $Elements section of the Gmsh file is too short." );
+		for ( std::size_t i = 0; i < n; ++i ){
+			ElementRecord record;
+			record.type = type;
+			record.nodes = p + i*recordSize + sizeof(std::size_t);
+			records.push_back( record );
+		}
+		p = p + n*recordSize;
+	}
+	return true;
+}
+
+const char					*m_Begin;
+const char					*m_End;
+const char					*m_SectionEnd;
+int							m_Version;
+bool						m_Binary;
+unsigned int				m_NumberOfThreads;
+std::vector< IdType >		m_NodeIndex; // node id of every node tag, -1 if unused
+std::vector< double >		m_Points;
+std::vector< int >			m_CellTypes;
+std::vector< IdType >		m_Cells;
+ElementCountType			m_SkippedElements;
+std::string					m_ErrorMessage;
+
+}; // end class GmshReader
+
+#endif // GMSHREADER_H
@@ -0,0 +1,293 @@
+//      ImageCache.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <utime.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "MetaImageMapper.cxx"
+
+/** A class to keep artifacts derived from the input images, e.g. the 
+ * shrunk images and the transform of the global registration, in a 
+ * cache directory shared by later runs.  An artifact is stored under a
+ * 64 bit key made from the content of its input images, the stage and
+ * the parameters (see Hash and Combine), so a run on the same images 
+ * with the same parameters finds it whatever the file names.  Images 
+ * are stored as uncompressed MetaImages and mapped back, see 
+ * MetaImageMapper.  The files are written under a temporary name and
+ * renamed, so runs sharing the directory never see part of a file.  
+ * Using an artifact marks it as recent, and the least recently used 
+ * artifacts are deleted when the directory grows over its size limit. */
+class ImageCache
+{
+public:
+
+typedef unsigned long long		KeyType;
+
+/** Constructor **/
+ImageCache()
+{
+	m_SizeLimit = 0;
+}
+
+/** Destructor **/
+~ImageCache() {}
+
+/** Set the cache directory, which is made if it does not exist, empty
+ * to turn the cache off. */
+void SetDirectory( const std::string &directory )
+{
+	m_Directory = directory;
+	if ( !m_Directory.empty() ) mkdir( m_Directory.c_str(), 0777 );
+}
+
+/** Set the size of the cache directory in bytes above which the least
+ * recently used artifacts are deleted. */
+void SetSizeLimit( double bytes )
+{
+	m_SizeLimit = bytes;
+}
+
+/** Get whether a cache directory is set. */
+bool IsEnabled() const
+{
+	return !m_Directory.empty();
+}
+
+/** Mix a value into a key (64 bit FNV-1a over its bytes). */
+template< typename TValue >
+static KeyType Combine( KeyType key, const TValue &value )
+{
+	return HashBytes( &value, sizeof(TValue), key );
+}
+
+/** Mix a string into a key. */
+static KeyType Combine( KeyType key, const std::string &value )
+{
+	return HashBytes( value.data(), value.size(), Combine( key, value.size() ) );
+}
+
+/** Hash the pixels and the geometry of an image.  The buffer is hashed
+ * in blocks in parallel and the block hashes are combined in order. */
+template< typename TImage >
+static KeyType Hash( const TImage *image, unsigned int nThreads )
+{
+	const char *pixels = reinterpret_cast< const char* >( image->GetBufferPointer() );
+	const std::size_t nBytes = image->GetBufferedRegion().GetNumberOfPixels()*sizeof(typename TImage::PixelType);
+	const std::size_t blockSize = 1 << 20;
+	const long nBlocks = ( nBytes + blockSize - 1 )/blockSize;
+	std::vector< KeyType > blockKeys( nBlocks );
+	#pragma omp parallel for num_threads(nThreads > 0 ? nThreads : 1) schedule(static)
+	for ( long i = 0; i < nBlocks; ++i ){
+		blockKeys[i] = HashBytes( pixels + i*blockSize, std::min( blockSize, nBytes - i*blockSize ), BasisKey() );
+	}
+	KeyType key = HashBytes( blockKeys.empty() ? 0 : &blockKeys[0], blockKeys.size()*sizeof(KeyType), BasisKey() );
+	for ( unsigned int d = 0; d < TImage::ImageDimension; ++d ){
+		key = Combine( key, (long)image->GetBufferedRegion().GetIndex()[d] );
+		key = Combine( key, (unsigned long)image->GetBufferedRegion().GetSize()[d] );
+		key = Combine( key, (double)image->GetSpacing()[d] );
+		key = Combine( key, (double)image->GetOrigin()[d] );
+		for ( unsigned int e = 0; e < TImage::ImageDimension; ++e ) key = Combine( key, (double)image->GetDirection()[d][e] );
+	}
+	return key;
+}
+
+/** Map the image stored under the key.  The mapper holds the image and
+ * must outlive it.  Returns false if the cache holds no such image. */
+template< typename TImage >
+bool LoadImage( KeyType key, MetaImageMapper< TImage > &mapper )
+{
+	std::string fileName = this->GetFileName( key, "mha" );
+	if ( !this->IsEnabled() || !mapper.Map( fileName, false ) ) return false;
+	Touch( fileName );
+	return true;
+}
+
+/** Store an image under the key.  Returns false if it cannot be 
+ * written. */
+template< typename TImage >
+bool StoreImage( KeyType key, const TImage *image )
+{
+	if ( !this->IsEnabled() ) return false;
+	
+	// the header is padded so the pixels start on an 8 byte boundary for mapping
+	std::stringstream header("");
+	header << std::setprecision( 17 );
+	header << "NDims = 3\nBinaryData = True\nBinaryDataByteOrderMSB = "<<( IsLittleEndian() ? "False" : "True" )<<"\nCompressedData = False\n";
+	header << "TransformMatrix =";
+	for ( unsigned int i = 0; i < 3; ++i ){
+		for ( unsigned int j = 0; j < 3; ++j ) header << " "<<image->GetDirection()[j][i];
+	}
+	header << "\nOffset = "<<image->GetOrigin()[0]<<" "<<image->GetOrigin()[1]<<" "<<image->GetOrigin()[2]<<"\n";
+	header << "ElementSpacing = "<<image->GetSpacing()[0]<<" "<<image->GetSpacing()[1]<<" "<<image->GetSpacing()[2]<<"\n";
+	typename TImage::SizeType size = image->GetBufferedRegion().GetSize();
+	header << "DimSize = "<<size[0]<<" "<<size[1]<<" "<<size[2]<<"\n";
+	header << "ElementType = "<<MetaImageMapper< TImage >::GetElementTypeName()<<"\n";
+	std::string objectType = "ObjectType = Image";
+	std::size_t headerSize = objectType.size() + 1 + header.str().size() + std::string( "ElementDataFile = LOCAL\n" ).size();
+	objectType.append( ( 8 - headerSize%8 )%8, ' ' );
+	
+	std::string fileName = this->GetFileName( key, "mha" );
+	std::string temporaryName = this->GetTemporaryName( fileName );
+	std::ofstream output( temporaryName.c_str(), std::ios::out | std::ios::binary );
+	output << objectType << "\n" << header.str() << "ElementDataFile = LOCAL\n";
+	output.write( reinterpret_cast< const char* >( image->GetBufferPointer() ), 
+		image->GetBufferedRegion().GetNumberOfPixels()*sizeof(typename TImage::PixelType) );
+	output.close();
+	return this->Commit( temporaryName, fileName, !output.fail() );
+}
+
+/** Read the values stored under the key.  Returns false if the cache 
+ * holds no such values. */
+bool LoadValues( KeyType key, std::vector< double > &values )
+{
+	std::string fileName = this->GetFileName( key, "txt" );
+	std::ifstream input( fileName.c_str() );
+	if ( !this->IsEnabled() || !input ) return false;
+	values.clear();
+	double value;
+	while ( input >> value ) values.push_back( value );
+	Touch( fileName );
+	return true;
+}
+
+/** Store values, e.g. transform parameters, under the key.  Returns 
+ * false if they cannot be written. */
+bool StoreValues( KeyType key, const std::vector< double > &values )
+{
+	if ( !this->IsEnabled() ) return false;
+	std::string fileName = this->GetFileName( key, "txt" );
+	std::string temporaryName = this->GetTemporaryName( fileName );
+	std::ofstream output( temporaryName.c_str() );
+	output << std::setprecision( 17 );
+	for ( std::size_t i = 0; i < values.size(); ++i ) output << values[i] << "\n";
+	output.close();
+	return this->Commit( temporaryName, fileName, !output.fail() );
+}
+
+/** Get the first key to combine values into. */
+static KeyType BasisKey()
+{
+	return 14695981039346656037ULL;
+}
+
+private:
+
+static KeyType HashBytes( const void *data, std::size_t nBytes, KeyType key )
+{
+	const unsigned char *bytes = static_cast< const unsigned char* >( data );
+	for ( std::size_t i = 0; i < nBytes; ++i ){
+		key = ( key ^ bytes[i] )*1099511628211ULL;
+	}
+	return key;
+}
+
+static bool IsLittleEndian()
+{
+	const unsigned short one = 1;
+	return *reinterpret_cast< const unsigned char* >( &one ) == 1;
+}
+
+// mark a file as used now
+static void Touch( const std::string &fileName )
+{
+	utime( fileName.c_str(), 0 );
+}
+
+std::string GetFileName( KeyType key, const std::string &extension ) const
+{
+	std::stringstream fileName("");
+	fileName << m_Directory << "/dvc-" << std::hex << std::setw( 16 ) << std::setfill( '0' ) << key << "." << extension;
+	return fileName.str();
+}
+
+// a name no other process or thread writes to
+static std::string GetTemporaryName( const std::string &fileName )
+{
+	static unsigned long count = 0;
+	unsigned long number;
+	#pragma omp critical(imagecache)
+	number = ++count;
+	std::stringstream temporaryName("");
+	temporaryName << fileName << ".tmp" << getpid() << "-" << number;
+	return temporaryName.str();
+}
+
+/** Rename a written file to its name, or delete it if writing failed,
+ * then evict the least recently used artifacts.  The threads of the
+ * process commit one at a time. */
+bool Commit( const std::string &temporaryName, const std::string &fileName, bool written )
+{
+	bool committed = false;
+	#pragma omp critical(imagecache)
+	{
+		if ( !written || std::rename( temporaryName.c_str(), fileName.c_str() ) ){
+			std::remove( temporaryName.c_str() );
+		}
+		else{
+			this->Evict( fileName );
+			committed = true;
+		}
+	}
+	return committed;
+}
+
+/** Delete the least recently used artifacts, except the one just 
+ * stored, until the artifacts fit in the size limit. */
+void Evict( const std::string &keep )
+{
+	DIR *directory = opendir( m_Directory.c_str() );
+	if ( !directory ) return;
+	std::vector< std::pair< time_t, std::pair< std::string, double > > > artifacts;
+	double totalSize = 0;
+	for ( dirent *entry = readdir( directory ); entry; entry = readdir( directory ) ){
+		std::string name = entry->d_name;
+		if ( name.compare( 0, 4, "dvc-" ) || name.find( ".tmp" ) != std::string::npos ) continue;
+		struct stat status;
+		std::string fileName = m_Directory + "/" + name;
+		if ( stat( fileName.c_str(), &status ) || !S_ISREG( status.st_mode ) ) continue;
+		totalSize = totalSize + status.st_size;
+		if ( fileName != keep ) artifacts.push_back( std::make_pair( status.st_mtime, std::make_pair( fileName, (double)status.st_size ) ) );
+	}
+	closedir( directory );
+	
+	std::sort( artifacts.begin(), artifacts.end() );
+	for ( std::size_t i = 0; i < artifacts.size() && totalSize > m_SizeLimit; ++i ){
+		if ( !std::remove( artifacts[i].second.first.c_str() ) ) totalSize = totalSize - artifacts[i].second.second;
+	}
+}
+
+std::string				m_Directory;
+double					m_SizeLimit;
+
+}; // end class ImageCache
+
+#endif // IMAGECACHE_H
@@ -0,0 +1,155 @@
+//      MappedFile.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** A class to map a file into memory read only, or copy on write so 
+ * the contents can be handed to code that wants a writable buffer 
+ * while the pages stay shared with the page cache until written.  If 
+ * the file cannot be mapped it is read into a buffer instead, so the 
+ * contents are always available through GetData() until the object is
+ * destroyed. */
+class MappedFile
+{
+public:
+
+/** Constructor **/
+MappedFile()
+{
+	m_Data = 0;
+	m_Size = 0;
+	m_Mapped = false;
+	m_Writable = false;
+}
+
+/** Destructor **/
+~MappedFile()
+{
+	this->Close();
+}
+
+/** Map the file, to be read from start to end or, if sequential is 
+ * false, in random order.  Returns false if the file cannot be read. */
+bool Open( const std::string &fileName, bool sequential = true, bool copyOnWrite = false )
+{
+	this->Close();
+	
+	int fileDescriptor = open( fileName.c_str(), O_RDONLY );
+	if ( fileDescriptor >= 0 ){
+		struct stat fileStatus;
+		if ( fstat( fileDescriptor, &fileStatus ) == 0 && fileStatus.st_size > 0 ){
+			void *data = mmap( 0, fileStatus.st_size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fileDescriptor, 0 );
+			if ( data != MAP_FAILED ){
+				madvise( data, fileStatus.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM );
+				m_Data = static_cast< const char* >( data );
+				m_Size = fileStatus.st_size;
+				m_Mapped = true;
+				m_Writable = copyOnWrite;
+			}
+		}
+		close( fileDescriptor );
+		if ( m_Mapped ) return true;
+	}
+	
+	// fall back to reading the whole file
+	std::ifstream input( fileName.c_str(), std::ios::in | std::ios::binary );
+	if ( !input ) return false;
+	input.seekg( 0, std::ios::end );
+	m_Buffer.resize( (std::size_t)input.tellg() );
+	input.seekg( 0, std::ios::beg );
+	if ( !m_Buffer.empty() ) input.read( &m_Buffer[0], m_Buffer.size() );
+	if ( !input ) return false;
+	m_Data = m_Buffer.empty() ? 0 : &m_Buffer[0];
+	m_Size = m_Buffer.size();
+	m_Writable = true;
+	return true;
+}
+
+/** Unmap the file. */
+void Close()
+{
+	if ( m_Mapped ) munmap( const_cast< char* >( m_Data ), m_Size );
+	m_Buffer.clear();
+	m_Data = 0;
+	m_Size = 0;
+	m_Mapped = false;
+	m_Writable = false;
+}
+
+/** Start reading part of the mapped file in the background. */
+void WillNeed( std::size_t offset, std::size_t size )
+{
+	if ( !m_Mapped || offset >= m_Size ) return;
+	std::size_t start = offset - offset%sysconf( _SC_PAGESIZE );
+	madvise( const_cast< char* >( m_Data ) + start, std::min( m_Size, offset + size ) - start, MADV_WILLNEED );
+}
+
+/** Ask for transparent huge pages for the mapping, where the kernel 
+ * supports them for the file. */
+void UseHugePages()
+{
+#ifdef MADV_HUGEPAGE
+	if ( m_Mapped ) madvise( const_cast< char* >( m_Data ), m_Size, MADV_HUGEPAGE );
+#endif
+}
+
+/** Get the first byte of the file. */
+const char *GetData() const
+{
+	return m_Data;
+}
+
+/** Get the first byte of a file opened copy on write, or 0 if it is
+ * mapped read only. */
+char *GetWritableData()
+{
+	return m_Writable ? const_cast< char* >( m_Data ) : 0;
+}
+
+/** Get the number of bytes in the file. */
+std::size_t GetSize() const
+{
+	return m_Size;
+}
+
+private:
+
+MappedFile( const MappedFile& ); // not copyable
+MappedFile &operator=( const MappedFile& );
+
+const char			*m_Data;
+std::size_t			m_Size;
+bool				m_Mapped;
+bool				m_Writable;
+std::vector< char >	m_Buffer;
+
+}; // end class MappedFile
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,248 @@
+//      MeshFieldStore.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef MESHFIELDSTORE_H
+#define MESHFIELDSTORE_H
+
+#include <vector>
+#include <cstring>
+
+// The precision of the strain fields. Single precision halves the memory
+// and bandwidth of the strain post-processing.
+#ifdef DVC_SINGLE_PRECISION_STRAIN
+typedef float	StrainValueType;
+#else
+typedef double	StrainValueType;
+#endif
+
+/** A class to hold one field of values (eg. the displacement) defined
+ * at every node or cell of a mesh. The values are stored contiguously
+ * with nComponents values of type TValue per tuple.  The field is 
+ * double buffered: the filters read the current values through 
+ * GetPointer() and write the new values through GetWritePointer(), 
+ * then Swap() makes the new values current.  The write buffer is only allocated when first used. */
+template< typename TValue >
+class MeshFieldBuffer
+{
+public:
+
+typedef unsigned long	TupleIdType;
+typedef TValue			ValueType;
+
+/** Constructor **/
+MeshFieldBuffer()
+{
+	m_NumberOfTuples = 0;
+	m_NumberOfComponents = 0;
+	m_Current = 0;
+}
+
+/** Destructor **/
+~MeshFieldBuffer() {}
+
+/** Allocate the field and set every value to 0. */
+void Allocate( TupleIdType nTuples, unsigned int nComponents )
+{
+	m_NumberOfTuples = nTuples;
+	m_NumberOfComponents = nComponents;
+	m_Current = 0;
+	m_Buffers[0].assign( nTuples*nComponents, 0 );
+	m_Buffers[1].clear();
+}
+
+/** Release the memory held by the field. */
+void Release()
+{
+	m_NumberOfTuples = 0;
+	m_NumberOfComponents = 0;
+	m_Current = 0;
+	std::vector< TValue >().swap( m_Buffers[0] );
+	std::vector< TValue >().swap( m_Buffers[1] );
+}
+
+/** Returns true if the field holds values. */
+bool IsAllocated() const
+{
+	return m_NumberOfComponents > 0;
+}
+
+/** Get the number of tuples. */
+TupleIdType GetNumberOfTuples() const
+{
+	return m_NumberOfTuples;
+}
+
+/** Get the number of components in each tuple. */
+unsigned int GetNumberOfComponents() const
+{
+	return m_NumberOfComponents;
+}
+
+/** Get a pointer to the current values. */
+TValue *GetPointer()
+{
+	return m_Buffers[m_Current].empty() ? 0 : &m_Buffers[m_Current][0];
+}
+
+/** Get a pointer to the write buffer.  The contents of the write
+ * buffer are undefined until written. */
+TValue *GetWritePointer()
+{
+	std::vector< TValue > &buffer = m_Buffers[1-m_Current];
+	if ( buffer.size() != m_Buffers[m_Current].size() ){
+		buffer.resize( m_Buffers[m_Current].size() );
+	}
+	return buffer.empty() ? 0 : &buffer[0];
+}
+
+/** Make the write buffer the current values. */
+void Swap()
+{
+	this->GetWritePointer();
+	m_Current = 1 - m_Current;
+}
+
+/** Copy the tuple i from the write buffer into the current values. Used
+ * when only some tuples of the write buffer have been filled. */
+void CommitTuple( TupleIdType i )
+{
+	std::memcpy( &m_Buffers[m_Current][i*m_NumberOfComponents], &m_Buffers[1-m_Current][i*m_NumberOfComponents], m_NumberOfComponents*sizeof(TValue) );
+}
+
+/** Get a pointer to the current value of tuple i. */
+TValue *GetTuplePointer( TupleIdType i )
+{
+	return &m_Buffers[m_Current][i*m_NumberOfComponents];
+}
+
+/** Copy the current value of tuple i into tuple. */
+void GetTuple( TupleIdType i, TValue *tuple ) const
+{
+	std::memcpy( tuple, &m_Buffers[m_Current][i*m_NumberOfComponents], m_NumberOfComponents*sizeof(TValue) );
+}
+
+/** Set the current value of tuple i. */
+void SetTuple( TupleIdType i, const TValue *tuple )
+{
+	std::memcpy( &m_Buffers[m_Current][i*m_NumberOfComponents], tuple, m_NumberOfComponents*sizeof(TValue) );
+}
+
+/** Set every tuple of the field to tuple. */
+void Fill( const TValue *tuple )
+{
+	for ( TupleIdType i = 0; i < m_NumberOfTuples; ++i ){
+		this->SetTuple( i, tuple );
+	}
+}
+
+private:
+
+TupleIdType				m_NumberOfTuples;
+unsigned int			m_NumberOfComponents;
+unsigned int			m_Current;
+std::vector< TValue >	m_Buffers[2];
+
+}; // end class MeshFieldBuffer
+
+typedef MeshFieldBuffer< double >			MeshField;
+typedef MeshFieldBuffer< StrainValueType >	MeshStrainField;
+
+
+/** A class to hold the fields calculated on a mesh, independent of the
+ * vtkUnstructuredGrid that holds the geometry.  Keeping the fields 
+ * apart lets the filters read and write the values directly without
+ * copying the mesh.  The fields are copied into the grid only when the
+ * mesh is written. */
+class MeshFieldStore
+{
+public:
+
+/** Constructor **/
+MeshFieldStore()
+{
+	m_NumberOfPoints = 0;
+	m_NumberOfCells = 0;
+}
+
+/** Destructor **/
+~MeshFieldStore() {}
+
+/** Set the size of the mesh. The displacement and optimizer value
+ * fields are allocated and set to 0, the strain fields are released 
+ * until they are calculated.  The strains are symmetric tensors stored
+ * as 6 values per tuple in the order xx, yy, zz, xy, yz, xz. */
+void Initialize( MeshField::TupleIdType nPoints, MeshField::TupleIdType nCells )
+{
+	m_NumberOfPoints = nPoints;
+	m_NumberOfCells = nCells;
+	m_Displacement.Allocate( nPoints, 3 );
+	m_OptimizerValue.Allocate( nPoints, 1 );
+	m_Strain.Release();
+	m_CellStrain.Release();
+}
+
+/** Get the number of points. */
+MeshField::TupleIdType GetNumberOfPoints() const
+{
+	return m_NumberOfPoints;
+}
+
+/** Get the number of cells. */
+MeshField::TupleIdType GetNumberOfCells() const
+{
+	return m_NumberOfCells;
+}
+
+/** Get the point displacement field. */
+MeshField &GetDisplacement()
+{
+	return m_Displacement;
+}
+
+/** Get the point optimizer value field. */
+MeshField &GetOptimizerValue()
+{
+	return m_OptimizerValue;
+}
+
+/** Get the point strain field. */
+MeshStrainField &GetStrain()
+{
+	return m_Strain;
+}
+
+/** Get the cell strain field. */
+MeshStrainField &GetCellStrain()
+{
+	return m_CellStrain;
+}
+
+private:
+
+MeshField::TupleIdType	m_NumberOfPoints;
+MeshField::TupleIdType	m_NumberOfCells;
+MeshField				m_Displacement;
+MeshField				m_OptimizerValue;
+MeshStrainField			m_Strain;
+MeshStrainField			m_CellStrain;
+
+}; // end class MeshFieldStore
+
+#endif // MESHFIELDSTORE_H
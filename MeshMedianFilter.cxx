@@ -0,0 +1,136 @@
+//      MeshMedianFilter.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef MESHMEDIANFILTER_H
+#define MESHMEDIANFILTER_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "MeshNeighbourhood.cxx"
+
+/** A class to apply a median filter to a field defined at the nodes of
+ * a mesh.  The median at a node is taken over the node and its
+ * connected neighbours.  Two modes are available:
+ * ComponentMedian - each component is replaced by the median of that
+ *   component over the neighbourhood.
+ * MagnitudeMedian - the value is replaced by the value of the node in
+ *   the neighbourhood that has the median magnitude, so the result is 
+ *   always one of the measured values.  Six component values are taken
+ *   as Voigt strains and their magnitude is the tensor norm.
+ * The medians are found by selection (std::nth_element) instead of
+ * sorting, and each thread uses scratch space allocated once for the
+ * largest neighbourhood. */
+class MeshMedianFilter
+{
+public:
+
+typedef MeshNeighbourhood::NodeIdType	NodeIdType;
+
+enum MedianModeType { ComponentMedian = 1, MagnitudeMedian = 2 };
+
+/** Constructor **/
+MeshMedianFilter()
+{
+	m_Mode = ComponentMedian;
+	m_NumberOfThreads = 1;
+}
+
+/** Destructor **/
+~MeshMedianFilter() {}
+
+/** Set the median mode. */
+void SetMode( MedianModeType mode )
+{
+	m_Mode = mode;
+}
+
+/** Get the median mode. */
+MedianModeType GetMode() const
+{
+	return m_Mode;
+}
+
+/** Set the number of threads. */
+void SetNumberOfThreads( unsigned int nThreads )
+{
+	m_NumberOfThreads = nThreads > 0 ? nThreads : 1;
+}
+
+/** Apply the filter to a field with nComponents values per node.
+ * input and output must not overlap. */
+template< typename TValue >
+void Apply( const MeshNeighbourhood &neighbourhood, const TValue *input, TValue *output, unsigned int nComponents ) const
+{
+	long nNodes = (long)neighbourhood.GetNumberOfNodes();
+	NodeIdType scratchSize = neighbourhood.GetMaximumNumberOfNeighbours() + 1;
+	
+	#pragma omp parallel num_threads(m_NumberOfThreads)
+	{
+		// scratch space for this thread
+		std::vector< double > values( scratchSize );
+		std::vector< std::pair< double, NodeIdType > > magnitudes( scratchSize );
+		
+		#pragma omp for schedule(static)
+		for ( long i = 0; i < nNodes; ++i ){
+			const NodeIdType *neighbours = neighbourhood.GetNeighbours( i );
+			NodeIdType nValues = neighbourhood.GetNumberOfNeighbours( i ) + 1;
+			NodeIdType middle = nValues/2;
+			
+			if ( m_Mode == MagnitudeMedian ){
+				for ( NodeIdType j = 0; j < nValues; ++j ){
+					NodeIdType cId = j == nValues-1 ? (NodeIdType)i : neighbours[j]; // include the point itself at the very end
+					const TValue *value = input + nComponents*cId;
+					double squaredMagnitude = 0;
+					for ( unsigned int c = 0; c < nComponents; ++c ){
+						double weight = nComponents == 6 && c > 2 ? 2 : 1; // the shear terms of strains appear twice in the tensor
+						squaredMagnitude = squaredMagnitude + weight*value[c]*value[c];
+					}
+					magnitudes[j] = std::make_pair( squaredMagnitude, cId );
+				}
+				std::nth_element( magnitudes.begin(), magnitudes.begin() + middle, magnitudes.begin() + nValues );
+				std::copy( input + nComponents*magnitudes[middle].second, input + nComponents*( magnitudes[middle].second + 1 ), output + nComponents*i );
+				continue;
+			}
+			
+			for ( unsigned int c = 0; c < nComponents; ++c ){
+				for ( NodeIdType j = 0; j < nValues; ++j ){
+					NodeIdType cId = j == nValues-1 ? (NodeIdType)i : neighbours[j];
+					values[j] = input[ nComponents*cId + c ];
+				}
+				std::nth_element( values.begin(), values.begin() + middle, values.begin() + nValues );
+				double median = values[middle];
+				if ( nValues % 2 == 0 ){ // average the two middle values, the lower one is the largest of the lower half
+					median = 0.5*( median + *std::max_element( values.begin(), values.begin() + middle ) );
+				}
+				output[ nComponents*i + c ] = (TValue)median;
+			}
+		}
+	}
+}
+
+private:
+
+MedianModeType	m_Mode;
+unsigned int	m_NumberOfThreads;
+
+}; // end class MeshMedianFilter
+
+#endif // MESHMEDIANFILTER_H
@@ -0,0 +1,156 @@
+//      MeshNeighbourhood.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef MESHNEIGHBOURHOOD_H
+#define MESHNEIGHBOURHOOD_H
+
+#include <vector>
+#include <algorithm>
+
+/** A class to hold the connected neighbours of every node of a mesh in
+ * compressed sparse row form. The neighbours of node i are stored in
+ * m_Neighbours[ m_Offsets[i] ] to m_Neighbours[ m_Offsets[i+1]-1 ] in
+ * ascending order. A node is never listed as its own neighbour. The
+ * neighbourhood only depends on the mesh topology so it is built once
+ * and reused by every filter. */
+class MeshNeighbourhood
+{
+public:
+
+typedef unsigned int					NodeIdType;
+typedef unsigned long					OffsetType;
+typedef std::pair< NodeIdType, NodeIdType >	NodePairType;
+typedef std::vector< NodePairType >		NodePairListType;
+
+/** Constructor **/
+MeshNeighbourhood()
+{
+	m_Offsets.assign( 1, 0 );
+	m_MaximumNumberOfNeighbours = 0;
+}
+
+/** Destructor **/
+~MeshNeighbourhood() {}
+
+/** Build the neighbourhood from a list of connected node pairs (eg.
+ * the edges of the mesh cells). The pairs are undirected and may be
+ * repeated. nNodes is the number of nodes in the mesh. */
+void Build( NodeIdType nNodes, const NodePairListType &pairs )
+{
+	// count the number of entries for each node
+	std::vector< OffsetType > counts( nNodes + 1, 0 );
+	for ( OffsetType i = 0; i < pairs.size(); ++i ){
+		if ( pairs[i].first == pairs[i].second ) continue;
+		++counts[ pairs[i].first + 1 ];
+		++counts[ pairs[i].second + 1 ];
+	}
+	for ( NodeIdType i = 0; i < nNodes; ++i ){
+		counts[i+1] += counts[i];
+	}
+	
+	// scatter both directions of every pair into the rows
+	std::vector< NodeIdType > entries( counts[nNodes] );
+	std::vector< OffsetType > fill( counts.begin(), counts.end()-1 );
+	for ( OffsetType i = 0; i < pairs.size(); ++i ){
+		if ( pairs[i].first == pairs[i].second ) continue;
+		entries[ fill[ pairs[i].first ]++ ] = pairs[i].second;
+		entries[ fill[ pairs[i].second ]++ ] = pairs[i].first;
+	}
+	
+	// sort each row and remove the repeated entries
+	m_Offsets.assign( nNodes + 1, 0 );
+	m_Neighbours.clear();
+	m_Neighbours.reserve( entries.size() );
+	m_MaximumNumberOfNeighbours = 0;
+	for ( NodeIdType i = 0; i < nNodes; ++i ){
+		std::vector< NodeIdType >::iterator rowStart = entries.begin() + counts[i];
+		std::vector< NodeIdType >::iterator rowEnd = entries.begin() + counts[i+1];
+		std::sort( rowStart, rowEnd );
+		rowEnd = std::unique( rowStart, rowEnd );
+		m_Neighbours.insert( m_Neighbours.end(), rowStart, rowEnd );
+		m_Offsets[i+1] = m_Neighbours.size();
+		
+		NodeIdType nNeighbours = (NodeIdType)(rowEnd - rowStart);
+		if ( nNeighbours > m_MaximumNumberOfNeighbours ){
+			m_MaximumNumberOfNeighbours = nNeighbours;
+		}
+	}
+}
+
+/** Empty the neighbourhood. */
+void Clear()
+{
+	m_Offsets.assign( 1, 0 );
+	m_Neighbours.clear();
+	m_MaximumNumberOfNeighbours = 0;
+}
+
+/** Returns true if the neighbourhood has not been built. */
+bool IsEmpty() const
+{
+	return m_Offsets.size() < 2;
+}
+
+/** Get the number of nodes the neighbourhood was built for. */
+NodeIdType GetNumberOfNodes() const
+{
+	return (NodeIdType)( m_Offsets.size() - 1 );
+}
+
+/** Get the number of neighbours of node i. */
+NodeIdType GetNumberOfNeighbours( NodeIdType i ) const
+{
+	return (NodeIdType)( m_Offsets[i+1] - m_Offsets[i] );
+}
+
+/** Get a pointer to the first neighbour of node i. */
+const NodeIdType* GetNeighbours( NodeIdType i ) const
+{
+	return m_Neighbours.empty() ? 0 : &m_Neighbours[ m_Offsets[i] ];
+}
+
+/** Get the largest number of neighbours of any node.  This is used to
+ * size scratch space. */
+NodeIdType GetMaximumNumberOfNeighbours() const
+{
+	return m_MaximumNumberOfNeighbours;
+}
+
+/** Get the row offsets. */
+const std::vector< OffsetType >& GetOffsets() const
+{
+	return m_Offsets;
+}
+
+/** Get the neighbour entries. */
+const std::vector< NodeIdType >& GetNeighbourList() const
+{
+	return m_Neighbours;
+}
+
+private:
+
+std::vector< OffsetType >	m_Offsets;
+std::vector< NodeIdType >	m_Neighbours;
+NodeIdType					m_MaximumNumberOfNeighbours;
+
+}; // end class MeshNeighbourhood
+
+#endif // MESHNEIGHBOURHOOD_H
@@ -0,0 +1,139 @@
+//      MeshOutlierDetector.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef MESHOUTLIERDETECTOR_H
+#define MESHOUTLIERDETECTOR_H
+
+#include <cmath>
+#include "MeshNeighbourhood.cxx"
+#include "NodeBitmap.cxx"
+
+/** A class to find the nodes of a mesh whose value is an outlier 
+ * compared to their connected neighbours.  A node is an outlier if any
+ * component of its value is farther than tolerance standard deviations
+ * from the average of that component over the neighbours (the node 
+ * itself is not part of the average).  The average and standard
+ * deviation are calculated in a single pass (Welford's method) directly
+ * on the contiguous field values, and the nodes are visited in 
+ * parallel. */
+class MeshOutlierDetector
+{
+public:
+
+typedef MeshNeighbourhood::NodeIdType	NodeIdType;
+
+static const unsigned int	MaximumNumberOfComponents = 9;
+
+/** Constructor **/
+MeshOutlierDetector()
+{
+	m_Tolerance = 2;
+	m_NumberOfThreads = 1;
+}
+
+/** Destructor **/
+~MeshOutlierDetector() {}
+
+/** Set the tolerance in standard deviations from the neighbourhood mean. */
+void SetTolerance( double tolerance )
+{
+	m_Tolerance = tolerance;
+}
+
+/** Get the tolerance in standard deviations from the neighbourhood mean. */
+double GetTolerance() const
+{
+	return m_Tolerance;
+}
+
+/** Set the number of threads. */
+void SetNumberOfThreads( unsigned int nThreads )
+{
+	m_NumberOfThreads = nThreads > 0 ? nThreads : 1;
+}
+
+/** Find the outliers of a field with nComponents values per node. The
+ * outliers are returned in flags, which is resized to the number of
+ * nodes in the neighbourhood.  If nodesToTest is given, only the nodes
+ * in that set are tested and every other node is left unflagged. */
+template< typename TValue >
+void FindOutliers( const MeshNeighbourhood &neighbourhood, const TValue *field, unsigned int nComponents, NodeBitmap &flags, const NodeBitmap *nodesToTest = 0 ) const
+{
+	NodeIdType nNodes = neighbourhood.GetNumberOfNodes();
+	flags.SetNumberOfNodes( nNodes );
+	long nWords = (long)flags.GetNumberOfWords();
+	
+	// each thread fills whole words of the bitmap so no locking is needed
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(dynamic,64)
+	for ( long w = 0; w < nWords; ++w ){
+		NodeBitmap::WordType word = 0;
+		NodeBitmap::WordType testWord = nodesToTest ? nodesToTest->GetWord( w ) : ~(NodeBitmap::WordType)0;
+		for ( unsigned int b = 0; b < NodeBitmap::BitsPerWord && testWord; ++b, testWord >>= 1 ){
+			NodeIdType i = (NodeIdType)w*NodeBitmap::BitsPerWord + b;
+			if ( i >= nNodes ) break;
+			if ( !( testWord & 1 ) ) continue;
+			if ( this->IsOutlier( neighbourhood, field, nComponents, i ) ){
+				word |= (NodeBitmap::WordType)1 << b;
+			}
+		}
+		flags.SetWord( w, word );
+	}
+}
+
+/** Returns true if the value at node i is an outlier. */
+template< typename TValue >
+bool IsOutlier( const MeshNeighbourhood &neighbourhood, const TValue *field, unsigned int nComponents, NodeIdType i ) const
+{
+	const NodeIdType *neighbours = neighbourhood.GetNeighbours( i );
+	NodeIdType nNeighbours = neighbourhood.GetNumberOfNeighbours( i );
+	if ( nNeighbours == 0 ) return false; // nothing to compare with
+	
+	// running mean and sum of squared differences from the mean
+	double average[MaximumNumberOfComponents] = { 0 };
+	double sumOfSquares[MaximumNumberOfComponents] = { 0 };
+	for ( NodeIdType j = 0; j < nNeighbours; ++j ){
+		const TValue *cValue = field + nComponents*neighbours[j];
+		double count = j + 1;
+		for ( unsigned int c = 0; c < nComponents; ++c ){
+			double difference = cValue[c] - average[c];
+			average[c] = average[c] + difference/count;
+			sumOfSquares[c] = sumOfSquares[c] + difference*( cValue[c] - average[c] );
+		}
+	}
+	
+	// the value is invalid if any component is out of bounds
+	const TValue *value = field + nComponents*i;
+	for ( unsigned int c = 0; c < nComponents; ++c ){
+		double stDev = std::sqrt( sumOfSquares[c]/nNeighbours );
+		if ( std::fabs( value[c] - average[c] ) > m_Tolerance*stDev ){
+			return true;
+		}
+	}
+	return false;
+}
+
+private:
+
+double			m_Tolerance;
+unsigned int	m_NumberOfThreads;
+
+}; // end class MeshOutlierDetector
+
+#endif // MESHOUTLIERDETECTOR_H
@@ -0,0 +1,216 @@
+//      MeshRefiner.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef MESHREFINER_H
+#define MESHREFINER_H
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <utility>
+
+/** A class to refine a linear tetrahedral mesh by edge bisection.  An
+ * edge is bisected at its midpoint and every tet that uses the edge is
+ * split in two at the same time, so the refined mesh stays conforming.
+ * A refined tet is split through its longest edge.  The nodes of the
+ * original mesh keep their ids and the new nodes are numbered after
+ * them.  The two end nodes of the edge each new node bisects are kept
+ * so values can be interpolated onto the new nodes. */
+class MeshRefiner
+{
+public:
+
+typedef unsigned int						NodeIdType;
+typedef std::pair< NodeIdType, NodeIdType >	EdgeType;
+
+/** Constructor **/
+MeshRefiner() {}
+
+/** Destructor **/
+~MeshRefiner() {}
+
+/** Set the mesh to refine.  points holds 3 coordinates per node and
+ * tets holds 4 node ids per tet. */
+void Initialize( NodeIdType nPoints, const double *points, const std::vector< NodeIdType > &tets )
+{
+	m_Points.assign( points, points + 3*nPoints );
+	m_Tets = tets;
+	m_NumberOfOriginalPoints = nPoints;
+	m_Parents.clear();
+	m_EdgeTets.clear();
+	NodeIdType nTets = m_Tets.size()/4;
+	for ( NodeIdType t = 0; t < nTets; ++t ){
+		for ( unsigned int a = 0; a < 4; ++a ){
+			for ( unsigned int b = a+1; b < 4; ++b ){
+				m_EdgeTets[ MakeEdge( m_Tets[4*t+a], m_Tets[4*t+b] ) ].push_back( t );
+			}
+		}
+	}
+}
+
+/** Split every listed tet once through its longest edge, in the order
+ * given, until maxNewPoints nodes have been added (0 for no limit).  
+ * A listed tet that was already split by a neighbour in this pass is 
+ * skipped.  Returns the number of new nodes. */
+NodeIdType RefineTets( const std::vector< NodeIdType > &tets, NodeIdType maxNewPoints )
+{
+	NodeIdType nTets = m_Tets.size()/4;
+	std::vector< bool > split( nTets, false );
+	NodeIdType nNewPoints = 0;
+	for ( std::vector< NodeIdType >::const_iterator it = tets.begin(); it != tets.end(); ++it ){
+		if ( maxNewPoints > 0 && nNewPoints >= maxNewPoints ) break;
+		if ( *it >= nTets || split[*it] ) continue;
+		
+		EdgeType edge = this->GetLongestEdge( *it );
+		std::vector< NodeIdType > edgeTets = m_EdgeTets[ edge ];
+		for ( std::vector< NodeIdType >::const_iterator t = edgeTets.begin(); t != edgeTets.end(); ++t ){
+			if ( *t < nTets ) split[*t] = true;
+		}
+		this->BisectEdge( edge );
+		++nNewPoints;
+	}
+	return nNewPoints;
+}
+
+/** Get the number of nodes, including the new nodes. */
+NodeIdType GetNumberOfPoints() const
+{
+	return m_Points.size()/3;
+}
+
+/** Get the number of nodes before the refinement. */
+NodeIdType GetNumberOfOriginalPoints() const
+{
+	return m_NumberOfOriginalPoints;
+}
+
+/** Get the node locations, 3 coordinates per node. */
+const std::vector< double > &GetPoints() const
+{
+	return m_Points;
+}
+
+/** Get the node ids of the tets, 4 per tet. */
+const std::vector< NodeIdType > &GetTets() const
+{
+	return m_Tets;
+}
+
+/** Get the end nodes of the edge that new node id bisects. */
+const EdgeType &GetParents( NodeIdType id ) const
+{
+	return m_Parents[ id - m_NumberOfOriginalPoints ];
+}
+
+private:
+
+static EdgeType MakeEdge( NodeIdType a, NodeIdType b )
+{
+	return a < b ? EdgeType( a, b ) : EdgeType( b, a );
+}
+
+double GetSquaredLength( const EdgeType &edge ) const
+{
+	const double *a = &m_Points[ 3*edge.first ];
+	const double *b = &m_Points[ 3*edge.second ];
+	return ( b[0]-a[0] )*( b[0]-a[0] ) + ( b[1]-a[1] )*( b[1]-a[1] ) + ( b[2]-a[2] )*( b[2]-a[2] );
+}
+
+/** The longest edge of a tet, ties go to the edge with the smallest 
+ * node ids so neighbouring tets agree. */
+EdgeType GetLongestEdge( NodeIdType tet ) const
+{
+	const NodeIdType *nodes = &m_Tets[ 4*tet ];
+	EdgeType longest = MakeEdge( nodes[0], nodes[1] );
+	double longestLength = this->GetSquaredLength( longest );
+	for ( unsigned int a = 0; a < 4; ++a ){
+		for ( unsigned int b = a+1; b < 4; ++b ){
+			EdgeType edge = MakeEdge( nodes[a], nodes[b] );
+			double length = this->GetSquaredLength( edge );
+			if ( length > longestLength || ( length == longestLength && edge < longest ) ){
+				longest = edge;
+				longestLength = length;
+			}
+		}
+	}
+	return longest;
+}
+
+void RemoveTetFromEdge( NodeIdType a, NodeIdType b, NodeIdType tet )
+{
+	std::vector< NodeIdType > &edgeTets = m_EdgeTets[ MakeEdge( a, b ) ];
+	edgeTets.erase( std::remove( edgeTets.begin(), edgeTets.end(), tet ), edgeTets.end() );
+}
+
+/** Add the midpoint of the edge and split every tet using the edge.  A
+ * tet (a,b,p,q) becomes (a,m,p,q) and (m,b,p,q) with the nodes in the
+ * same positions, so the orientation is kept. */
+void BisectEdge( const EdgeType &edge )
+{
+	NodeIdType m = this->GetNumberOfPoints();
+	for ( unsigned int d = 0; d < 3; ++d ){
+		m_Points.push_back( 0.5*( m_Points[ 3*edge.first + d ] + m_Points[ 3*edge.second + d ] ) );
+	}
+	m_Parents.push_back( edge );
+	
+	std::vector< NodeIdType > edgeTets;
+	edgeTets.swap( m_EdgeTets[ edge ] );
+	m_EdgeTets.erase( edge );
+	for ( std::vector< NodeIdType >::const_iterator it = edgeTets.begin(); it != edgeTets.end(); ++it ){
+		NodeIdType tet = *it;
+		NodeIdType child = m_Tets.size()/4;
+		NodeIdType copy[4] = { m_Tets[4*tet], m_Tets[4*tet+1], m_Tets[4*tet+2], m_Tets[4*tet+3] };
+		m_Tets.insert( m_Tets.end(), copy, copy + 4 );
+		NodeIdType *parentNodes = &m_Tets[ 4*tet ];
+		NodeIdType *childNodes = &m_Tets[ 4*child ];
+		
+		NodeIdType others[2];
+		unsigned int nOthers = 0;
+		for ( unsigned int n = 0; n < 4; ++n ){
+			if ( parentNodes[n] == edge.second ) parentNodes[n] = m;
+			else if ( childNodes[n] == edge.first ) childNodes[n] = m;
+			else others[ nOthers++ ] = parentNodes[n];
+		}
+		
+		// the parent loses the edges to the second node, the child has them
+		this->RemoveTetFromEdge( edge.second, others[0], tet );
+		this->RemoveTetFromEdge( edge.second, others[1], tet );
+		m_EdgeTets[ MakeEdge( edge.first, m ) ].push_back( tet );
+		m_EdgeTets[ MakeEdge( m, others[0] ) ].push_back( tet );
+		m_EdgeTets[ MakeEdge( m, others[1] ) ].push_back( tet );
+		
+		m_EdgeTets[ MakeEdge( m, edge.second ) ].push_back( child );
+		m_EdgeTets[ MakeEdge( m, others[0] ) ].push_back( child );
+		m_EdgeTets[ MakeEdge( m, others[1] ) ].push_back( child );
+		m_EdgeTets[ MakeEdge( edge.second, others[0] ) ].push_back( child );
+		m_EdgeTets[ MakeEdge( edge.second, others[1] ) ].push_back( child );
+		m_EdgeTets[ MakeEdge( others[0], others[1] ) ].push_back( child );
+	}
+}
+
+std::vector< double >		m_Points;
+std::vector< NodeIdType >	m_Tets;
+NodeIdType					m_NumberOfOriginalPoints;
+std::vector< EdgeType >		m_Parents; // the bisected edge of every new node
+std::map< EdgeType, std::vector< NodeIdType > >	m_EdgeTets; // the tets using every edge
+
+}; // end class MeshRefiner
+
+#endif // MESHREFINER_H
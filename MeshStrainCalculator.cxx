@@ -0,0 +1,501 @@
+//      MeshStrainCalculator.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef MESHSTRAINCALCULATOR_H
+#define MESHSTRAINCALCULATOR_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "MeshNeighbourhood.cxx"
+#include "NodeBitmap.cxx"
+
+/** A class to calculate the small strain tensor of a displacement field
+ * defined at the nodes of a tetrahedral mesh.  The gradients of the 
+ * shape functions and the volume of every tet only depend on the mesh
+ * geometry so they are calculated once by Build() and reused for every
+ * displacement field.  The strain of a cell is 0.5*(grad(u)+grad(u)^T)
+ * and the strain of a node is the volume weighted average of the 
+ * strains of the cells that use it.  Linear (4 node) and quadratic
+ * (10 node, vtk node order) tets are supported.  The strain of a 
+ * quadratic tet varies through the cell so its cell strain is the 
+ * volume average of the strains at four Gauss points, which is the 
+ * strain given by the volume averaged shape function gradients, while
+ * its contribution to the strain of one of its nodes is the strain at
+ * that node, from the shape function gradients evaluated there.  When 
+ * only some nodes have moved, only the cells that use them and the 
+ * nodes of those cells need to be recalculated (see FindCellsOfNodes
+ * and FindNodesOfCells).  The tensors are symmetric so they are stored
+ * as 6 values per tuple in the order xx, yy, zz, xy, yz, xz and only 
+ * expanded to the 9 value row major form for output. */
+class MeshStrainCalculator
+{
+public:
+
+typedef MeshNeighbourhood::NodeIdType	NodeIdType;
+typedef MeshNeighbourhood::OffsetType	OffsetType;
+
+enum CellTypeType { UnsupportedCell = 0, LinearTetrahedron = 1, QuadraticTetrahedron = 2 };
+
+enum { NumberOfStrainComponents = 6 };
+
+/** Constructor **/
+MeshStrainCalculator()
+{
+	this->Clear();
+}
+
+/** Destructor **/
+~MeshStrainCalculator() {}
+
+/** Empty the calculator. */
+void Clear()
+{
+	m_NumberOfNodes = 0;
+	m_NumberOfUnsupportedCells = 0;
+	m_CellTypes.clear();
+	m_CellOffsets.assign( 1, 0 );
+	m_CellNodes.clear();
+	m_Gradients.clear();
+	m_NodeGradientOffsets.assign( 1, 0 );
+	m_NodeGradients.clear();
+	m_Volumes.clear();
+	m_NodeCellOffsets.assign( 1, 0 );
+	m_NodeCells.clear();
+}
+
+/** Returns true if the calculator has not been built. */
+bool IsEmpty() const
+{
+	return m_CellTypes.empty();
+}
+
+/** Build the calculator.  points holds the x,y,z location of every
+ * node.  The nodes of cell i are cellNodes[ cellOffsets[i] ] to 
+ * cellNodes[ cellOffsets[i+1]-1 ] and its type is cellTypes[i]. 
+ * Unsupported cells get zero strain and are left out of the node
+ * averages. */
+void Build( NodeIdType nNodes, const double *points, const std::vector< CellTypeType > &cellTypes, const std::vector< OffsetType > &cellOffsets, const std::vector< NodeIdType > &cellNodes, unsigned int nThreads )
+{
+	m_NumberOfNodes = nNodes;
+	m_CellTypes = cellTypes;
+	m_CellOffsets = cellOffsets;
+	m_CellNodes = cellNodes;
+	
+	long nCells = (long)m_CellTypes.size();
+	m_Gradients.assign( 3*m_CellNodes.size(), 0 ); // 3 values for each node of each cell
+	m_Volumes.assign( nCells, 0 );
+	this->CalculateQuadraticReferenceGradients();
+	
+	// the quadratic cells also keep the gradients of their shape functions at each of their nodes
+	m_NodeGradientOffsets.assign( nCells + 1, 0 );
+	for ( long i = 0; i < nCells; ++i ){
+		m_NodeGradientOffsets[i+1] = m_NodeGradientOffsets[i] + ( m_CellTypes[i] == QuadraticTetrahedron ? 300 : 0 );
+	}
+	m_NodeGradients.assign( m_NodeGradientOffsets[nCells], 0 );
+	
+	unsigned long nUnsupported = 0;
+	#pragma omp parallel for num_threads(nThreads) schedule(static) reduction(+:nUnsupported)
+	for ( long i = 0; i < nCells; ++i ){
+		const NodeIdType *nodes = &m_CellNodes[ m_CellOffsets[i] ];
+		double *gradients = &m_Gradients[ 3*m_CellOffsets[i] ];
+		if ( m_CellTypes[i] == LinearTetrahedron ){
+			m_Volumes[i] = this->CalculateTetrahedronGradients( points + 3*nodes[0], points + 3*nodes[1], points + 3*nodes[2], points + 3*nodes[3], gradients );
+		}
+		else if ( m_CellTypes[i] == QuadraticTetrahedron ){
+			m_Volumes[i] = this->CalculateQuadraticTetrahedronGradients( points, nodes, gradients );
+			if ( m_Volumes[i] != 0 ) this->CalculateQuadraticTetrahedronNodeGradients( points, nodes, gradients, &m_NodeGradients[ m_NodeGradientOffsets[i] ] );
+		}
+		else{
+			++nUnsupported;
+		}
+	}
+	
+	m_NumberOfUnsupportedCells = nUnsupported;
+	
+	// list the supported cells that use each node
+	std::vector< OffsetType > counts( nNodes + 1, 0 );
+	for ( long i = 0; i < nCells; ++i ){
+		if ( m_Volumes[i] == 0 ) continue;
+		for ( OffsetType j = m_CellOffsets[i]; j < m_CellOffsets[i+1]; ++j ){
+			++counts[ m_CellNodes[j] + 1 ];
+		}
+	}
+	for ( NodeIdType i = 0; i < nNodes; ++i ){
+		counts[i+1] += counts[i];
+	}
+	m_NodeCellOffsets = counts;
+	m_NodeCells.resize( counts[nNodes] );
+	for ( long i = 0; i < nCells; ++i ){
+		if ( m_Volumes[i] == 0 ) continue;
+		for ( OffsetType j = m_CellOffsets[i]; j < m_CellOffsets[i+1]; ++j ){
+			m_NodeCells[ counts[ m_CellNodes[j] ]++ ] = (NodeIdType)i;
+		}
+	}
+}
+
+/** Get the number of cells that are not supported. */
+unsigned long GetNumberOfUnsupportedCells() const
+{
+	return m_NumberOfUnsupportedCells;
+}
+
+/** Expand a strain tensor from 6 values to the 9 value row major form. */
+template< typename TValue >
+static void ExpandStrain( const TValue *strain, double *tensor )
+{
+	tensor[0] = strain[0]; tensor[1] = strain[3]; tensor[2] = strain[5];
+	tensor[3] = strain[3]; tensor[4] = strain[1]; tensor[5] = strain[4];
+	tensor[6] = strain[5]; tensor[7] = strain[4]; tensor[8] = strain[2];
+}
+
+/** Reduce a symmetric strain tensor from the 9 value row major form to
+ * 6 values.  The off diagonal values are averaged. */
+template< typename TValue >
+static void ReduceStrain( const double *tensor, TValue *strain )
+{
+	strain[0] = (TValue)tensor[0];
+	strain[1] = (TValue)tensor[4];
+	strain[2] = (TValue)tensor[8];
+	strain[3] = (TValue)( 0.5*( tensor[1] + tensor[3] ) );
+	strain[4] = (TValue)( 0.5*( tensor[5] + tensor[7] ) );
+	strain[5] = (TValue)( 0.5*( tensor[2] + tensor[6] ) );
+}
+
+/** Calculate the strain of every cell from the displacement of every
+ * node.  cellStrains must hold 6 values per cell. */
+template< typename TValue >
+void CalculateCellStrains( const double *displacements, TValue *cellStrains, unsigned int nThreads ) const
+{
+	long nCells = (long)m_CellTypes.size();
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long i = 0; i < nCells; ++i ){
+		this->CalculateCellStrain( i, displacements, cellStrains + 6*i );
+	}
+}
+
+/** Calculate the strain of the listed cells only. */
+template< typename TValue >
+void CalculateCellStrains( const double *displacements, TValue *cellStrains, const std::vector< NodeIdType > &cellIds, unsigned int nThreads ) const
+{
+	long nIds = (long)cellIds.size();
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long j = 0; j < nIds; ++j ){
+		this->CalculateCellStrain( cellIds[j], displacements, cellStrains + 6*cellIds[j] );
+	}
+}
+
+/** Calculate the strain of every cell as the average of the strains of
+ * its nodes.  Used when the point strains are found without the cells.
+ * Unsupported cells get zero strain. */
+template< typename TValue >
+void CalculateCellStrainsFromPoints( const TValue *pointStrains, TValue *cellStrains, unsigned int nThreads ) const
+{
+	long nCells = (long)m_CellTypes.size();
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long i = 0; i < nCells; ++i ){
+		double total[6] = { 0 };
+		OffsetType nCellNodes = m_CellOffsets[i+1] - m_CellOffsets[i];
+		for ( OffsetType j = m_CellOffsets[i]; j < m_CellOffsets[i+1]; ++j ){
+			const TValue *pStrain = pointStrains + 6*m_CellNodes[j];
+			for ( unsigned int k = 0; k < 6; ++k ){
+				total[k] = total[k] + pStrain[k];
+			}
+		}
+		for ( unsigned int k = 0; k < 6; ++k ){
+			cellStrains[6*i+k] = nCellNodes == 0 ? 0 : (TValue)( total[k] / nCellNodes );
+		}
+	}
+}
+
+/** Calculate the strain of every node as the volume weighted average
+ * of the strains of its cells at the node: the cell strain of linear
+ * tets and the strain at the node of quadratic tets, which is found
+ * from the displacements.  Every node gathers from its own cells so 
+ * the threads never write to the same node.  pointStrains must hold
+ * 6 values per node. */
+template< typename TValue >
+void CalculatePointStrains( const double *displacements, const TValue *cellStrains, TValue *pointStrains, unsigned int nThreads ) const
+{
+	long nNodes = (long)m_NumberOfNodes;
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long i = 0; i < nNodes; ++i ){
+		this->CalculatePointStrain( i, displacements, cellStrains, pointStrains + 6*i );
+	}
+}
+
+/** Calculate the strain of the listed nodes only. */
+template< typename TValue >
+void CalculatePointStrains( const double *displacements, const TValue *cellStrains, TValue *pointStrains, const std::vector< NodeIdType > &nodeIds, unsigned int nThreads ) const
+{
+	long nIds = (long)nodeIds.size();
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long j = 0; j < nIds; ++j ){
+		this->CalculatePointStrain( nodeIds[j], displacements, cellStrains, pointStrains + 6*nodeIds[j] );
+	}
+}
+
+/** Find the cells that use any of the given nodes.  These are the
+ * cells whose strain changes when the nodes move. */
+void FindCellsOfNodes( const NodeBitmap &nodes, NodeBitmap &cells ) const
+{
+	cells.SetNumberOfNodes( (NodeIdType)m_CellTypes.size() );
+	std::vector< NodeIdType > nodeIds;
+	nodes.GetNodes( nodeIds );
+	for ( unsigned int j = 0; j < nodeIds.size(); ++j ){
+		for ( OffsetType k = m_NodeCellOffsets[ nodeIds[j] ]; k < m_NodeCellOffsets[ nodeIds[j]+1 ]; ++k ){
+			cells.Set( m_NodeCells[k] );
+		}
+	}
+}
+
+/** Find the nodes used by any of the given cells.  These are the nodes
+ * whose averaged strain changes when the cell strains change. */
+void FindNodesOfCells( const NodeBitmap &cells, NodeBitmap &nodes ) const
+{
+	nodes.SetNumberOfNodes( m_NumberOfNodes );
+	std::vector< NodeIdType > cellIds;
+	cells.GetNodes( cellIds );
+	for ( unsigned int j = 0; j < cellIds.size(); ++j ){
+		for ( OffsetType k = m_CellOffsets[ cellIds[j] ]; k < m_CellOffsets[ cellIds[j]+1 ]; ++k ){
+			nodes.Set( m_CellNodes[k] );
+		}
+	}
+}
+
+private:
+
+/** Calculate the strain of cell i. */
+template< typename TValue >
+void CalculateCellStrain( NodeIdType i, const double *displacements, TValue *strain ) const
+{
+	if ( m_Volumes[i] == 0 ){
+		for ( unsigned int k = 0; k < 6; ++k ) strain[k] = 0;
+		return;
+	}
+	this->CalculateStrain( i, &m_Gradients[ 3*m_CellOffsets[i] ], displacements, strain );
+}
+
+/** Calculate the strain of cell i from the gradients of its shape 
+ * functions at some point of the cell. */
+template< typename TValue >
+void CalculateStrain( NodeIdType i, const double *shapeGradients, const double *displacements, TValue *strain ) const
+{
+	double gradient[9] = { 0 }; // du_r/dx_c in row major order
+	for ( OffsetType j = m_CellOffsets[i]; j < m_CellOffsets[i+1]; ++j, shapeGradients += 3 ){
+		const double *u = displacements + 3*m_CellNodes[j];
+		for ( unsigned int r = 0; r < 3; ++r ){
+			for ( unsigned int c = 0; c < 3; ++c ){
+				gradient[3*r+c] = gradient[3*r+c] + u[r]*shapeGradients[c];
+			}
+		}
+	}
+	MeshStrainCalculator::ReduceStrain( gradient, strain ); // the symmetric part of the gradient
+}
+
+/** Calculate the strain of node i. */
+template< typename TValue >
+void CalculatePointStrain( NodeIdType i, const double *displacements, const TValue *cellStrains, TValue *strain ) const
+{
+	double total[6] = { 0 };
+	double totalVolume = 0;
+	for ( OffsetType j = m_NodeCellOffsets[i]; j < m_NodeCellOffsets[i+1]; ++j ){
+		NodeIdType cId = m_NodeCells[j];
+		double nodeStrain[6];
+		if ( m_CellTypes[cId] == QuadraticTetrahedron ){
+			OffsetType local = 0; // the position of the node in the cell
+			while ( m_CellNodes[ m_CellOffsets[cId] + local ] != i ) ++local;
+			this->CalculateStrain( cId, &m_NodeGradients[ m_NodeGradientOffsets[cId] + 30*local ], displacements, nodeStrain );
+		}
+		else{
+			std::copy( cellStrains + 6*cId, cellStrains + 6*cId + 6, nodeStrain );
+		}
+		for ( unsigned int k = 0; k < 6; ++k ){
+			total[k] = total[k] + m_Volumes[cId]*nodeStrain[k];
+		}
+		totalVolume = totalVolume + m_Volumes[cId];
+	}
+	for ( unsigned int k = 0; k < 6; ++k ){
+		strain[k] = totalVolume == 0 ? 0 : (TValue)( total[k] / totalVolume );
+	}
+}
+
+/** Calculate the gradients of the four linear shape functions of the
+ * tet with corners p0 to p3 and return its volume.  The gradients are 
+ * the rows of the inverse of the Jacobian [p1-p0 p2-p0 p3-p0], the 
+ * gradient of the first shape function is minus their sum.  A 
+ * degenerate tet has a volume of 0 and zero gradients. */
+double CalculateTetrahedronGradients( const double *p0, const double *p1, const double *p2, const double *p3, double *gradients ) const
+{
+	double a[3], b[3], c[3];
+	for ( unsigned int k = 0; k < 3; ++k ){
+		a[k] = p1[k] - p0[k];
+		b[k] = p2[k] - p0[k];
+		c[k] = p3[k] - p0[k];
+	}
+	// the rows of the inverse are the cross products of the columns divided by the determinant
+	double bxc[3] = { b[1]*c[2] - b[2]*c[1], b[2]*c[0] - b[0]*c[2], b[0]*c[1] - b[1]*c[0] };
+	double cxa[3] = { c[1]*a[2] - c[2]*a[1], c[2]*a[0] - c[0]*a[2], c[0]*a[1] - c[1]*a[0] };
+	double axb[3] = { a[1]*b[2] - a[2]*b[1], a[2]*b[0] - a[0]*b[2], a[0]*b[1] - a[1]*b[0] };
+	double determinant = a[0]*bxc[0] + a[1]*bxc[1] + a[2]*bxc[2];
+	
+	double scale = std::fabs( a[0] ) + std::fabs( a[1] ) + std::fabs( a[2] ) + std::fabs( b[0] ) + std::fabs( b[1] ) + std::fabs( b[2] ) + std::fabs( c[0] ) + std::fabs( c[1] ) + std::fabs( c[2] );
+	if ( std::fabs( determinant ) <= 1e-12*scale*scale*scale ){
+		return 0;
+	}
+	
+	for ( unsigned int k = 0; k < 3; ++k ){
+		gradients[3+k] = bxc[k] / determinant;
+		gradients[6+k] = cxa[k] / determinant;
+		gradients[9+k] = axb[k] / determinant;
+		gradients[k] = -( gradients[3+k] + gradients[6+k] + gradients[9+k] );
+	}
+	return std::fabs( determinant ) / 6;
+}
+
+/** Calculate the derivatives of the ten quadratic shape functions with
+ * respect to the parametric coordinates (r,s,t) at the four Gauss 
+ * points and then at the ten nodes of the reference tet.  With the barycentric coordinates 
+ * L0 = 1-r-s-t, L1 = r, L2 = s, L3 = t, the corner functions are
+ * Li*(2*Li-1) and the mid-edge functions are 4*Li*Lj, with the vtk
+ * edge order (0,1), (1,2), (2,0), (0,3), (1,3), (2,3). */
+void CalculateQuadraticReferenceGradients()
+{
+	static const int edges[6][2] = { {0,1}, {1,2}, {2,0}, {0,3}, {1,3}, {2,3} };
+	static const double dL[4][3] = { {-1,-1,-1}, {1,0,0}, {0,1,0}, {0,0,1} };
+	const double a = 0.5854101966249685, b = 0.1381966011250105;
+	const double points[14][3] = { {b,b,b}, {a,b,b}, {b,a,b}, {b,b,a}, // the Gauss points then the nodes
+		{0,0,0}, {1,0,0}, {0,1,0}, {0,0,1}, {0.5,0,0}, {0.5,0.5,0}, {0,0.5,0}, {0,0,0.5}, {0.5,0,0.5}, {0,0.5,0.5} };
+	
+	for ( int g = 0; g < 14; ++g ){
+		double L[4] = { 1 - points[g][0] - points[g][1] - points[g][2], points[g][0], points[g][1], points[g][2] };
+		double *dN = m_QuadraticReferenceGradients + 30*g;
+		for ( int n = 0; n < 4; ++n ){
+			for ( int k = 0; k < 3; ++k ){
+				dN[3*n+k] = ( 4*L[n] - 1 )*dL[n][k];
+			}
+		}
+		for ( int e = 0; e < 6; ++e ){
+			int i = edges[e][0], j = edges[e][1];
+			for ( int k = 0; k < 3; ++k ){
+				dN[3*(4+e)+k] = 4*( L[i]*dL[j][k] + L[j]*dL[i][k] );
+			}
+		}
+	}
+}
+
+/** Calculate the volume averaged gradients of the ten shape functions
+ * of a quadratic tet and return its volume.  At every Gauss point the
+ * Jacobian is J = sum( x_a * dN_a/d(r,s,t) ) and the gradients are
+ * J^-T * dN_a/d(r,s,t).  A cell whose Jacobian vanishes or changes sign
+ * at a Gauss point is degenerate and has a volume of 0. */
+double CalculateQuadraticTetrahedronGradients( const double *points, const NodeIdType *nodes, double *gradients ) const
+{
+	double volume = 0;
+	int orientation = 0;
+	for ( int g = 0; g < 4; ++g ){
+		double pointGradients[30];
+		double determinant = this->CalculateQuadraticTetrahedronPointGradients( points, nodes, m_QuadraticReferenceGradients + 30*g, pointGradients );
+		int sign = determinant > 0 ? 1 : -1;
+		if ( determinant == 0 || ( orientation != 0 && sign != orientation ) ){
+			for ( int k = 0; k < 30; ++k ) gradients[k] = 0;
+			return 0;
+		}
+		orientation = sign;
+		
+		// weighted by the Gauss point volume
+		double weight = std::fabs( determinant )/24;
+		for ( int k = 0; k < 30; ++k ) gradients[k] = gradients[k] + weight*pointGradients[k];
+		volume = volume + weight;
+	}
+	for ( int k = 0; k < 30; ++k ) gradients[k] = gradients[k]/volume;
+	return volume;
+}
+
+/** Calculate the gradients of the ten shape functions of a quadratic 
+ * tet at each of its nodes, 30 values per node.  A node where the 
+ * Jacobian vanishes, which a valid but badly curved cell can have at a
+ * corner, gets the volume averaged gradients of the cell instead. */
+void CalculateQuadraticTetrahedronNodeGradients( const double *points, const NodeIdType *nodes, const double *averageGradients, double *nodeGradients ) const
+{
+	for ( int n = 0; n < 10; ++n ){
+		double *gradients = nodeGradients + 30*n;
+		if ( this->CalculateQuadraticTetrahedronPointGradients( points, nodes, m_QuadraticReferenceGradients + 30*( 4 + n ), gradients ) == 0 ){
+			std::copy( averageGradients, averageGradients + 30, gradients );
+		}
+	}
+}
+
+/** Calculate the gradients of the ten shape functions of a quadratic 
+ * tet at one point from their derivatives dN with respect to the 
+ * parametric coordinates there, and return the determinant of the 
+ * Jacobian, 0 if it vanishes.  The Jacobian is 
+ * J = sum( x_a * dN_a/d(r,s,t) ) and the gradients are 
+ * J^-T * dN_a/d(r,s,t). */
+double CalculateQuadraticTetrahedronPointGradients( const double *points, const NodeIdType *nodes, const double *dN, double *gradients ) const
+{
+	double J[9] = { 0 }; // J[3*r+c] = dx_r/dxi_c
+	for ( int n = 0; n < 10; ++n ){
+		const double *x = points + 3*nodes[n];
+		for ( int r = 0; r < 3; ++r ){
+			for ( int c = 0; c < 3; ++c ){
+				J[3*r+c] = J[3*r+c] + x[r]*dN[3*n+c];
+			}
+		}
+	}
+	// the inverse of J from its cofactors
+	double C[9] = { J[4]*J[8] - J[5]*J[7], J[5]*J[6] - J[3]*J[8], J[3]*J[7] - J[4]*J[6],
+					J[2]*J[7] - J[1]*J[8], J[0]*J[8] - J[2]*J[6], J[1]*J[6] - J[0]*J[7],
+					J[1]*J[5] - J[2]*J[4], J[2]*J[3] - J[0]*J[5], J[0]*J[4] - J[1]*J[3] };
+	double determinant = J[0]*C[0] + J[1]*C[1] + J[2]*C[2];
+	double scale = 0;
+	for ( int k = 0; k < 9; ++k ) scale = scale + std::fabs( J[k] );
+	if ( std::fabs( determinant ) <= 1e-12*scale*scale*scale ) return 0;
+	
+	// dN/dx_c = sum_r dN/dxi_r * (J^-1)_rc, with (J^-1)_rc = C[3*c+r]/determinant
+	for ( int n = 0; n < 10; ++n ){
+		for ( int c = 0; c < 3; ++c ){
+			gradients[3*n+c] = ( dN[3*n]*C[3*c] + dN[3*n+1]*C[3*c+1] + dN[3*n+2]*C[3*c+2] )/determinant;
+		}
+	}
+	return determinant;
+}
+
+double						m_QuadraticReferenceGradients[420]; // 3 values for each of the 10 shape functions at the 4 Gauss points and the 10 nodes
+NodeIdType					m_NumberOfNodes;
+unsigned long				m_NumberOfUnsupportedCells;
+std::vector< CellTypeType >	m_CellTypes;
+std::vector< OffsetType >	m_CellOffsets;
+std::vector< NodeIdType >	m_CellNodes;
+std::vector< double >		m_Gradients; // 3 values for each node of each cell
+std::vector< OffsetType >	m_NodeGradientOffsets; // the start of the node gradients of each cell
+std::vector< double >		m_NodeGradients; // 30 values for each node of each quadratic cell
+std::vector< double >		m_Volumes;
+std::vector< OffsetType >	m_NodeCellOffsets;
+std::vector< NodeIdType >	m_NodeCells;
+
+}; // end class MeshStrainCalculator
+
+#endif // MESHSTRAINCALCULATOR_H
@@ -0,0 +1,280 @@
+//      MetaImageMapper.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+
+#ifndef METAIMAGEMAPPER_H
+#define METAIMAGEMAPPER_H
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include "MappedFile.cxx"
+#include "itkImportImageFilter.h"
+
+/** A class to load an uncompressed MetaImage (.mha, or .mhd with a raw
+ * data file) without copying it: the data file is mapped copy on write
+ * and the image uses the mapped pixels as an external buffer that it 
+ * does not own.  Reading the volume is left to the page faults and a
+ * background read ahead, and the pages are shared with other processes
+ * mapping the same file.  The mapper must outlive the image.
+ * 
+ * Only single channel, three dimensional files in the pixel type of 
+ * the image and in the native byte order can be mapped; Map() returns
+ * false with the reason in GetMessage() for any other file so it can 
+ * be read with itk::ImageFileReader instead.  An image that will be 
+ * cropped can be mapped without the read ahead and cut down to a slab
+ * of whole slices by CropSlices, which still uses the mapped pixels 
+ * and only reads the slab. */
+template< typename TImage >
+class MetaImageMapper
+{
+public:
+
+typedef				TImage							ImageType;
+typedef	typename	ImageType::Pointer				ImagePointer;
+typedef	typename	ImageType::PixelType			PixelType;
+typedef itk::ImportImageFilter< PixelType, 3 >		ImportFilterType;
+
+/** Constructor **/
+MetaImageMapper()
+{
+	m_DataOffset = 0;
+}
+
+/** Destructor **/
+~MetaImageMapper() {}
+
+/** Map the image file, with transparent huge pages if asked, and start
+ * reading it in the background unless prefetch is false.  Returns false
+ * if the file cannot be mapped. */
+bool Map( const std::string &fileName, bool hugePages, bool prefetch = true )
+{
+	m_Image = 0;
+	m_Message.clear();
+	std::string extension = fileName.substr( fileName.rfind( '.' ) + 1 );
+	if ( extension.compare( "mha" ) && extension.compare( "mhd" ) ){
+		m_Message = "it is not a MetaImage";
+		return false;
+	}
+	std::ifstream header( fileName.c_str(), std::ios::in | std::ios::binary );
+	if ( !header ){
+		m_Message = "it cannot be opened";
+		return false;
+	}
+	
+	// read the header up to the data file, which is the last field
+	unsigned int dimensions = 0, channels = 1;
+	long dimSize[3] = {0, 0, 0};
+	double spacing[3] = {1, 1, 1}, origin[3] = {0, 0, 0};
+	double matrix[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+	bool compressed = false, bigEndian = false, spacingSet = false;
+	long headerSize = 0;
+	std::string elementType, dataFile, line;
+	while ( dataFile.empty() && std::getline( header, line ) ){
+		std::size_t equals = line.find( '=' );
+		if ( equals == std::string::npos ) continue;
+		std::string key = Trim( line.substr( 0, equals ) );
+		std::string value = Trim( line.substr( equals + 1 ) );
+		std::stringstream values( value );
+		if ( !key.compare( "NDims" ) ) values >> dimensions;
+		else if ( !key.compare( "DimSize" ) ) values >> dimSize[0] >> dimSize[1] >> dimSize[2];
+		else if ( !key.compare( "ElementSpacing" ) ) {values >> spacing[0] >> spacing[1] >> spacing[2]; spacingSet = true;}
+		else if ( !key.compare( "ElementSize" ) && !spacingSet ) values >> spacing[0] >> spacing[1] >> spacing[2];
+		else if ( !key.compare( "Offset" ) || !key.compare( "Position" ) || !key.compare( "Origin" ) ) values >> origin[0] >> origin[1] >> origin[2];
+		else if ( !key.compare( "TransformMatrix" ) || !key.compare( "Rotation" ) || !key.compare( "Orientation" ) ){
+			for ( unsigned int i = 0; i < 9; ++i ) values >> matrix[i];
+		}
+		else if ( !key.compare( "ElementType" ) ) elementType = value;
+		else if ( !key.compare( "ElementNumberOfChannels" ) ) values >> channels;
+		else if ( !key.compare( "CompressedData" ) ) compressed = !value.compare( "True" );
+		else if ( !key.compare( "BinaryDataByteOrderMSB" ) || !key.compare( "ElementByteOrderMSB" ) ) bigEndian = !value.compare( "True" );
+		else if ( !key.compare( "HeaderSize" ) ) values >> headerSize;
+		else if ( !key.compare( "ElementDataFile" ) ) dataFile = value;
+	}
+	
+	const unsigned short one = 1;
+	bool littleEndian = *reinterpret_cast< const unsigned char* >( &one ) == 1;
+	if ( dimensions != 3 || dimSize[0] < 1 || dimSize[1] < 1 || dimSize[2] < 1 ) m_Message = "it is not a three dimensional image";
+	else if ( elementType.compare( GetElementTypeName() ) ) m_Message = "its element type is not "+GetElementTypeName();
+	else if ( channels != 1 ) m_Message = "it has more than one channel";
+	else if ( compressed ) m_Message = "it is compressed";
+	else if ( bigEndian == littleEndian ) m_Message = "it is not in the native byte order";
+	else if ( dataFile.empty() || !dataFile.compare( 0, 4, "LIST" ) || dataFile.find( '%' ) != std::string::npos ) m_Message = "its data is not in one file";
+	if ( !m_Message.empty() ) return false;
+	
+	// the local data follows the header, a data file is next to the header
+	std::size_t dataOffset = headerSize > 0 ? headerSize : 0;
+	if ( !dataFile.compare( "LOCAL" ) ){
+		dataOffset = dataOffset + header.tellg();
+		dataFile = fileName;
+	}
+	else if ( dataFile[0] != '/' && fileName.rfind( '/' ) != std::string::npos ){
+		dataFile = fileName.substr( 0, fileName.rfind( '/' ) + 1 ) + dataFile;
+	}
+	header.close();
+	
+	std::size_t nPixels = dimSize[0]*dimSize[1]*dimSize[2];
+	std::size_t nBytes = nPixels*sizeof(PixelType);
+	if ( !m_File.Open( dataFile, false, true ) ){
+		m_Message = "the data file "+dataFile+" cannot be opened";
+		return false;
+	}
+	if ( headerSize == -1 && m_File.GetSize() >= nBytes ) dataOffset = m_File.GetSize() - nBytes; // the data is at the end
+	if ( dataOffset + nBytes > m_File.GetSize() ){
+		m_File.Close();
+		m_Message = "the data file "+dataFile+" is too short";
+		return false;
+	}
+	if ( dataOffset%sizeof(PixelType) ){
+		m_File.Close();
+		m_Message = "its data is not aligned";
+		return false;
+	}
+	if ( hugePages ) m_File.UseHugePages();
+	m_DataOffset = dataOffset;
+	if ( prefetch ) m_File.WillNeed( dataOffset, nBytes );
+	
+	typename ImportFilterType::Pointer importer = ImportFilterType::New();
+	typename ImportFilterType::SizeType size;
+	typename ImportFilterType::IndexType start;
+	typename ImportFilterType::DirectionType direction;
+	double importSpacing[3], importOrigin[3];
+	for ( unsigned int i = 0; i < 3; ++i ){
+		size[i] = dimSize[i];
+		start[i] = 0;
+		importSpacing[i] = spacing[i];
+		importOrigin[i] = origin[i];
+		for ( unsigned int j = 0; j < 3; ++j ) direction[j][i] = matrix[3*i+j];
+	}
+	typename ImportFilterType::RegionType region;
+	region.SetSize( size );
+	region.SetIndex( start );
+	importer->SetRegion( region );
+	importer->SetSpacing( importSpacing );
+	importer->SetOrigin( importOrigin );
+	importer->SetDirection( direction );
+	importer->SetImportPointer( reinterpret_cast< PixelType* >( m_File.GetWritableData() + dataOffset ), nPixels, false );
+	importer->Update();
+	m_Image = importer->GetOutput();
+	m_Image->DisconnectPipeline();
+	return true;
+}
+
+/** Get the mapped image. */
+ImagePointer GetOutput()
+{
+	return m_Image;
+}
+
+/** Start reading the pixels of the image in the background. */
+void Prefetch()
+{
+	if ( !m_Image ) return;
+	m_File.WillNeed( m_DataOffset, m_Image->GetBufferedRegion().GetNumberOfPixels()*sizeof(PixelType) );
+}
+
+/** Cut the image down to nSlices slices (the third index) from 
+ * firstSlice, counted from the start of the current image, without 
+ * copying: the new image starts at the first slice in the mapped 
+ * pixels and has the same geometry otherwise.  Only whole slices can 
+ * be kept this way because the pixels of a slice are contiguous.  The
+ * slab is then prefetched.  Returns false if the slices are out of 
+ * range. */
+bool CropSlices( unsigned long firstSlice, unsigned long nSlices )
+{
+	if ( !m_Image ) return false;
+	typename ImageType::RegionType region = m_Image->GetBufferedRegion();
+	if ( nSlices == 0 || firstSlice + nSlices > region.GetSize()[2] ) return false;
+	
+	typename ImageType::IndexType firstIndex = region.GetIndex();
+	firstIndex[2] = firstIndex[2] + firstSlice;
+	typename ImageType::PointType firstPoint;
+	m_Image->TransformIndexToPhysicalPoint( firstIndex, firstPoint );
+	typename ImportFilterType::SizeType size;
+	typename ImportFilterType::IndexType start;
+	double importSpacing[3], importOrigin[3];
+	for ( unsigned int i = 0; i < 3; ++i ){
+		size[i] = i < 2 ? region.GetSize()[i] : nSlices;
+		start[i] = 0;
+		importSpacing[i] = m_Image->GetSpacing()[i];
+		importOrigin[i] = firstPoint[i];
+	}
+	std::size_t sliceBytes = region.GetSize()[0]*region.GetSize()[1]*sizeof(PixelType);
+	m_DataOffset = m_DataOffset + firstSlice*sliceBytes;
+	
+	typename ImportFilterType::Pointer importer = ImportFilterType::New();
+	typename ImportFilterType::RegionType importRegion;
+	importRegion.SetSize( size );
+	importRegion.SetIndex( start );
+	importer->SetRegion( importRegion );
+	importer->SetSpacing( importSpacing );
+	importer->SetOrigin( importOrigin );
+	importer->SetDirection( m_Image->GetDirection() );
+	importer->SetImportPointer( reinterpret_cast< PixelType* >( m_File.GetWritableData() + m_DataOffset ), size[0]*size[1]*size[2], false );
+	importer->Update();
+	m_Image = importer->GetOutput();
+	m_Image->DisconnectPipeline();
+	this->Prefetch();
+	return true;
+}
+
+/** Get the MetaImage element type of the pixel type. */
+static std::string GetElementTypeName()
+{
+	return GetElementType( static_cast< PixelType* >( 0 ) );
+}
+
+/** Get the reason the last file could not be mapped. */
+std::string GetMessage() const
+{
+	return m_Message;
+}
+
+private:
+
+MetaImageMapper( const MetaImageMapper& ); // not copyable
+MetaImageMapper &operator=( const MetaImageMapper& );
+
+static std::string Trim( const std::string &text )
+{
+	std::size_t first = text.find_first_not_of( " \t\r" );
+	if ( first == std::string::npos ) return "";
+	return text.substr( first, text.find_last_not_of( " \t\r" ) - first + 1 );
+}
+
+// the MetaImage names of the pixel types
+static const char *GetElementType( char* ) {return "MET_CHAR";}
+static const char *GetElementType( unsigned char* ) {return "MET_UCHAR";}
+static const char *GetElementType( short* ) {return "MET_SHORT";}
+static const char *GetElementType( unsigned short* ) {return "MET_USHORT";}
+static const char *GetElementType( int* ) {return "MET_INT";}
+static const char *GetElementType( unsigned int* ) {return "MET_UINT";}
+static const char *GetElementType( float* ) {return "MET_FLOAT";}
+static const char *GetElementType( double* ) {return "MET_DOUBLE";}
+
+MappedFile			m_File;
+std::size_t			m_DataOffset; // the offset of the first pixel of the image in the file
+ImagePointer		m_Image;
+std::string			m_Message;
+
+}; // end class MetaImageMapper
+
+#endif // METAIMAGEMAPPER_H
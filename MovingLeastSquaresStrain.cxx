@@ -0,0 +1,258 @@
+//      MovingLeastSquaresStrain.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef MOVINGLEASTSQUARESSTRAIN_H
+#define MOVINGLEASTSQUARESSTRAIN_H
+
+#include <vector>
+#include <cmath>
+#include "MeshNeighbourhood.cxx"
+
+/** A class to calculate the strain at the nodes of a mesh without using
+ * its cells.  A linear or quadratic displacement field is fitted to
+ * each node and its neighbours (found by a radius or nearest neighbour
+ * search) by weighted least squares, and the strain of the node is the
+ * symmetric part of the gradient of the fitted field at the node.  The
+ * fitted gradient is a weighted sum of the neighbour displacements and
+ * the weights only depend on the node locations, so they are found by
+ * Build() once (one small dense solve per node) and every strain 
+ * calculation is a sparse product.  The neighbour weights are 
+ * (1-(d/R)^2)^2, where R is just larger than the farthest neighbour.
+ * The strains are stored as 6 values per node in the order xx, yy, zz,
+ * xy, yz, xz. */
+class MovingLeastSquaresStrain
+{
+public:
+
+typedef MeshNeighbourhood::NodeIdType	NodeIdType;
+typedef MeshNeighbourhood::OffsetType	OffsetType;
+
+/** Constructor **/
+MovingLeastSquaresStrain()
+{
+	this->Clear();
+}
+
+/** Destructor **/
+~MovingLeastSquaresStrain() {}
+
+/** Empty the calculator. */
+void Clear()
+{
+	m_Offsets.assign( 1, 0 );
+	m_Neighbours.clear();
+	m_Coefficients.clear();
+	m_NumberOfReducedNodes = 0;
+	m_NumberOfFailedNodes = 0;
+}
+
+/** Returns true if the calculator has not been built. */
+bool IsEmpty() const
+{
+	return m_Offsets.size() < 2;
+}
+
+/** Build the calculator.  points holds the x,y,z location of every 
+ * node.  The neighbours of node i are neighbours[ offsets[i] ] to 
+ * neighbours[ offsets[i+1]-1 ]; node i itself may be listed or not.
+ * order is 1 for a linear fit (at least 4 nodes are needed) or 2 for a
+ * quadratic fit (at least 10 nodes are needed).  A node where the 
+ * quadratic fit is singular uses the linear fit and a node where the
+ * linear fit is singular gets zero strain. */
+void Build( const double *points, const std::vector< OffsetType > &offsets, const std::vector< NodeIdType > &neighbours, unsigned int order, unsigned int nThreads )
+{
+	long nNodes = (long)offsets.size() - 1;
+	
+	// every row holds the neighbours and the node itself, the node is stored last
+	m_Offsets.resize( nNodes + 1 );
+	m_Offsets[0] = 0;
+	for ( long i = 0; i < nNodes; ++i ){
+		OffsetType nNeighbours = 0;
+		for ( OffsetType j = offsets[i]; j < offsets[i+1]; ++j ){
+			if ( neighbours[j] != (NodeIdType)i ) ++nNeighbours;
+		}
+		m_Offsets[i+1] = m_Offsets[i] + nNeighbours + 1;
+	}
+	m_Neighbours.resize( m_Offsets[nNodes] );
+	m_Coefficients.assign( 3*m_Offsets[nNodes], 0 );
+	
+	unsigned long nReduced = 0;
+	unsigned long nFailed = 0;
+	#pragma omp parallel for num_threads(nThreads) schedule(dynamic,64) reduction(+:nReduced,nFailed)
+	for ( long i = 0; i < nNodes; ++i ){
+		OffsetType k = m_Offsets[i];
+		for ( OffsetType j = offsets[i]; j < offsets[i+1]; ++j ){
+			if ( neighbours[j] != (NodeIdType)i ) m_Neighbours[k++] = neighbours[j];
+		}
+		m_Neighbours[k] = (NodeIdType)i;
+		
+		unsigned int usedOrder = order > 1 ? 2 : 1;
+		bool solved = this->CalculateCoefficients( points, i, usedOrder );
+		if ( !solved && usedOrder == 2 ){
+			usedOrder = 1;
+			++nReduced;
+			solved = this->CalculateCoefficients( points, i, usedOrder );
+		}
+		if ( !solved ) ++nFailed;
+	}
+	m_NumberOfReducedNodes = nReduced;
+	m_NumberOfFailedNodes = nFailed;
+}
+
+/** Get the number of nodes where the quadratic fit was singular and a 
+ * linear fit was used. */
+unsigned long GetNumberOfReducedNodes() const
+{
+	return m_NumberOfReducedNodes;
+}
+
+/** Get the number of nodes where no fit was possible. */
+unsigned long GetNumberOfFailedNodes() const
+{
+	return m_NumberOfFailedNodes;
+}
+
+/** Calculate the strain of every node from the displacements. 
+ * pointStrains must hold 6 values per node. */
+template< typename TValue >
+void CalculatePointStrains( const double *displacements, TValue *pointStrains, unsigned int nThreads ) const
+{
+	long nNodes = (long)m_Offsets.size() - 1;
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long i = 0; i < nNodes; ++i ){
+		double gradient[9] = { 0 }; // du_r/dx_c in row major order
+		for ( OffsetType j = m_Offsets[i]; j < m_Offsets[i+1]; ++j ){
+			const double *u = displacements + 3*m_Neighbours[j];
+			const double *g = &m_Coefficients[3*j];
+			for ( unsigned int r = 0; r < 3; ++r ){
+				for ( unsigned int c = 0; c < 3; ++c ){
+					gradient[3*r+c] = gradient[3*r+c] + u[r]*g[c];
+				}
+			}
+		}
+		TValue *strain = pointStrains + 6*i;
+		strain[0] = (TValue)gradient[0];
+		strain[1] = (TValue)gradient[4];
+		strain[2] = (TValue)gradient[8];
+		strain[3] = (TValue)( 0.5*( gradient[1] + gradient[3] ) );
+		strain[4] = (TValue)( 0.5*( gradient[5] + gradient[7] ) );
+		strain[5] = (TValue)( 0.5*( gradient[2] + gradient[6] ) );
+	}
+}
+
+private:
+
+/** Calculate the gradient coefficients of node i for a fit of the given
+ * order.  With the basis p(x) of the fit, centred on node i and scaled
+ * by R, the fitted coefficients are M^-1 * sum( w_j p_j u_j ) with 
+ * M = sum( w_j p_j p_j^T ), so the coefficient of u_j in the gradient
+ * is w_j times rows 1 to 3 of M^-1 p_j, divided by R.  Returns false
+ * if M is singular. */
+bool CalculateCoefficients( const double *points, NodeIdType i, unsigned int order )
+{
+	const unsigned int nBasis = order == 2 ? 10 : 4;
+	OffsetType rowStart = m_Offsets[i];
+	OffsetType rowEnd = m_Offsets[i+1];
+	for ( OffsetType j = rowStart; j < rowEnd; ++j ){
+		m_Coefficients[3*j] = m_Coefficients[3*j+1] = m_Coefficients[3*j+2] = 0;
+	}
+	if ( rowEnd - rowStart < nBasis ) return false;
+	
+	const double *x = points + 3*i;
+	double R = 0;
+	for ( OffsetType j = rowStart; j < rowEnd; ++j ){
+		const double *y = points + 3*m_Neighbours[j];
+		double d = std::sqrt( ( y[0]-x[0] )*( y[0]-x[0] ) + ( y[1]-x[1] )*( y[1]-x[1] ) + ( y[2]-x[2] )*( y[2]-x[2] ) );
+		R = d > R ? d : R;
+	}
+	if ( R == 0 ) return false;
+	R = 1.1*R; // so the farthest neighbour keeps some weight
+	
+	// assemble M
+	double M[100] = { 0 };
+	double p[10];
+	for ( OffsetType j = rowStart; j < rowEnd; ++j ){
+		double w = this->CalculateBasis( points, i, m_Neighbours[j], R, order, p );
+		for ( unsigned int r = 0; r < nBasis; ++r ){
+			for ( unsigned int c = 0; c <= r; ++c ){
+				M[nBasis*r+c] = M[nBasis*r+c] + w*p[r]*p[c];
+			}
+		}
+	}
+	
+	// Cholesky factorization M = L*L^T, stored in the lower triangle
+	for ( unsigned int c = 0; c < nBasis; ++c ){
+		double diagonal = M[nBasis*c+c], original = diagonal; // the pivot is relative to the diagonal before the updates
+		for ( unsigned int k = 0; k < c; ++k ) diagonal = diagonal - M[nBasis*c+k]*M[nBasis*c+k];
+		if ( !( diagonal > 1e-12*original ) ) return false;
+		diagonal = std::sqrt( diagonal );
+		M[nBasis*c+c] = diagonal;
+		for ( unsigned int r = c+1; r < nBasis; ++r ){
+			double value = M[nBasis*r+c];
+			for ( unsigned int k = 0; k < c; ++k ) value = value - M[nBasis*r+k]*M[nBasis*c+k];
+			M[nBasis*r+c] = value/diagonal;
+		}
+	}
+	
+	// solve M*y = p_j for every neighbour and keep the gradient terms of y
+	for ( OffsetType j = rowStart; j < rowEnd; ++j ){
+		double w = this->CalculateBasis( points, i, m_Neighbours[j], R, order, p );
+		for ( unsigned int r = 0; r < nBasis; ++r ){ // forward substitution
+			for ( unsigned int k = 0; k < r; ++k ) p[r] = p[r] - M[nBasis*r+k]*p[k];
+			p[r] = p[r]/M[nBasis*r+r];
+		}
+		for ( int r = nBasis-1; r >= 0; --r ){ // back substitution
+			for ( unsigned int k = r+1; k < nBasis; ++k ) p[r] = p[r] - M[nBasis*k+r]*p[k];
+			p[r] = p[r]/M[nBasis*r+r];
+		}
+		for ( unsigned int c = 0; c < 3; ++c ){
+			m_Coefficients[3*j+c] = w*p[1+c]/R;
+		}
+	}
+	return true;
+}
+
+/** Fill p with the basis of the fit at node j, centred on node i and
+ * scaled by R, and return the weight of node j. The basis is 1, dx, dy,
+ * dz and, for a quadratic fit, dx^2, dy^2, dz^2, dx*dy, dy*dz, dx*dz. */
+double CalculateBasis( const double *points, NodeIdType i, NodeIdType j, double R, unsigned int order, double *p ) const
+{
+	const double *x = points + 3*i;
+	const double *y = points + 3*j;
+	double dx = ( y[0]-x[0] )/R, dy = ( y[1]-x[1] )/R, dz = ( y[2]-x[2] )/R;
+	p[0] = 1; p[1] = dx; p[2] = dy; p[3] = dz;
+	if ( order == 2 ){
+		p[4] = dx*dx; p[5] = dy*dy; p[6] = dz*dz;
+		p[7] = dx*dy; p[8] = dy*dz; p[9] = dx*dz;
+	}
+	double q = 1 - ( dx*dx + dy*dy + dz*dz );
+	return q*q;
+}
+
+std::vector< OffsetType >	m_Offsets;
+std::vector< NodeIdType >	m_Neighbours;
+std::vector< double >		m_Coefficients; // 3 values for each neighbour of each node
+unsigned long				m_NumberOfReducedNodes;
+unsigned long				m_NumberOfFailedNodes;
+
+}; // end class MovingLeastSquaresStrain
+
+#endif // MOVINGLEASTSQUARESSTRAIN_H
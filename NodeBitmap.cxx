@@ -0,0 +1,160 @@
+//      NodeBitmap.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef NODEBITMAP_H
+#define NODEBITMAP_H
+
+#include <vector>
+
+/** A compact set of mesh nodes stored as one bit per node.  The bits
+ * are packed into 32 bit words so that a word can be filled by a single
+ * thread without locking. */
+class NodeBitmap
+{
+public:
+
+typedef unsigned int	NodeIdType;
+typedef unsigned int	WordType;
+
+static const unsigned int	BitsPerWord = 32;
+
+/** Constructor **/
+NodeBitmap()
+{
+	m_NumberOfNodes = 0;
+}
+
+/** Destructor **/
+~NodeBitmap() {}
+
+/** Set the number of nodes and clear every bit. */
+void SetNumberOfNodes( NodeIdType nNodes )
+{
+	m_NumberOfNodes = nNodes;
+	m_Words.assign( ( nNodes + BitsPerWord - 1 ) / BitsPerWord, 0 );
+}
+
+/** Get the number of nodes. */
+NodeIdType GetNumberOfNodes() const
+{
+	return m_NumberOfNodes;
+}
+
+/** Clear every bit. */
+void Clear()
+{
+	m_Words.assign( m_Words.size(), 0 );
+}
+
+/** Set every bit. */
+void Fill()
+{
+	m_Words.assign( m_Words.size(), ~(WordType)0 );
+	if ( m_NumberOfNodes % BitsPerWord ){ // clear the bits past the last node
+		m_Words.back() = ( (WordType)1 << ( m_NumberOfNodes % BitsPerWord ) ) - 1;
+	}
+}
+
+/** Add node i to the set. */
+void Set( NodeIdType i )
+{
+	m_Words[ i / BitsPerWord ] |= (WordType)1 << ( i % BitsPerWord );
+}
+
+/** Remove node i from the set. */
+void Reset( NodeIdType i )
+{
+	m_Words[ i / BitsPerWord ] &= ~( (WordType)1 << ( i % BitsPerWord ) );
+}
+
+/** Returns true if node i is in the set. */
+bool Test( NodeIdType i ) const
+{
+	return ( m_Words[ i / BitsPerWord ] >> ( i % BitsPerWord ) ) & 1;
+}
+
+/** Get the number of words. */
+NodeIdType GetNumberOfWords() const
+{
+	return (NodeIdType)m_Words.size();
+}
+
+/** Get word w. */
+WordType GetWord( NodeIdType w ) const
+{
+	return m_Words[w];
+}
+
+/** Set word w. */
+void SetWord( NodeIdType w, WordType word )
+{
+	m_Words[w] = word;
+}
+
+/** Add the nodes of another set of the same size to this set. */
+void Union( const NodeBitmap &other )
+{
+	for ( NodeIdType w = 0; w < m_Words.size(); ++w ){
+		m_Words[w] |= other.m_Words[w];
+	}
+}
+
+/** Returns true if no node is in the set. */
+bool IsEmpty() const
+{
+	for ( NodeIdType w = 0; w < m_Words.size(); ++w ){
+		if ( m_Words[w] ) return false;
+	}
+	return true;
+}
+
+/** Get the number of nodes in the set. */
+NodeIdType Count() const
+{
+	NodeIdType count = 0;
+	for ( NodeIdType w = 0; w < m_Words.size(); ++w ){
+		for ( WordType word = m_Words[w]; word; word &= word - 1 ){
+			++count;
+		}
+	}
+	return count;
+}
+
+/** Put the nodes in the set into ids, in ascending order. */
+void GetNodes( std::vector< NodeIdType > &ids ) const
+{
+	ids.clear();
+	for ( NodeIdType w = 0; w < m_Words.size(); ++w ){
+		for ( unsigned int b = 0; b < BitsPerWord; ++b ){
+			if ( ( m_Words[w] >> b ) & 1 ){
+				ids.push_back( w*BitsPerWord + b );
+			}
+		}
+	}
+}
+
+private:
+
+NodeIdType				m_NumberOfNodes;
+std::vector< WordType >	m_Words;
+
+}; // end class NodeBitmap
+
+#endif // NODEBITMAP_H
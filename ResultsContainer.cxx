@@ -0,0 +1,547 @@
+//      ResultsContainer.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+
+#ifndef RESULTSCONTAINER_H
+#define RESULTSCONTAINER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include "MappedFile.cxx"
+#include "VTUWriter.cxx"
+#include <vtkType.h>
+#include <vtkSmartPointer.h>
+#include <vtkUnstructuredGrid.h>
+#include <vtkPoints.h>
+#include <vtkCellArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkPointData.h>
+#include <vtkCellData.h>
+#include <vtkDataArray.h>
+#include <vtkDoubleArray.h>
+#include <vtkFloatArray.h>
+
+/** A class to collect the results of several stages or time steps of 
+ * an analysis in one binary file (.dvcr).  The mesh is stored once and
+ * every stage adds its point and cell arrays as named datasets; a stage
+ * on a new mesh (e.g. after refinement) stores that mesh as a second 
+ * geometry.  An index at the end of the file gives the location of 
+ * every block, so the file can be mapped and one tuple, or the history 
+ * of one node through the stages, read without touching the rest.
+ * 
+ * The file is in native byte order, every block starts on an 8 byte 
+ * boundary and all the counts and offsets are 64 bit:
+ *   header (64 bytes): "DVCRSLT1", uint32 0x01020304, uint32 version,
+ *     uint64 index offset, uint64 index size
+ *   geometry blocks: points (float64 x 3), cells (int64, the number of
+ *     points of each cell before its point ids, as in vtkCellArray),
+ *     cell types (uint8)
+ *   dataset blocks: the tuples as float64 or float32
+ *   index: uint64 number of geometries, then for each the number of
+ *     points, cells and cell entries and the points, cells and types 
+ *     offsets and a hash of the mesh; uint64 number of datasets, then 
+ *     for each uint32 geometry, association (0 point, 1 cell), vtk data
+ *     type and number of components, uint64 number of tuples and offset,
+ *     and the stage and array names as a uint32 length and the chars.
+ * A stage is appended by writing its blocks and a new index after the
+ * end of the file and only then pointing the header at the new index, 
+ * so an append that is interrupted leaves the file as it was.  The old
+ * indices are left in the file. */
+class ResultsContainer
+{
+public:
+
+struct GeometryType
+{
+	unsigned long long	nPoints;
+	unsigned long long	nCells;
+	unsigned long long	nCellEntries;
+	unsigned long long	pointsOffset;
+	unsigned long long	cellsOffset;
+	unsigned long long	typesOffset;
+	unsigned long long	hash;
+};
+
+struct DatasetType
+{
+	unsigned int		geometry;
+	unsigned int		association; // 0 for point data, 1 for cell data
+	unsigned int		dataType; // VTK_DOUBLE or VTK_FLOAT
+	unsigned int		nComponents;
+	unsigned long long	nTuples;
+	unsigned long long	offset;
+	std::string			stage;
+	std::string			name;
+};
+
+/** Constructor **/
+ResultsContainer()
+{
+	m_IndexOffset = 0;
+	m_NumberOfThreads = 1;
+}
+
+/** Destructor **/
+~ResultsContainer() {}
+
+/** Set the number of threads used to append and export a stage. */
+void SetNumberOfThreads( unsigned int nThreads )
+{
+	m_NumberOfThreads = nThreads > 0 ? nThreads : 1;
+}
+
+/** Append the point and cell arrays of the grid to the file as the 
+ * datasets of the named stage.  The file is created if it does not 
+ * exist and the mesh is only written if the file does not hold it yet.
+ * The file is mapped again afterwards to read it.  Returns false if the
+ * file cannot be read or written. */
+bool AppendStage( const std::string &fileName, const std::string &stage, vtkUnstructuredGrid *grid )
+{
+	unsigned long long end = HeaderSize;
+	std::ifstream existing( fileName.c_str() );
+	bool exists = existing.good();
+	existing.close();
+	if ( exists ){
+		if ( !this->Open( fileName ) ) return false;
+		end = m_File.GetSize(); // the old index stays valid until the header is rewritten
+		m_File.Close(); // the blocks are read from the index
+	}
+	else{
+		m_Geometries.clear();
+		m_Datasets.clear();
+		std::ofstream created( fileName.c_str(), std::ios::out | std::ios::binary );
+		if ( !created ) return false;
+	}
+	
+	std::fstream output( fileName.c_str(), std::ios::in | std::ios::out | std::ios::binary );
+	if ( !output ) return false;
+	output.seekp( end );
+	
+	// find the mesh or write it
+	std::vector< long long > cells;
+	vtkIdType nCells = grid->GetNumberOfCells();
+	if ( nCells > 0 ){
+		const vtkIdType *cellValues = grid->GetCells()->GetPointer();
+		cells.assign( cellValues, cellValues + grid->GetCells()->GetNumberOfConnectivityEntries() );
+	}
+	long nPoints = grid->GetNumberOfPoints();
+	std::vector< double > points( 3*nPoints );
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+	for ( long i = 0; i < nPoints; ++i ){
+		grid->GetPoints()->GetPoint( i, &points[3*i] );
+	}
+	GeometryType geometry;
+	geometry.nPoints = grid->GetNumberOfPoints();
+	geometry.nCells = nCells;
+	geometry.nCellEntries = cells.size();
+	geometry.hash = Hash( points.empty() ? 0 : &points[0], points.size()*sizeof(double), 
+		Hash( cells.empty() ? 0 : &cells[0], cells.size()*sizeof(long long), 14695981039346656037ULL ) );
+	unsigned int geometryIndex = 0;
+	while ( geometryIndex < m_Geometries.size() && !SameGeometry( m_Geometries[geometryIndex], geometry ) ) ++geometryIndex;
+	if ( geometryIndex == m_Geometries.size() ){
+		std::vector< unsigned char > types( nCells );
+		for ( vtkIdType i = 0; i < nCells; ++i ) types[i] = (unsigned char)grid->GetCellType( i );
+		geometry.pointsOffset = WriteBlock( output, points.empty() ? 0 : &points[0], points.size()*sizeof(double) );
+		geometry.cellsOffset = WriteBlock( output, cells.empty() ? 0 : &cells[0], cells.size()*sizeof(long long) );
+		geometry.typesOffset = WriteBlock( output, types.empty() ? 0 : &types[0], types.size() );
+		m_Geometries.push_back( geometry );
+	}
+	
+	// write the datasets
+	this->AppendDatasets( output, stage, geometryIndex, 0, grid->GetPointData() );
+	this->AppendDatasets( output, stage, geometryIndex, 1, grid->GetCellData() );
+	
+	// write the index, then point the header at it once everything else is written
+	std::string index = this->GetIndex();
+	unsigned long long indexOffset = WriteBlock( output, index.data(), index.size() );
+	output.flush();
+	if ( output.fail() ) return false;
+	WriteHeader( output, indexOffset, index.size() );
+	output.close();
+	if ( output.fail() ) return false;
+	return this->Open( fileName );
+}
+
+/** Create an empty file, replacing a file of that name, e.g. the 
+ * results of an earlier run.  Returns false if the file cannot be 
+ * written. */
+bool Create( const std::string &fileName )
+{
+	m_File.Close();
+	m_Geometries.clear();
+	m_Datasets.clear();
+	std::fstream output( fileName.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc );
+	if ( !output ) return false;
+	output.seekp( HeaderSize );
+	std::string index = this->GetIndex();
+	unsigned long long indexOffset = WriteBlock( output, index.data(), index.size() );
+	WriteHeader( output, indexOffset, index.size() );
+	output.close();
+	if ( output.fail() ) return false;
+	return this->Open( fileName );
+}
+
+/** Map the file and read its index.  Returns false if the file cannot 
+ * be read or is not a results container. */
+bool Open( const std::string &fileName )
+{
+	m_Geometries.clear();
+	m_Datasets.clear();
+	if ( !m_File.Open( fileName, false ) || m_File.GetSize() < HeaderSize ) return false;
+	const char *data = m_File.GetData();
+	unsigned int byteOrder, version;
+	unsigned long long indexSize;
+	std::memcpy( &byteOrder, data + 8, 4 );
+	std::memcpy( &version, data + 12, 4 );
+	std::memcpy( &m_IndexOffset, data + 16, 8 );
+	std::memcpy( &indexSize, data + 24, 8 );
+	if ( std::memcmp( data, GetMagic(), 8 ) || byteOrder != ByteOrder || version != Version ||
+		m_IndexOffset + indexSize > m_File.GetSize() ) return false;
+	
+	const char *position = data + m_IndexOffset;
+	const char *end = position + indexSize;
+	unsigned long long nGeometries, nDatasets;
+	if ( !Get( position, end, nGeometries ) ) return false;
+	m_Geometries.resize( nGeometries );
+	for ( unsigned long long i = 0; i < nGeometries; ++i ){
+		GeometryType &geometry = m_Geometries[i];
+		if ( !Get( position, end, geometry.nPoints ) || !Get( position, end, geometry.nCells ) ||
+			!Get( position, end, geometry.nCellEntries ) || !Get( position, end, geometry.pointsOffset ) ||
+			!Get( position, end, geometry.cellsOffset ) || !Get( position, end, geometry.typesOffset ) ||
+			!Get( position, end, geometry.hash ) ) return false;
+		if ( geometry.pointsOffset + 3*geometry.nPoints*sizeof(double) > m_IndexOffset ||
+			geometry.cellsOffset + geometry.nCellEntries*sizeof(long long) > m_IndexOffset ||
+			geometry.typesOffset + geometry.nCells > m_IndexOffset ) return false;
+	}
+	if ( !Get( position, end, nDatasets ) ) return false;
+	m_Datasets.resize( nDatasets );
+	for ( unsigned long long i = 0; i < nDatasets; ++i ){
+		DatasetType &dataset = m_Datasets[i];
+		if ( !Get( position, end, dataset.geometry ) || !Get( position, end, dataset.association ) ||
+			!Get( position, end, dataset.dataType ) || !Get( position, end, dataset.nComponents ) ||
+			!Get( position, end, dataset.nTuples ) || !Get( position, end, dataset.offset ) ||
+			!Get( position, end, dataset.stage ) || !Get( position, end, dataset.name ) ) return false;
+		if ( dataset.geometry >= nGeometries || ( dataset.dataType != VTK_DOUBLE && dataset.dataType != VTK_FLOAT ) ||
+			dataset.offset + dataset.nTuples*dataset.nComponents*GetTypeSize( dataset.dataType ) > m_IndexOffset ) return false;
+	}
+	return true;
+}
+
+/** Get the number of meshes in the file. */
+std::size_t GetNumberOfGeometries() const
+{
+	return m_Geometries.size();
+}
+
+/** Get a mesh of the file. */
+const GeometryType &GetGeometry( std::size_t i ) const
+{
+	return m_Geometries[i];
+}
+
+/** Get the number of datasets in the file. */
+std::size_t GetNumberOfDatasets() const
+{
+	return m_Datasets.size();
+}
+
+/** Get a dataset of the file. */
+const DatasetType &GetDataset( std::size_t i ) const
+{
+	return m_Datasets[i];
+}
+
+/** Get the index of the named dataset of a stage, or -1 if the stage 
+ * has no such dataset.  If the stage was appended more than once the
+ * last one is used. */
+long FindDataset( const std::string &stage, const std::string &name, unsigned int association ) const
+{
+	for ( long i = (long)m_Datasets.size() - 1; i >= 0; --i ){
+		if ( m_Datasets[i].association == association && m_Datasets[i].stage == stage && m_Datasets[i].name == name ) return i;
+	}
+	return -1;
+}
+
+/** Get the coordinates of the points of a mesh, 3 per point. */
+const double *GetPoints( std::size_t geometry ) const
+{
+	return reinterpret_cast< const double* >( m_File.GetData() + m_Geometries[geometry].pointsOffset );
+}
+
+/** Get one tuple of a dataset.  Returns false if the id is out of range. */
+bool GetTuple( std::size_t dataset, unsigned long long id, double *values ) const
+{
+	const DatasetType &data = m_Datasets[dataset];
+	if ( id >= data.nTuples ) return false;
+	const char *tuple = m_File.GetData() + data.offset + id*data.nComponents*GetTypeSize( data.dataType );
+	for ( unsigned int c = 0; c < data.nComponents; ++c ){
+		if ( data.dataType == VTK_DOUBLE ) values[c] = reinterpret_cast< const double* >( tuple )[c];
+		else values[c] = reinterpret_cast< const float* >( tuple )[c];
+	}
+	return true;
+}
+
+/** Get the history of a point array at one node of a mesh: the stages, 
+ * in the order they were written, and the tuples of the array at the 
+ * node, one after the other.  Only the mapped pages holding the node 
+ * are read. */
+void GetNodeHistory( const std::string &name, unsigned long long nodeId, std::size_t geometry, 
+	std::vector< std::string > &stages, std::vector< double > &values ) const
+{
+	stages.clear();
+	values.clear();
+	for ( std::size_t i = 0; i < m_Datasets.size(); ++i ){
+		const DatasetType &data = m_Datasets[i];
+		if ( data.association != 0 || data.geometry != geometry || data.name != name || nodeId >= data.nTuples ) continue;
+		stages.push_back( data.stage );
+		values.resize( values.size() + data.nComponents );
+		this->GetTuple( i, nodeId, &values[ values.size() - data.nComponents ] );
+	}
+}
+
+/** Make a grid of a stage with its mesh and arrays.  If the stage was
+ * appended more than once the mesh of the last append is used, with 
+ * the last datasets of each name on that mesh.  Returns a null pointer
+ * if the stage is not in the file. */
+vtkSmartPointer< vtkUnstructuredGrid > GetStageImage( const std::string &stage ) const
+{
+	vtkSmartPointer< vtkUnstructuredGrid > grid;
+	long last = (long)m_Datasets.size() - 1;
+	while ( last >= 0 && m_Datasets[last].stage != stage ) --last;
+	if ( last < 0 ) return grid;
+	
+	// the last dataset of each name on the mesh, in the order they were written
+	unsigned int geometryIndex = m_Datasets[last].geometry;
+	std::vector< std::size_t > datasets;
+	for ( long i = last; i >= 0; --i ){
+		const DatasetType &dataset = m_Datasets[i];
+		if ( dataset.stage != stage || dataset.geometry != geometryIndex ) continue;
+		bool found = false;
+		for ( std::size_t j = 0; j < datasets.size() && !found; ++j ){
+			found = m_Datasets[ datasets[j] ].name == dataset.name && m_Datasets[ datasets[j] ].association == dataset.association;
+		}
+		if ( !found ) datasets.push_back( i );
+	}
+	std::reverse( datasets.begin(), datasets.end() );
+	
+	const GeometryType &geometry = m_Geometries[ geometryIndex ];
+	const char *data = m_File.GetData();
+	vtkSmartPointer< vtkDoubleArray > pointValues = vtkSmartPointer< vtkDoubleArray >::New();
+	pointValues->SetNumberOfComponents( 3 );
+	pointValues->SetNumberOfTuples( geometry.nPoints );
+	std::memcpy( pointValues->GetPointer( 0 ), data + geometry.pointsOffset, 3*geometry.nPoints*sizeof(double) );
+	vtkSmartPointer< vtkPoints > points = vtkSmartPointer< vtkPoints >::New();
+	points->SetData( pointValues );
+	
+	vtkSmartPointer< vtkIdTypeArray > cellValues = vtkSmartPointer< vtkIdTypeArray >::New();
+	cellValues->SetNumberOfValues( geometry.nCellEntries );
+	const long long *cells = reinterpret_cast< const long long* >( data + geometry.cellsOffset );
+	for ( unsigned long long i = 0; i < geometry.nCellEntries; ++i ) cellValues->SetValue( i, cells[i] );
+	vtkSmartPointer< vtkCellArray > cellArray = vtkSmartPointer< vtkCellArray >::New();
+	cellArray->SetCells( geometry.nCells, cellValues );
+	std::vector< int > types( data + geometry.typesOffset, data + geometry.typesOffset + geometry.nCells );
+	
+	grid = vtkSmartPointer< vtkUnstructuredGrid >::New();
+	grid->SetPoints( points );
+	grid->SetCells( types.empty() ? 0 : &types[0], cellArray );
+	
+	for ( std::size_t i = 0; i < datasets.size(); ++i ){
+		const DatasetType &dataset = m_Datasets[ datasets[i] ];
+		vtkSmartPointer< vtkDataArray > array;
+		if ( dataset.dataType == VTK_DOUBLE ) array = vtkSmartPointer< vtkDoubleArray >::New();
+		else array = vtkSmartPointer< vtkFloatArray >::New();
+		array->SetName( dataset.name.c_str() );
+		array->SetNumberOfComponents( dataset.nComponents );
+		array->SetNumberOfTuples( dataset.nTuples );
+		std::memcpy( array->GetVoidPointer( 0 ), data + dataset.offset, dataset.nTuples*dataset.nComponents*GetTypeSize( dataset.dataType ) );
+		if ( dataset.association == 0 ) grid->GetPointData()->AddArray( array );
+		else grid->GetCellData()->AddArray( array );
+	}
+	return grid;
+}
+
+/** Write a stage to a VTK XML (.vtu) file for visualization.  Returns 
+ * false if the stage is not in the file or the file cannot be written. 
+ * see VTUWriter */
+bool ExportStage( const std::string &stage, const std::string &fileName, int compressionLevel )
+{
+	vtkSmartPointer< vtkUnstructuredGrid > grid = this->GetStageImage( stage );
+	if ( !grid ) return false;
+	VTUWriter writer;
+	writer.SetCompressionLevel( compressionLevel );
+	writer.SetNumberOfThreads( m_NumberOfThreads );
+	return writer.Write( fileName, grid );
+}
+
+private:
+
+enum { HeaderSize = 64, ByteOrder = 0x01020304, Version = 1 };
+
+static const char *GetMagic()
+{
+	return "DVCRSLT1";
+}
+
+static std::size_t GetTypeSize( unsigned int dataType )
+{
+	return dataType == VTK_DOUBLE ? sizeof(double) : sizeof(float);
+}
+
+// 64 bit FNV-1a hash
+static unsigned long long Hash( const void *data, std::size_t nBytes, unsigned long long hash )
+{
+	const unsigned char *bytes = static_cast< const unsigned char* >( data );
+	for ( std::size_t i = 0; i < nBytes; ++i ){
+		hash = ( hash ^ bytes[i] )*1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool SameGeometry( const GeometryType &a, const GeometryType &b )
+{
+	return a.nPoints == b.nPoints && a.nCells == b.nCells && a.nCellEntries == b.nCellEntries && a.hash == b.hash;
+}
+
+/** Write the header pointing at the index. */
+static void WriteHeader( std::fstream &output, unsigned long long indexOffset, unsigned long long indexSize )
+{
+	char header[ HeaderSize ];
+	std::memset( header, 0, HeaderSize );
+	std::memcpy( header, GetMagic(), 8 );
+	unsigned int byteOrder = ByteOrder, version = Version;
+	std::memcpy( header + 8, &byteOrder, 4 );
+	std::memcpy( header + 12, &version, 4 );
+	std::memcpy( header + 16, &indexOffset, 8 );
+	std::memcpy( header + 24, &indexSize, 8 );
+	output.seekp( 0 );
+	output.write( header, HeaderSize );
+}
+
+/** Write a block at the next 8 byte boundary and return its offset. */
+static unsigned long long WriteBlock( std::fstream &output, const void *data, std::size_t nBytes )
+{
+	unsigned long long offset = output.tellp();
+	const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	output.write( padding, ( 8 - offset%8 )%8 );
+	offset = output.tellp();
+	if ( nBytes > 0 ) output.write( static_cast< const char* >( data ), nBytes );
+	return offset;
+}
+
+/** Write every array of the point or cell data as a dataset, double 
+ * and float arrays as they are and the others as double. */
+void AppendDatasets( std::fstream &output, const std::string &stage, unsigned int geometry, unsigned int association, vtkDataSetAttributes *data )
+{
+	for ( int i = 0; i < data->GetNumberOfArrays(); ++i ){
+		vtkDataArray *array = data->GetArray( i );
+		if ( !array || !array->GetName() ) continue;
+		DatasetType dataset;
+		dataset.geometry = geometry;
+		dataset.association = association;
+		dataset.nComponents = array->GetNumberOfComponents();
+		dataset.nTuples = array->GetNumberOfTuples();
+		dataset.stage = stage;
+		dataset.name = array->GetName();
+		std::size_t nValues = dataset.nTuples*dataset.nComponents;
+		if ( array->GetDataType() == VTK_DOUBLE || array->GetDataType() == VTK_FLOAT ){
+			dataset.dataType = array->GetDataType();
+			dataset.offset = WriteBlock( output, array->GetVoidPointer( 0 ), nValues*GetTypeSize( dataset.dataType ) );
+		}
+		else{
+			dataset.dataType = VTK_DOUBLE;
+			std::vector< double > values( nValues );
+			for ( vtkIdType j = 0; j < array->GetNumberOfTuples(); ++j ) array->GetTuple( j, &values[ j*dataset.nComponents ] );
+			dataset.offset = WriteBlock( output, values.empty() ? 0 : &values[0], nValues*sizeof(double) );
+		}
+		m_Datasets.push_back( dataset );
+	}
+}
+
+template< class TValue >
+static void Put( std::string &buffer, const TValue &value )
+{
+	buffer.append( reinterpret_cast< const char* >( &value ), sizeof(TValue) );
+}
+
+static void Put( std::string &buffer, const std::string &value )
+{
+	Put( buffer, (unsigned int)value.size() );
+	buffer.append( value );
+}
+
+template< class TValue >
+static bool Get( const char *&position, const char *end, TValue &value )
+{
+	if ( end - position < (long)sizeof(TValue) ) return false;
+	std::memcpy( &value, position, sizeof(TValue) );
+	position = position + sizeof(TValue);
+	return true;
+}
+
+static bool Get( const char *&position, const char *end, std::string &value )
+{
+	unsigned int size;
+	if ( !Get( position, end, size ) || end - position < (long)size ) return false;
+	value.assign( position, size );
+	position = position + size;
+	return true;
+}
+
+std::string GetIndex() const
+{
+	std::string index;
+	Put( index, (unsigned long long)m_Geometries.size() );
+	for ( std::size_t i = 0; i < m_Geometries.size(); ++i ){
+		const GeometryType &geometry = m_Geometries[i];
+		Put( index, geometry.nPoints );
+		Put( index, geometry.nCells );
+		Put( index, geometry.nCellEntries );
+		Put( index, geometry.pointsOffset );
+		Put( index, geometry.cellsOffset );
+		Put( index, geometry.typesOffset );
+		Put( index, geometry.hash );
+	}
+	Put( index, (unsigned long long)m_Datasets.size() );
+	for ( std::size_t i = 0; i < m_Datasets.size(); ++i ){
+		const DatasetType &dataset = m_Datasets[i];
+		Put( index, dataset.geometry );
+		Put( index, dataset.association );
+		Put( index, dataset.dataType );
+		Put( index, dataset.nComponents );
+		Put( index, dataset.nTuples );
+		Put( index, dataset.offset );
+		Put( index, dataset.stage );
+		Put( index, dataset.name );
+	}
+	return index;
+}
+
+MappedFile					m_File;
+unsigned long long			m_IndexOffset;
+std::vector< GeometryType >	m_Geometries;
+std::vector< DatasetType >	m_Datasets;
+unsigned int				m_NumberOfThreads;
+
+}; // end class ResultsContainer
+
+#endif // RESULTSCONTAINER_H
@@ -0,0 +1,295 @@
+//      SliceStackReader.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+
+#ifndef SLICESTACKREADER_H
+#define SLICESTACKREADER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+#include "itkImage.h"
+#include "itk_tiff.h"
+
+/** A class to read a volume stored as a series of 2D slices, TIFF 
+ * files or raw files of the pixel type with no header, into one 
+ * preallocated image.  The slices are decoded in parallel, each 
+ * straight into its place in the image buffer.  If crop bounds are set
+ * only the slices, rows and columns inside them are read; the origin 
+ * of the image is moved to the first voxel read so every voxel keeps 
+ * its physical position.
+ * 
+ * The TIFF slices must have one sample per pixel of 8, 16 or 32 bits 
+ * and be stored in strips, with any compression; the samples are cast
+ * to the pixel type. */
+template< typename TImage >
+class SliceStackReader
+{
+public:
+
+typedef				TImage							ImageType;
+typedef	typename	ImageType::Pointer				ImagePointer;
+typedef	typename	ImageType::PixelType			PixelType;
+
+/** Constructor **/
+SliceStackReader()
+{
+	for ( unsigned int i = 0; i < 3; ++i ){
+		m_Spacing[i] = 1;
+		m_Origin[i] = 0;
+	}
+	m_RawSliceSize[0] = m_RawSliceSize[1] = 0;
+	m_Crop = false;
+	m_NumberOfThreads = 1;
+}
+
+/** Destructor **/
+~SliceStackReader() {}
+
+/** Set the slice files in slice order. */
+void SetFileNames( const std::vector< std::string > &fileNames )
+{
+	m_FileNames = fileNames;
+}
+
+/** Set the voxel spacing, which the slices do not hold. */
+void SetSpacing( const double spacing[3] )
+{
+	for ( unsigned int i = 0; i < 3; ++i ) m_Spacing[i] = spacing[i];
+}
+
+/** Set the position of the first voxel of the first slice. */
+void SetOrigin( const double origin[3] )
+{
+	for ( unsigned int i = 0; i < 3; ++i ) m_Origin[i] = origin[i];
+}
+
+/** Set the width and height of raw slices. */
+void SetRawSliceSize( unsigned long width, unsigned long height )
+{
+	m_RawSliceSize[0] = width;
+	m_RawSliceSize[1] = height;
+}
+
+/** Only read the voxels inside the bounds (xmin, xmax, ymin, ymax, 
+ * zmin, zmax) in physical units. */
+void SetCropBounds( const double bounds[6] )
+{
+	for ( unsigned int i = 0; i < 6; ++i ) m_CropBounds[i] = bounds[i];
+	m_Crop = true;
+}
+
+/** Set the number of slices decoded at once. */
+void SetNumberOfThreads( unsigned int nThreads )
+{
+	m_NumberOfThreads = nThreads > 0 ? nThreads : 1;
+}
+
+/** Read the slices.  Returns false with the reason in GetMessage() if 
+ * a slice cannot be read. */
+bool Read()
+{
+	m_Image = 0;
+	m_Message.clear();
+	if ( m_FileNames.empty() ){
+		m_Message = "No slice files.";
+		return false;
+	}
+	
+	// the size of every slice is the size of the first
+	unsigned long sliceSize[3] = {m_RawSliceSize[0], m_RawSliceSize[1], m_FileNames.size()};
+	if ( !IsRaw( m_FileNames[0] ) ){
+		TIFFSetWarningHandler( 0 );
+		TIFF *tiff = TIFFOpen( m_FileNames[0].c_str(), "r" );
+		if ( !tiff ){
+			m_Message = "Cannot open the slice "+m_FileNames[0]+".";
+			return false;
+		}
+		uint32 width = 0, height = 0;
+		TIFFGetField( tiff, TIFFTAG_IMAGEWIDTH, &width );
+		TIFFGetField( tiff, TIFFTAG_IMAGELENGTH, &height );
+		TIFFClose( tiff );
+		sliceSize[0] = width;
+		sliceSize[1] = height;
+	}
+	if ( !sliceSize[0] || !sliceSize[1] ){
+		m_Message = "The size of the slices is not known.";
+		return false;
+	}
+	
+	// the voxels to read
+	long start[3], end[3];
+	for ( unsigned int i = 0; i < 3; ++i ){
+		start[i] = 0;
+		end[i] = sliceSize[i];
+		if ( m_Crop ){
+			start[i] = std::max( start[i], (long)std::floor( ( m_CropBounds[2*i] - m_Origin[i] )/m_Spacing[i] ) );
+			end[i] = std::min( end[i], (long)std::ceil( ( m_CropBounds[2*i+1] - m_Origin[i] )/m_Spacing[i] ) + 1 );
+		}
+		if ( end[i] <= start[i] ){
+			m_Message = "The crop bounds are outside the slices.";
+			return false;
+		}
+	}
+	
+	typename ImageType::RegionType region;
+	typename ImageType::SpacingType spacing;
+	typename ImageType::PointType origin;
+	for ( unsigned int i = 0; i < 3; ++i ){
+		region.SetIndex( i, 0 );
+		region.SetSize( i, end[i] - start[i] );
+		spacing[i] = m_Spacing[i];
+		origin[i] = m_Origin[i] + start[i]*m_Spacing[i];
+	}
+	ImagePointer image = ImageType::New();
+	image->SetRegions( region );
+	image->SetSpacing( spacing );
+	image->SetOrigin( origin );
+	image->Allocate();
+	PixelType *buffer = image->GetBufferPointer();
+	
+	const std::size_t rowSize = end[0] - start[0];
+	const std::size_t imageSliceSize = rowSize*( end[1] - start[1] );
+	long nSlices = end[2] - start[2];
+	std::vector< std::string > errors( nSlices );
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(dynamic, 1)
+	for ( long z = 0; z < nSlices; ++z ){
+		const std::string &fileName = m_FileNames[ start[2] + z ];
+		PixelType *slice = buffer + z*imageSliceSize;
+		if ( IsRaw( fileName ) ) errors[z] = ReadRawSlice( fileName, sliceSize, start, end, slice );
+		else errors[z] = ReadTIFFSlice( fileName, sliceSize, start, end, slice );
+	}
+	for ( long z = 0; z < nSlices; ++z ){
+		if ( !errors[z].empty() ){
+			m_Message = errors[z];
+			return false;
+		}
+	}
+	m_Image = image;
+	return true;
+}
+
+/** Get the image read. */
+ImagePointer GetOutput()
+{
+	return m_Image;
+}
+
+/** Get the reason the slices could not be read. */
+std::string GetMessage() const
+{
+	return m_Message;
+}
+
+private:
+
+static bool IsRaw( const std::string &fileName )
+{
+	return fileName.size() > 4 && !fileName.compare( fileName.size() - 4, 4, ".raw" );
+}
+
+/** Read the rows and columns of a raw slice between start and end. */
+static std::string ReadRawSlice( const std::string &fileName, const unsigned long sliceSize[3], const long start[3], const long end[3], PixelType *slice )
+{
+	std::ifstream input( fileName.c_str(), std::ios::in | std::ios::binary );
+	if ( !input ) return "Cannot open the slice "+fileName+".";
+	input.seekg( 0, std::ios::end );
+	if ( (std::size_t)input.tellg() < sliceSize[0]*sliceSize[1]*sizeof(PixelType) ) return "The slice "+fileName+" is too short.";
+	
+	const std::size_t rowSize = end[0] - start[0];
+	for ( long y = start[1]; y < end[1]; ++y ){
+		input.seekg( ( y*sliceSize[0] + start[0] )*sizeof(PixelType) );
+		input.read( reinterpret_cast< char* >( slice + ( y - start[1] )*rowSize ), rowSize*sizeof(PixelType) );
+	}
+	if ( !input ) return "Cannot read the slice "+fileName+".";
+	return "";
+}
+
+/** Cast the columns between start and end of a row of samples. */
+template< typename TSample >
+static void CopyRow( const void *row, long start, long end, PixelType *pixels )
+{
+	const TSample *samples = static_cast< const TSample* >( row );
+	for ( long x = start; x < end; ++x ) pixels[ x - start ] = static_cast< PixelType >( samples[x] );
+}
+
+/** Decode the rows of a TIFF slice up to the end row and keep the 
+ * rows and columns between start and end. */
+static std::string ReadTIFFSlice( const std::string &fileName, const unsigned long sliceSize[3], const long start[3], const long end[3], PixelType *slice )
+{
+	TIFF *tiff = TIFFOpen( fileName.c_str(), "r" );
+	if ( !tiff ) return "Cannot open the slice "+fileName+".";
+	
+	uint32 width = 0, height = 0;
+	uint16 samplesPerPixel = 1, bitsPerSample = 8, sampleFormat = SAMPLEFORMAT_UINT;
+	TIFFGetField( tiff, TIFFTAG_IMAGEWIDTH, &width );
+	TIFFGetField( tiff, TIFFTAG_IMAGELENGTH, &height );
+	TIFFGetFieldDefaulted( tiff, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel );
+	TIFFGetFieldDefaulted( tiff, TIFFTAG_BITSPERSAMPLE, &bitsPerSample );
+	TIFFGetFieldDefaulted( tiff, TIFFTAG_SAMPLEFORMAT, &sampleFormat );
+	std::string error;
+	if ( width != sliceSize[0] || height != sliceSize[1] ) error = "The slice "+fileName+" is not the size of the first slice.";
+	else if ( samplesPerPixel != 1 || ( bitsPerSample != 8 && bitsPerSample != 16 && bitsPerSample != 32 ) ) error = "The slice "+fileName+" is not a single 8, 16 or 32 bit channel.";
+	else if ( TIFFIsTiled( tiff ) ) error = "The slice "+fileName+" is tiled.";
+	if ( !error.empty() ){
+		TIFFClose( tiff );
+		return error;
+	}
+	
+	std::vector< char > row( TIFFScanlineSize( tiff ) );
+	const std::size_t rowSize = end[0] - start[0];
+	for ( long y = 0; y < end[1] && error.empty(); ++y ){
+		// the rows before the start are decoded, a compressed strip can't be entered in the middle
+		if ( TIFFReadScanline( tiff, &row[0], y ) < 0 ) {error = "Cannot read the slice "+fileName+"."; break;}
+		if ( y < start[1] ) continue;
+		PixelType *pixels = slice + ( y - start[1] )*rowSize;
+		if ( bitsPerSample == 8 ){
+			if ( sampleFormat == SAMPLEFORMAT_INT ) CopyRow< signed char >( &row[0], start[0], end[0], pixels );
+			else CopyRow< unsigned char >( &row[0], start[0], end[0], pixels );
+		}
+		else if ( bitsPerSample == 16 ){
+			if ( sampleFormat == SAMPLEFORMAT_INT ) CopyRow< short >( &row[0], start[0], end[0], pixels );
+			else CopyRow< unsigned short >( &row[0], start[0], end[0], pixels );
+		}
+		else{
+			if ( sampleFormat == SAMPLEFORMAT_IEEEFP ) CopyRow< float >( &row[0], start[0], end[0], pixels );
+			else if ( sampleFormat == SAMPLEFORMAT_INT ) CopyRow< int >( &row[0], start[0], end[0], pixels );
+			else CopyRow< unsigned int >( &row[0], start[0], end[0], pixels );
+		}
+	}
+	TIFFClose( tiff );
+	return error;
+}
+
+std::vector< std::string >	m_FileNames;
+double						m_Spacing[3];
+double						m_Origin[3];
+unsigned long				m_RawSliceSize[2];
+double						m_CropBounds[6];
+bool						m_Crop;
+unsigned int				m_NumberOfThreads;
+ImagePointer				m_Image;
+std::string					m_Message;
+
+}; // end class SliceStackReader
+
+#endif // SLICESTACKREADER_H
@@ -0,0 +1,158 @@
+//      SparseWeightMatrix.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef SPARSEWEIGHTMATRIX_H
+#define SPARSEWEIGHTMATRIX_H
+
+#include <vector>
+#include <cmath>
+#include "MeshNeighbourhood.cxx"
+
+/** A sparse matrix, in compressed sparse row form, holding the weights
+ * used by the weighted moving average filters.  Row i holds the weights
+ * of node i and its neighbours, normalized to sum to one, so applying
+ * the filter to a field is a single sparse matrix-vector product.  The
+ * weights only depend on the mesh geometry and the kernel parameters so
+ * a matrix can be reused for any field and any number of passes. */
+class SparseWeightMatrix
+{
+public:
+
+typedef MeshNeighbourhood::NodeIdType	NodeIdType;
+typedef MeshNeighbourhood::OffsetType	OffsetType;
+
+/** Constructor **/
+SparseWeightMatrix()
+{
+	m_Offsets.assign( 1, 0 );
+}
+
+/** Destructor **/
+~SparseWeightMatrix() {}
+
+/** Fill the matrix with the Gaussian weights of each node and its
+ * neighbours.  points holds the x,y,z location of every node. The
+ * weight of node j in the average at node i is
+ * 1/(sqrt(2*pi)*sigma)*e^(-(d_ij-mean)^2/(2*sigma^2)) (the Gaussian
+ * distribution), where d_ij is the distance between the nodes.  The
+ * weights in each row are divided by their sum.  sigma must not be 0. */
+void BuildGaussian( const MeshNeighbourhood &neighbourhood, const double *points, double sigma, double mean, unsigned int nThreads )
+{
+	NodeIdType nNodes = neighbourhood.GetNumberOfNodes();
+	
+	// every row holds the neighbours and the node itself, the node is stored last
+	m_Offsets.resize( nNodes + 1 );
+	m_Offsets[0] = 0;
+	for ( NodeIdType i = 0; i < nNodes; ++i ){
+		m_Offsets[i+1] = m_Offsets[i] + neighbourhood.GetNumberOfNeighbours( i ) + 1;
+	}
+	m_Columns.resize( m_Offsets[nNodes] );
+	m_Weights.resize( m_Offsets[nNodes] );
+	
+	const double exponentScale = -1/(2*sigma*sigma);
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long i = 0; i < (long)nNodes; ++i ){
+		const NodeIdType *neighbours = neighbourhood.GetNeighbours( i );
+		NodeIdType nNeighbours = neighbourhood.GetNumberOfNeighbours( i );
+		const double *rPoint = points + 3*i; // reference point location
+		OffsetType rowStart = m_Offsets[i];
+		
+		double totalWeight = 0;
+		for ( NodeIdType j = 0; j <= nNeighbours; ++j ){
+			NodeIdType cId = j == nNeighbours ? (NodeIdType)i : neighbours[j]; // include the reference point at the very end
+			const double *cPoint = points + 3*cId;
+			
+			double dx = cPoint[0] - rPoint[0];
+			double dy = cPoint[1] - rPoint[1];
+			double dz = cPoint[2] - rPoint[2];
+			double offset = std::sqrt( dx*dx + dy*dy + dz*dz ) - mean;
+			double weight = std::exp( exponentScale*offset*offset ); // the 1/(sqrt(2*pi)*sigma) factor cancels in the normalization
+			
+			m_Columns[rowStart+j] = cId;
+			m_Weights[rowStart+j] = weight;
+			totalWeight = totalWeight + weight;
+		}
+		for ( NodeIdType j = 0; j <= nNeighbours; ++j ){
+			m_Weights[rowStart+j] = m_Weights[rowStart+j] / totalWeight;
+		}
+	}
+}
+
+/** Multiply the matrix by a field with nComponents values per node.
+ * input and output must hold nComponents*GetNumberOfRows() values and
+ * must not overlap. */
+template< typename TValue >
+void Multiply( const TValue *input, TValue *output, unsigned int nComponents, unsigned int nThreads ) const
+{
+	long nRows = (long)this->GetNumberOfRows();
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long i = 0; i < nRows; ++i ){
+		this->MultiplyRow( (NodeIdType)i, input, output + nComponents*i, nComponents );
+	}
+}
+
+/** Multiply a single row of the matrix by a field with nComponents
+ * values per node.  The nComponents results are put in output. */
+template< typename TValue >
+void MultiplyRow( NodeIdType row, const TValue *input, TValue *output, unsigned int nComponents ) const
+{
+	double total[9] = { 0 };
+	double *sum = total;
+	std::vector< double > longTotal;
+	if ( nComponents > 9 ){
+		longTotal.assign( nComponents, 0 );
+		sum = &longTotal[0];
+	}
+	
+	for ( OffsetType k = m_Offsets[row]; k < m_Offsets[row+1]; ++k ){
+		const TValue *value = input + nComponents*m_Columns[k];
+		double weight = m_Weights[k];
+		for ( unsigned int c = 0; c < nComponents; ++c ){
+			sum[c] = sum[c] + weight*value[c];
+		}
+	}
+	for ( unsigned int c = 0; c < nComponents; ++c ){
+		output[c] = (TValue)sum[c];
+	}
+}
+
+/** Get the number of rows in the matrix. */
+NodeIdType GetNumberOfRows() const
+{
+	return (NodeIdType)( m_Offsets.size() - 1 );
+}
+
+/** Returns true if the matrix has not been built. */
+bool IsEmpty() const
+{
+	return m_Offsets.size() < 2;
+}
+
+private:
+
+std::vector< OffsetType >	m_Offsets;
+std::vector< NodeIdType >	m_Columns;
+std::vector< double >		m_Weights;
+
+}; // end class SparseWeightMatrix
+
+#endif // SPARSEWEIGHTMATRIX_H
@@ -0,0 +1,261 @@
+//      StructuredGrid.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef STRUCTUREDGRID_H
+#define STRUCTUREDGRID_H
+
+#include <vector>
+#include <cmath>
+#include "MeshNeighbourhood.cxx"
+
+/** A class describing a regular lattice of nodes.  Node (i,j,k) has the
+ * id i + nx*(j + ny*k) and the location origin + spacing*(i,j,k), so 
+ * every field on the lattice is a dense 3D array.  The neighbours of a 
+ * node are the nodes one step away along each axis and the strain is
+ * calculated by finite differences (central inside the lattice, one
+ * sided on its faces).  The cells of the lattice are voxels with the
+ * vtk voxel node order.  The strains are stored as 6 values per tuple
+ * in the order xx, yy, zz, xy, yz, xz. */
+class StructuredGrid
+{
+public:
+
+typedef MeshNeighbourhood::NodeIdType	NodeIdType;
+
+/** Constructor **/
+StructuredGrid()
+{
+	this->Clear();
+}
+
+/** Destructor **/
+~StructuredGrid() {}
+
+/** Empty the lattice. */
+void Clear()
+{
+	for ( unsigned int d = 0; d < 3; ++d ){
+		m_Dimensions[d] = 0;
+		m_Origin[d] = 0;
+		m_Spacing[d] = 1;
+	}
+}
+
+/** Returns true if the lattice has no nodes. */
+bool IsEmpty() const
+{
+	return this->GetNumberOfNodes() == 0;
+}
+
+/** Set the lattice to cover the box bounds (xmin, xmax, ymin, ymax, 
+ * zmin, zmax) with the given node spacing.  The lattice is centred in
+ * the box. */
+void SetFromBounds( const double *bounds, double spacing )
+{
+	for ( unsigned int d = 0; d < 3; ++d ){
+		double length = bounds[2*d+1] - bounds[2*d];
+		m_Dimensions[d] = length > 0 ? (NodeIdType)( length/spacing ) + 1 : 1;
+		m_Spacing[d] = spacing;
+		m_Origin[d] = bounds[2*d] + 0.5*( length - ( m_Dimensions[d] - 1 )*spacing );
+	}
+}
+
+/** Set the lattice from the locations (3 values per node) of nodes in
+ * the lattice order, e.g. of a grid written to a result file and read
+ * again.  The lattice is left empty and false returned if the nodes
+ * are not a lattice.  The locations may have been rounded, so they
+ * must lie within a thousandth of the spacing of the lattice nodes. */
+bool SetFromNodes( const double *locations, NodeIdType nNodes )
+{
+	this->Clear();
+	if ( nNodes == 0 ) return false;
+	
+	// the nodes are in lines along x, then planes in y, then z
+	NodeIdType nx = 1, ny = 1;
+	while ( nx < nNodes && locations[3*nx+1] == locations[1] && locations[3*nx+2] == locations[2] ) ++nx;
+	while ( ny*nx < nNodes && locations[3*ny*nx+2] == locations[2] ) ++ny;
+	NodeIdType nz = nNodes/( nx*ny );
+	if ( nx*ny*nz != nNodes ) return false;
+	
+	const NodeIdType dims[3] = { nx, ny, nz };
+	const NodeIdType stride[3] = { 1, nx, nx*ny };
+	double origin[3], spacing[3];
+	for ( unsigned int d = 0; d < 3; ++d ){
+		origin[d] = locations[d];
+		spacing[d] = dims[d] > 1 ? locations[3*stride[d]+d] - origin[d] : 1;
+		if ( !( spacing[d] > 0 ) ) return false;
+	}
+	for ( NodeIdType id = 0; id < nNodes; ++id ){
+		const NodeIdType index[3] = { id % nx, ( id / nx ) % ny, id / ( nx*ny ) };
+		for ( unsigned int d = 0; d < 3; ++d ){
+			if ( std::fabs( locations[3*id+d] - origin[d] - index[d]*spacing[d] ) > 1e-3*spacing[d] ) return false;
+		}
+	}
+	
+	for ( unsigned int d = 0; d < 3; ++d ){
+		m_Dimensions[d] = dims[d];
+		m_Origin[d] = origin[d];
+		m_Spacing[d] = spacing[d];
+	}
+	return true;
+}
+
+/** Get the number of nodes along each axis. */
+const NodeIdType *GetDimensions() const
+{
+	return m_Dimensions;
+}
+
+/** Get the number of nodes. */
+NodeIdType GetNumberOfNodes() const
+{
+	return m_Dimensions[0]*m_Dimensions[1]*m_Dimensions[2];
+}
+
+/** Get the number of voxels. */
+NodeIdType GetNumberOfCells() const
+{
+	NodeIdType nCells = 1;
+	for ( unsigned int d = 0; d < 3; ++d ){
+		nCells = nCells*( m_Dimensions[d] > 1 ? m_Dimensions[d] - 1 : 0 );
+	}
+	return nCells;
+}
+
+/** Get the id of node (i,j,k). */
+NodeIdType GetNodeId( NodeIdType i, NodeIdType j, NodeIdType k ) const
+{
+	return i + m_Dimensions[0]*( j + m_Dimensions[1]*k );
+}
+
+/** Get the location of node (i,j,k). */
+void GetNodeLocation( NodeIdType i, NodeIdType j, NodeIdType k, double *location ) const
+{
+	location[0] = m_Origin[0] + i*m_Spacing[0];
+	location[1] = m_Origin[1] + j*m_Spacing[1];
+	location[2] = m_Origin[2] + k*m_Spacing[2];
+}
+
+/** Get the eight node ids of voxel (i,j,k) in the vtk voxel order. */
+void GetCellNodes( NodeIdType i, NodeIdType j, NodeIdType k, NodeIdType *nodes ) const
+{
+	for ( unsigned int n = 0; n < 8; ++n ){
+		nodes[n] = this->GetNodeId( i + ( n & 1 ), j + ( ( n >> 1 ) & 1 ), k + ( ( n >> 2 ) & 1 ) );
+	}
+}
+
+/** Build the neighbourhood of the nodes from the lattice stencil. */
+void BuildNeighbourhood( MeshNeighbourhood &neighbourhood ) const
+{
+	MeshNeighbourhood::NodePairListType pairs;
+	pairs.reserve( 3*this->GetNumberOfNodes() );
+	for ( NodeIdType k = 0; k < m_Dimensions[2]; ++k ){
+		for ( NodeIdType j = 0; j < m_Dimensions[1]; ++j ){
+			for ( NodeIdType i = 0; i < m_Dimensions[0]; ++i ){
+				NodeIdType id = this->GetNodeId( i, j, k );
+				if ( i + 1 < m_Dimensions[0] ) pairs.push_back( MeshNeighbourhood::NodePairType( id, this->GetNodeId( i+1, j, k ) ) );
+				if ( j + 1 < m_Dimensions[1] ) pairs.push_back( MeshNeighbourhood::NodePairType( id, this->GetNodeId( i, j+1, k ) ) );
+				if ( k + 1 < m_Dimensions[2] ) pairs.push_back( MeshNeighbourhood::NodePairType( id, this->GetNodeId( i, j, k+1 ) ) );
+			}
+		}
+	}
+	neighbourhood.Build( this->GetNumberOfNodes(), pairs );
+}
+
+/** Calculate the strain of every node from the displacements by finite
+ * differences.  pointStrains must hold 6 values per node.  The nodes
+ * of one line along x are contiguous, so every line is one pass over
+ * contiguous memory. */
+template< typename TValue >
+void CalculatePointStrains( const double *displacements, TValue *pointStrains, unsigned int nThreads ) const
+{
+	const long nx = m_Dimensions[0], ny = m_Dimensions[1], nz = m_Dimensions[2];
+	const long stride[3] = { 1, nx, nx*ny };
+	const long nLines = ny*nz;
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long line = 0; line < nLines; ++line ){
+		const long index[3] = { 0, line % ny, line / ny };
+		for ( long i = 0; i < nx; ++i ){
+			long position[3] = { i, index[1], index[2] };
+			long id = i + nx*line;
+			
+			double gradient[9]; // du_r/dx_c in row major order
+			for ( unsigned int c = 0; c < 3; ++c ){
+				long n = m_Dimensions[c];
+				if ( n < 2 ){
+					gradient[c] = gradient[3+c] = gradient[6+c] = 0;
+					continue;
+				}
+				long lower = position[c] > 0 ? -1 : 0;
+				long upper = position[c] < n - 1 ? 1 : 0;
+				const double *uLower = displacements + 3*( id + lower*stride[c] );
+				const double *uUpper = displacements + 3*( id + upper*stride[c] );
+				double scale = 1/( ( upper - lower )*m_Spacing[c] );
+				for ( unsigned int r = 0; r < 3; ++r ){
+					gradient[3*r+c] = ( uUpper[r] - uLower[r] )*scale;
+				}
+			}
+			
+			TValue *strain = pointStrains + 6*id;
+			strain[0] = (TValue)gradient[0];
+			strain[1] = (TValue)gradient[4];
+			strain[2] = (TValue)gradient[8];
+			strain[3] = (TValue)( 0.5*( gradient[1] + gradient[3] ) );
+			strain[4] = (TValue)( 0.5*( gradient[5] + gradient[7] ) );
+			strain[5] = (TValue)( 0.5*( gradient[2] + gradient[6] ) );
+		}
+	}
+}
+
+/** Calculate the strain of every voxel as the average of the strains of
+ * its eight nodes.  cellStrains must hold 6 values per voxel. */
+template< typename TValue >
+void CalculateCellStrains( const TValue *pointStrains, TValue *cellStrains, unsigned int nThreads ) const
+{
+	if ( this->GetNumberOfCells() == 0 ) return;
+	const long cx = m_Dimensions[0] - 1, cy = m_Dimensions[1] - 1, cz = m_Dimensions[2] - 1;
+	const long nCells = cx*cy*cz;
+	
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for ( long c = 0; c < nCells; ++c ){
+		NodeIdType nodes[8];
+		this->GetCellNodes( c % cx, ( c / cx ) % cy, c / ( cx*cy ), nodes );
+		double total[6] = { 0 };
+		for ( unsigned int n = 0; n < 8; ++n ){
+			for ( unsigned int k = 0; k < 6; ++k ){
+				total[k] = total[k] + pointStrains[ 6*nodes[n] + k ];
+			}
+		}
+		for ( unsigned int k = 0; k < 6; ++k ){
+			cellStrains[6*c+k] = (TValue)( total[k]/8 );
+		}
+	}
+}
+
+private:
+
+NodeIdType	m_Dimensions[3];
+double		m_Origin[3];
+double		m_Spacing[3];
+
+}; // end class StructuredGrid
+
+#endif // STRUCTUREDGRID_H
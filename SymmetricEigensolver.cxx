@@ -0,0 +1,180 @@
+//      SymmetricEigensolver.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef SYMMETRICEIGENSOLVER_H
+#define SYMMETRICEIGENSOLVER_H
+
+#include <cmath>
+#include <algorithm>
+#include <vtkMath.h>
+
+/** A class to find the eigenvalues and eigenvectors of a symmetric 3x3
+ * matrix (eg. a strain tensor) in closed form.  The eigenvalues are the
+ * roots of the characteristic cubic, found with the trigonometric 
+ * method of Smith (1961).  The eigenvector of an eigenvalue that is 
+ * well separated from the others is the largest cross product of two
+ * rows of A-lambda*I.  When an eigenvalue is repeated any orthonormal
+ * vectors in its eigenspace are returned.  If the closed form fails 
+ * (eg. the matrix holds a NaN) vtkMath::Jacobi is used instead.  The 
+ * method only uses its arguments so it is safe to call from many 
+ * threads at once. */
+class SymmetricEigensolver
+{
+public:
+
+/** Find the eigenvalues and eigenvectors of the symmetric matrix A,
+ * given as 9 values in row major order (only the upper triangle is
+ * used).  The eigenvalues are put in values in decreasing order and 
+ * the unit eigenvector of values[i] is put in vectors[3*i] to
+ * vectors[3*i+2]. */
+static void Compute( const double *A, double *values, double *vectors )
+{
+	const double a00 = A[0], a01 = A[1], a02 = A[2], a11 = A[4], a12 = A[5], a22 = A[8];
+	
+	const double offDiagonal = a01*a01 + a02*a02 + a12*a12;
+	if ( offDiagonal == 0 ){ // the matrix is diagonal
+		double diagonal[3] = { a00, a11, a22 };
+		int order[3] = { 0, 1, 2 };
+		if ( diagonal[order[0]] < diagonal[order[1]] ) std::swap( order[0], order[1] );
+		if ( diagonal[order[1]] < diagonal[order[2]] ) std::swap( order[1], order[2] );
+		if ( diagonal[order[0]] < diagonal[order[1]] ) std::swap( order[0], order[1] );
+		for ( int i = 0; i < 3; ++i ){
+			values[i] = diagonal[order[i]];
+			vectors[3*i] = vectors[3*i+1] = vectors[3*i+2] = 0;
+			vectors[3*i+order[i]] = 1;
+		}
+		return;
+	}
+	
+	// shift and scale the matrix so the eigenvalues are 2*cos of the angles below
+	const double q = ( a00 + a11 + a22 )/3;
+	const double b00 = a00 - q, b11 = a11 - q, b22 = a22 - q;
+	const double p = std::sqrt( ( b00*b00 + b11*b11 + b22*b22 + 2*offDiagonal )/6 );
+	const double determinant = b00*( b11*b22 - a12*a12 ) - a01*( a01*b22 - a12*a02 ) + a02*( a01*a12 - b11*a02 );
+	double r = determinant/( 2*p*p*p );
+	r = r < -1 ? -1 : ( r > 1 ? 1 : r );
+	const double phi = std::acos( r )/3;
+	const double twoThirdsPi = 2.0943951023931954923;
+	
+	values[0] = q + 2*p*std::cos( phi );
+	values[2] = q + 2*p*std::cos( phi + twoThirdsPi );
+	values[1] = 3*q - values[0] - values[2];
+	
+	// values[0]-values[2] is at least 3p so one of the end eigenvalues is separated by at least 1.5p
+	const double separation = 1e-6*p;
+	int isolated = ( values[0] - values[1] >= values[1] - values[2] ) ? 0 : 2;
+	int other = 2 - isolated;
+	bool otherIsolated = std::fabs( values[other] - values[1] ) > separation;
+	
+	if ( !( p > 0 ) || !SymmetricEigensolver::CalculateEigenvector( A, values[isolated], vectors + 3*isolated ) ){
+		SymmetricEigensolver::ComputeJacobi( A, values, vectors );
+		return;
+	}
+	
+	// the second eigenvector must be perpendicular to the first
+	double *v = vectors + 3*other;
+	const double *u = vectors + 3*isolated;
+	if ( !otherIsolated || !SymmetricEigensolver::CalculateEigenvector( A, values[other], v ) ){
+		// any unit vector perpendicular to u, built from the axis least aligned with u
+		double axis[3] = { 0, 0, 0 };
+		int k = std::fabs( u[0] ) < std::fabs( u[1] ) ? 0 : 1;
+		k = std::fabs( u[k] ) < std::fabs( u[2] ) ? k : 2;
+		axis[k] = 1;
+		SymmetricEigensolver::Cross( u, axis, v );
+	}
+	double projection = v[0]*u[0] + v[1]*u[1] + v[2]*u[2];
+	for ( int k = 0; k < 3; ++k ) v[k] = v[k] - projection*u[k];
+	if ( !SymmetricEigensolver::Normalize( v ) ){
+		SymmetricEigensolver::ComputeJacobi( A, values, vectors );
+		return;
+	}
+	
+	// the middle eigenvector completes the right handed set
+	SymmetricEigensolver::Cross( vectors + 6, vectors, vectors + 3 );
+}
+
+private:
+
+/** Find the eigenvector of A for the eigenvalue value as the largest
+ * cross product of the rows of A-value*I.  Returns false if every
+ * cross product vanishes. */
+static bool CalculateEigenvector( const double *A, double value, double *vector )
+{
+	const double r0[3] = { A[0] - value, A[1], A[2] };
+	const double r1[3] = { A[1], A[4] - value, A[5] };
+	const double r2[3] = { A[2], A[5], A[8] - value };
+	double c01[3], c02[3], c12[3];
+	SymmetricEigensolver::Cross( r0, r1, c01 );
+	SymmetricEigensolver::Cross( r0, r2, c02 );
+	SymmetricEigensolver::Cross( r1, r2, c12 );
+	double n01 = c01[0]*c01[0] + c01[1]*c01[1] + c01[2]*c01[2];
+	double n02 = c02[0]*c02[0] + c02[1]*c02[1] + c02[2]*c02[2];
+	double n12 = c12[0]*c12[0] + c12[1]*c12[1] + c12[2]*c12[2];
+	
+	const double *largest = c01;
+	double largestNorm = n01;
+	if ( n02 > largestNorm ){ largest = c02; largestNorm = n02; }
+	if ( n12 > largestNorm ){ largest = c12; largestNorm = n12; }
+	if ( !( largestNorm > 0 ) ) return false;
+	
+	double scale = 1/std::sqrt( largestNorm );
+	for ( int k = 0; k < 3; ++k ) vector[k] = largest[k]*scale;
+	return true;
+}
+
+/** Find the eigenvalues and eigenvectors with vtkMath::Jacobi. */
+static void ComputeJacobi( const double *A, double *values, double *vectors )
+{
+	double r0[3] = { A[0], A[1], A[2] };
+	double r1[3] = { A[1], A[4], A[5] };
+	double r2[3] = { A[2], A[5], A[8] };
+	double *matrix[3] = { r0, r1, r2 };
+	double c0[3], c1[3], c2[3];
+	double *columns[3] = { c0, c1, c2 };
+	vtkMath::Jacobi( matrix, values, columns );
+	
+	// vtkMath::Jacobi returns the eigenvectors as the columns
+	for ( int i = 0; i < 3; ++i ){
+		for ( int k = 0; k < 3; ++k ){
+			vectors[3*i+k] = columns[k][i];
+		}
+	}
+}
+
+/** c = a x b */
+static void Cross( const double *a, const double *b, double *c )
+{
+	c[0] = a[1]*b[2] - a[2]*b[1];
+	c[1] = a[2]*b[0] - a[0]*b[2];
+	c[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+/** Scale v to unit length.  Returns false if v has no length. */
+static bool Normalize( double *v )
+{
+	double norm = std::sqrt( v[0]*v[0] + v[1]*v[1] + v[2]*v[2] );
+	if ( !( norm > 0 ) ) return false;
+	v[0] = v[0]/norm; v[1] = v[1]/norm; v[2] = v[2]/norm;
+	return true;
+}
+
+}; // end class SymmetricEigensolver
+
+#endif // SYMMETRICEIGENSOLVER_H
@@ -0,0 +1,491 @@
+//      VTUWriter.cxx
+//      
+//      Copyright 2012 Seth Gilchrist <seth@mech.ubc.ca>
+//      
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+//      
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//      
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef VTUWRITER_H
+#define VTUWRITER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <vtk_zlib.h>
+#include <vtkType.h>
+#include <vtkUnstructuredGrid.h>
+#include <vtkPoints.h>
+#include <vtkCellArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkUnsignedCharArray.h>
+#include <vtkPointData.h>
+#include <vtkCellData.h>
+#include <vtkDataArray.h>
+
+/** A class to write an unstructured grid to a VTK XML (.vtu) file with
+ * the data in binary appended form.  The data can be compressed with
+ * zlib in the block format of vtkZLibDataCompressor; the blocks of all
+ * the arrays are compressed in parallel.  The file uses the version 0.1
+ * layout with 32 bit block headers so it can be read by VTK 5, which 
+ * limits an uncompressed array to 4 GB.  A grid can also be written as
+ * a partitioned (.pvtu) file of pieces written concurrently. */
+class VTUWriter
+{
+public:
+
+typedef vtkTypeUInt32	HeaderType;
+
+/** Constructor **/
+VTUWriter()
+{
+	m_CompressionLevel = 1;
+	m_BlockSize = 1 << 15;
+	m_NumberOfThreads = 1;
+}
+
+/** Destructor **/
+~VTUWriter() {}
+
+/** Set the zlib compression level, 0 for no compression and 1 (fastest) 
+ * to 9 (smallest). */
+void SetCompressionLevel( int level )
+{
+	m_CompressionLevel = level < 0 ? 0 : ( level > 9 ? 9 : level );
+}
+
+/** Set the number of threads used for the compression. */
+void SetNumberOfThreads( unsigned int nThreads )
+{
+	m_NumberOfThreads = nThreads > 0 ? nThreads : 1;
+}
+
+/** Write the grid with all of its point and cell arrays.  Returns false
+ * if the file cannot be written. */
+bool Write( const std::string &fileName, vtkUnstructuredGrid *grid )
+{
+	GridArraysType arrays;
+	this->GetGridArrays( grid, arrays );
+	return this->WriteArrays( fileName, grid->GetNumberOfPoints(), grid->GetNumberOfCells(), arrays );
+}
+
+/** Write the grid as nPieces .vtu files and a .pvtu file that indexes
+ * them.  The cells are sorted along the longest side of the grid and
+ * cut into slabs of equal size; every piece holds its cells and the 
+ * points they use.  The pieces are written concurrently, one thread 
+ * per piece, and are named after the .pvtu file with the piece number
+ * appended.  Returns false if a file cannot be written. */
+bool WritePieces( const std::string &fileName, vtkUnstructuredGrid *grid, unsigned int nPieces )
+{
+	GridArraysType arrays;
+	this->GetGridArrays( grid, arrays );
+	const vtkIdType nCells = grid->GetNumberOfCells();
+	nPieces = std::max( 1u, std::min( nPieces, (unsigned int)std::max( nCells, (vtkIdType)1 ) ) );
+	
+	// sort the cells by the location of their centres along the longest side
+	double bounds[6];
+	grid->GetBounds( bounds );
+	int axis = 0;
+	for ( int d = 1; d < 3; ++d ){
+		if ( bounds[2*d+1] - bounds[2*d] > bounds[2*axis+1] - bounds[2*axis] ) axis = d;
+	}
+	const vtkIdType *connectivity = reinterpret_cast< const vtkIdType* >( arrays.connectivity.GetData() );
+	const vtkIdType *offsets = reinterpret_cast< const vtkIdType* >( arrays.offsets.GetData() );
+	std::vector< std::pair< double, vtkIdType > > order( nCells );
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+	for ( long i = 0; i < nCells; ++i ){
+		vtkIdType start = i > 0 ? offsets[i-1] : 0;
+		double centre = 0;
+		for ( vtkIdType n = start; n < offsets[i]; ++n ){
+			double point[3];
+			grid->GetPoints()->GetPoint( connectivity[n], point );
+			centre = centre + point[axis];
+		}
+		order[i] = std::pair< double, vtkIdType >( offsets[i] > start ? centre/( offsets[i] - start ) : 0, i );
+	}
+	std::sort( order.begin(), order.end() );
+	
+	std::string baseName = fileName.substr( 0, fileName.rfind( '.' ) );
+	std::vector< std::string > pieceNames( nPieces );
+	long nFailed = 0;
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(dynamic, 1) reduction(+:nFailed)
+	for ( long piece = 0; piece < (long)nPieces; ++piece ){
+		std::vector< vtkIdType > cells;
+		for ( vtkIdType i = nCells*piece/nPieces; i < nCells*( piece + 1 )/nPieces; ++i ){
+			cells.push_back( order[i].second );
+		}
+		std::sort( cells.begin(), cells.end() );
+		
+		GridArraysType pieceArrays;
+		vtkIdType nPiecePoints = this->GetPieceArrays( arrays, cells, pieceArrays );
+		std::stringstream pieceName("");
+		pieceName << baseName << "_" << piece << ".vtu";
+		pieceNames[piece] = pieceName.str();
+		
+		VTUWriter pieceWriter; // the threads are used for the pieces
+		pieceWriter.SetCompressionLevel( m_CompressionLevel );
+		if ( !pieceWriter.WriteArrays( pieceNames[piece], nPiecePoints, cells.size(), pieceArrays ) ) ++nFailed;
+	}
+	if ( nFailed > 0 ) return false;
+	
+	std::ofstream output( fileName.c_str() );
+	if ( !output ) return false;
+	output << "<?xml version=\"1.0\"?>\n";
+	output << "<VTKFile type=\"PUnstructuredGrid\" version=\"0.1\" byte_order=\""<<( IsLittleEndian() ? "LittleEndian" : "BigEndian" )<<"\">\n";
+	output << "  <PUnstructuredGrid GhostLevel=\"0\">\n";
+	output << "    <PPointData>\n";
+	for ( std::size_t i = 0; i < arrays.pointArrays.size(); ++i ) this->WriteArrayHeader( output, arrays.pointArrays[i], 0 );
+	output << "    </PPointData>\n";
+	output << "    <PCellData>\n";
+	for ( std::size_t i = 0; i < arrays.cellArrays.size(); ++i ) this->WriteArrayHeader( output, arrays.cellArrays[i], 0 );
+	output << "    </PCellData>\n";
+	output << "    <PPoints>\n";
+	this->WriteArrayHeader( output, arrays.points, 0 );
+	output << "    </PPoints>\n";
+	for ( unsigned int piece = 0; piece < nPieces; ++piece ){
+		output << "    <Piece Source=\""<<pieceNames[piece].substr( pieceNames[piece].rfind( '/' ) + 1 )<<"\"/>\n";
+	}
+	output << "  </PUnstructuredGrid>\n";
+	output << "</VTKFile>\n";
+	return !output.fail();
+}
+
+private:
+
+// an array to write, either pointing at the data of a vtk array or owning a copy
+struct DataArrayType
+{
+	std::string				name;
+	std::string				type; // the VTK XML type name
+	int						nComponents;
+	std::size_t				tupleBytes;
+	const char				*data;
+	std::size_t				nBytes;
+	std::vector< char >		ownedData;
+	std::vector< char >		encoded; // the block header and the (compressed) blocks
+	
+	const char *GetData() const
+	{
+		return ownedData.empty() ? data : &ownedData[0];
+	}
+};
+
+// the arrays of a grid or of a piece of it
+struct GridArraysType
+{
+	std::vector< DataArrayType >	pointArrays;
+	std::vector< DataArrayType >	cellArrays;
+	DataArrayType					points;
+	DataArrayType					connectivity; // the point ids of all the cells
+	DataArrayType					offsets; // the end of every cell in the connectivity
+	DataArrayType					types;
+};
+
+static bool IsLittleEndian()
+{
+	const unsigned short one = 1;
+	return *reinterpret_cast< const unsigned char* >( &one ) == 1;
+}
+
+/** The VTK XML name of a vtk data type, empty if it is not written. */
+static std::string GetTypeName( int dataType, int dataTypeSize )
+{
+	std::stringstream name("");
+	switch ( dataType ){
+		case VTK_FLOAT:
+		case VTK_DOUBLE:
+			name << "Float"<<8*dataTypeSize;
+			break;
+		case VTK_CHAR:
+		case VTK_SIGNED_CHAR:
+		case VTK_SHORT:
+		case VTK_INT:
+		case VTK_LONG:
+		case VTK_LONG_LONG:
+		case VTK_ID_TYPE:
+			name << "Int"<<8*dataTypeSize;
+			break;
+		case VTK_UNSIGNED_CHAR:
+		case VTK_UNSIGNED_SHORT:
+		case VTK_UNSIGNED_INT:
+		case VTK_UNSIGNED_LONG:
+		case VTK_UNSIGNED_LONG_LONG:
+			name << "UInt"<<8*dataTypeSize;
+			break;
+	}
+	return name.str();
+}
+
+/** Point the array at the values of a vtk data array. */
+void SetFromDataArray( DataArrayType &array, vtkDataArray *dataArray )
+{
+	array.name = dataArray->GetName() ? dataArray->GetName() : "";
+	array.type = GetTypeName( dataArray->GetDataType(), dataArray->GetDataTypeSize() );
+	array.nComponents = dataArray->GetNumberOfComponents();
+	array.tupleBytes = (std::size_t)array.nComponents*dataArray->GetDataTypeSize();
+	array.data = static_cast< const char* >( dataArray->GetVoidPointer( 0 ) );
+	array.nBytes = (std::size_t)dataArray->GetNumberOfTuples()*array.tupleBytes;
+}
+
+/** Allocate the array to hold nValues values of type TValue, the vtk
+ * data type dataType. */
+template< typename TValue >
+TValue *Allocate( DataArrayType &array, vtkIdType nValues, const std::string &name, int nComponents, int dataType )
+{
+	array.name = name;
+	array.type = GetTypeName( dataType, sizeof(TValue) );
+	array.nComponents = nComponents;
+	array.tupleBytes = nComponents*sizeof(TValue);
+	array.ownedData.resize( nValues*sizeof(TValue) );
+	array.data = 0;
+	array.nBytes = array.ownedData.size();
+	return reinterpret_cast< TValue* >( array.ownedData.empty() ? 0 : &array.ownedData[0] );
+}
+
+/** Add the named arrays of a point or cell data set with a known type. */
+void AddAttributeArrays( vtkDataSetAttributes *data, std::vector< DataArrayType > &arrays )
+{
+	for ( int i = 0; i < data->GetNumberOfArrays(); ++i ){
+		vtkDataArray *dataArray = data->GetArray( i );
+		if ( !dataArray || !dataArray->GetName() ) continue;
+		DataArrayType array;
+		this->SetFromDataArray( array, dataArray );
+		if ( array.type.empty() ) continue;
+		arrays.push_back( array );
+	}
+}
+
+/** Get the arrays of the grid.  The point and cell arrays and the 
+ * points point at the grid data; the connectivity and offsets are 
+ * built from the legacy cell array. */
+void GetGridArrays( vtkUnstructuredGrid *grid, GridArraysType &arrays )
+{
+	this->AddAttributeArrays( grid->GetPointData(), arrays.pointArrays );
+	this->AddAttributeArrays( grid->GetCellData(), arrays.cellArrays );
+	
+	// the points are written in their own precision
+	this->SetFromDataArray( arrays.points, grid->GetPoints()->GetData() );
+	arrays.points.name = "Points";
+	
+	vtkIdType nCells = grid->GetNumberOfCells();
+	if ( nCells > 0 ) this->SetFromDataArray( arrays.types, grid->GetCellTypesArray() );
+	else this->Allocate< unsigned char >( arrays.types, 0, "", 1, VTK_UNSIGNED_CHAR );
+	arrays.types.name = "types";
+	
+	// the legacy cell array holds the number of points before the point ids of every cell
+	vtkIdType *connectivityValues = this->Allocate< vtkIdType >( arrays.connectivity, nCells > 0 ? grid->GetCells()->GetNumberOfConnectivityEntries() - nCells : 0, "connectivity", 1, VTK_ID_TYPE );
+	vtkIdType *offsetValues = this->Allocate< vtkIdType >( arrays.offsets, nCells, "offsets", 1, VTK_ID_TYPE );
+	const vtkIdType *cells = nCells > 0 ? grid->GetCells()->GetPointer() : 0;
+	const vtkIdType *locations = nCells > 0 ? grid->GetCellLocationsArray()->GetPointer( 0 ) : 0;
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(static)
+	for ( long i = 0; i < nCells; ++i ){
+		vtkIdType nCellPoints = cells[ locations[i] ];
+		vtkIdType start = locations[i] - i;
+		std::memcpy( connectivityValues + start, cells + locations[i] + 1, nCellPoints*sizeof(vtkIdType) );
+		offsetValues[i] = start + nCellPoints;
+	}
+}
+
+/** Copy the tuples ids of an array into a new array. */
+static void GatherTuples( const DataArrayType &array, const std::vector< vtkIdType > &ids, DataArrayType &gathered )
+{
+	gathered.name = array.name;
+	gathered.type = array.type;
+	gathered.nComponents = array.nComponents;
+	gathered.tupleBytes = array.tupleBytes;
+	gathered.data = 0;
+	gathered.ownedData.resize( ids.size()*array.tupleBytes );
+	gathered.nBytes = gathered.ownedData.size();
+	for ( std::size_t i = 0; i < ids.size(); ++i ){
+		std::memcpy( &gathered.ownedData[ i*array.tupleBytes ], array.GetData() + ids[i]*array.tupleBytes, array.tupleBytes );
+	}
+}
+
+/** Get the arrays of the piece of the grid made of the given cells, in
+ * ascending order, and the points they use.  Returns the number of 
+ * points of the piece. */
+vtkIdType GetPieceArrays( const GridArraysType &arrays, const std::vector< vtkIdType > &cells, GridArraysType &piece )
+{
+	const vtkIdType *connectivity = reinterpret_cast< const vtkIdType* >( arrays.connectivity.GetData() );
+	const vtkIdType *offsets = reinterpret_cast< const vtkIdType* >( arrays.offsets.GetData() );
+	
+	// the points of the piece in ascending order
+	std::vector< vtkIdType > points;
+	for ( std::size_t i = 0; i < cells.size(); ++i ){
+		vtkIdType start = cells[i] > 0 ? offsets[ cells[i] - 1 ] : 0;
+		points.insert( points.end(), connectivity + start, connectivity + offsets[ cells[i] ] );
+	}
+	std::sort( points.begin(), points.end() );
+	points.erase( std::unique( points.begin(), points.end() ), points.end() );
+	
+	vtkIdType nConnectivity = 0;
+	for ( std::size_t i = 0; i < cells.size(); ++i ){
+		nConnectivity = nConnectivity + offsets[ cells[i] ] - ( cells[i] > 0 ? offsets[ cells[i] - 1 ] : 0 );
+	}
+	vtkIdType *pieceConnectivity = this->Allocate< vtkIdType >( piece.connectivity, nConnectivity, "connectivity", 1, VTK_ID_TYPE );
+	vtkIdType *pieceOffsets = this->Allocate< vtkIdType >( piece.offsets, cells.size(), "offsets", 1, VTK_ID_TYPE );
+	vtkIdType position = 0;
+	for ( std::size_t i = 0; i < cells.size(); ++i ){
+		vtkIdType start = cells[i] > 0 ? offsets[ cells[i] - 1 ] : 0;
+		for ( vtkIdType n = start; n < offsets[ cells[i] ]; ++n ){
+			pieceConnectivity[ position++ ] = std::lower_bound( points.begin(), points.end(), connectivity[n] ) - points.begin();
+		}
+		pieceOffsets[i] = position;
+	}
+	
+	GatherTuples( arrays.points, points, piece.points );
+	GatherTuples( arrays.types, cells, piece.types );
+	piece.pointArrays.resize( arrays.pointArrays.size() );
+	for ( std::size_t i = 0; i < arrays.pointArrays.size(); ++i ) GatherTuples( arrays.pointArrays[i], points, piece.pointArrays[i] );
+	piece.cellArrays.resize( arrays.cellArrays.size() );
+	for ( std::size_t i = 0; i < arrays.cellArrays.size(); ++i ) GatherTuples( arrays.cellArrays[i], cells, piece.cellArrays[i] );
+	return points.size();
+}
+
+/** Write the arrays of a grid to a .vtu file. */
+bool WriteArrays( const std::string &fileName, vtkIdType nPoints, vtkIdType nCells, GridArraysType &arrays )
+{
+	// encode every array, then the header knows the offsets into the appended data
+	std::vector< DataArrayType* > encoded;
+	for ( std::size_t i = 0; i < arrays.pointArrays.size(); ++i ) encoded.push_back( &arrays.pointArrays[i] );
+	for ( std::size_t i = 0; i < arrays.cellArrays.size(); ++i ) encoded.push_back( &arrays.cellArrays[i] );
+	encoded.push_back( &arrays.points );
+	encoded.push_back( &arrays.connectivity );
+	encoded.push_back( &arrays.offsets );
+	encoded.push_back( &arrays.types );
+	this->Encode( encoded );
+	
+	std::ofstream output( fileName.c_str(), std::ios::out | std::ios::binary );
+	if ( !output ) return false;
+	
+	std::size_t offset = 0;
+	output << "<?xml version=\"1.0\"?>\n";
+	output << "<VTKFile type=\"UnstructuredGrid\" version=\"0.1\" byte_order=\""<<( IsLittleEndian() ? "LittleEndian" : "BigEndian" )<<"\"";
+	if ( m_CompressionLevel > 0 ) output << " compressor=\"vtkZLibDataCompressor\"";
+	output << ">\n";
+	output << "  <UnstructuredGrid>\n";
+	output << "    <Piece NumberOfPoints=\""<<nPoints<<"\" NumberOfCells=\""<<nCells<<"\">\n";
+	output << "      <PointData>\n";
+	for ( std::size_t i = 0; i < arrays.pointArrays.size(); ++i ) this->WriteArrayHeader( output, arrays.pointArrays[i], &offset );
+	output << "      </PointData>\n";
+	output << "      <CellData>\n";
+	for ( std::size_t i = 0; i < arrays.cellArrays.size(); ++i ) this->WriteArrayHeader( output, arrays.cellArrays[i], &offset );
+	output << "      </CellData>\n";
+	output << "      <Points>\n";
+	this->WriteArrayHeader( output, arrays.points, &offset );
+	output << "      </Points>\n";
+	output << "      <Cells>\n";
+	this->WriteArrayHeader( output, arrays.connectivity, &offset );
+	this->WriteArrayHeader( output, arrays.offsets, &offset );
+	this->WriteArrayHeader( output, arrays.types, &offset );
+	output << "      </Cells>\n";
+	output << "    </Piece>\n";
+	output << "  </UnstructuredGrid>\n";
+	output << "  <AppendedData encoding=\"raw\">\n   _";
+	
+	// the appended data follows in the order of the encoding
+	for ( std::size_t i = 0; i < encoded.size(); ++i ) this->WriteArrayData( output, *encoded[i] );
+	output << "\n  </AppendedData>\n";
+	output << "</VTKFile>\n";
+	return !output.fail();
+}
+
+/** Encode every array: a byte count and the raw data, or the block 
+ * header and the compressed blocks.  The blocks of all the arrays are
+ * compressed together in parallel. */
+void Encode( std::vector< DataArrayType* > &arrays )
+{
+	if ( m_CompressionLevel == 0 ){
+		for ( std::size_t a = 0; a < arrays.size(); ++a ){
+			HeaderType nBytes = arrays[a]->nBytes;
+			arrays[a]->encoded.resize( sizeof(HeaderType) + nBytes );
+			std::memcpy( &arrays[a]->encoded[0], &nBytes, sizeof(HeaderType) );
+			if ( nBytes > 0 ) std::memcpy( &arrays[a]->encoded[ sizeof(HeaderType) ], arrays[a]->GetData(), nBytes );
+		}
+		return;
+	}
+	
+	// list the blocks of every array
+	std::vector< std::size_t > firstBlock( arrays.size() + 1, 0 );
+	for ( std::size_t a = 0; a < arrays.size(); ++a ){
+		firstBlock[a+1] = firstBlock[a] + ( arrays[a]->nBytes + m_BlockSize - 1 )/m_BlockSize;
+	}
+	const long nBlocks = firstBlock.back();
+	std::vector< std::vector< char > > blocks( nBlocks );
+	
+	#pragma omp parallel for num_threads(m_NumberOfThreads) schedule(dynamic, 16)
+	for ( long b = 0; b < nBlocks; ++b ){
+		std::size_t a = std::upper_bound( firstBlock.begin(), firstBlock.end(), (std::size_t)b ) - firstBlock.begin() - 1;
+		std::size_t start = ( b - firstBlock[a] )*m_BlockSize;
+		std::size_t size = std::min( m_BlockSize, arrays[a]->nBytes - start );
+		uLongf compressedSize = compressBound( size );
+		blocks[b].resize( compressedSize );
+		compress2( reinterpret_cast< Bytef* >( &blocks[b][0] ), &compressedSize, reinterpret_cast< const Bytef* >( arrays[a]->GetData() + start ), size, m_CompressionLevel );
+		blocks[b].resize( compressedSize );
+	}
+	
+	for ( std::size_t a = 0; a < arrays.size(); ++a ){
+		std::size_t nArrayBlocks = firstBlock[a+1] - firstBlock[a];
+		std::vector< HeaderType > header( 3 + nArrayBlocks );
+		header[0] = nArrayBlocks;
+		header[1] = m_BlockSize;
+		header[2] = arrays[a]->nBytes % m_BlockSize;
+		std::size_t nBytes = header.size()*sizeof(HeaderType);
+		for ( std::size_t b = 0; b < nArrayBlocks; ++b ){
+			header[3+b] = blocks[ firstBlock[a] + b ].size();
+			nBytes = nBytes + header[3+b];
+		}
+		std::vector< char > &encoded = arrays[a]->encoded;
+		encoded.resize( nBytes );
+		std::memcpy( &encoded[0], &header[0], header.size()*sizeof(HeaderType) );
+		std::size_t position = header.size()*sizeof(HeaderType);
+		for ( std::size_t b = 0; b < nArrayBlocks; ++b ){
+			std::vector< char > &block = blocks[ firstBlock[a] + b ];
+			if ( !block.empty() ) std::memcpy( &encoded[position], &block[0], block.size() );
+			position = position + block.size();
+			std::vector< char >().swap( block ); // free the block as it is copied
+		}
+	}
+}
+
+/** Write the header of an appended array and move the offset past its
+ * data, or the header of a .pvtu array if offset is 0. */
+void WriteArrayHeader( std::ofstream &output, const DataArrayType &array, std::size_t *offset )
+{
+	output << ( offset ? "        <DataArray" : "      <PDataArray" ) << " type=\""<<array.type<<"\" Name=\""<<array.name<<"\"";
+	if ( array.nComponents > 1 ) output << " NumberOfComponents=\""<<array.nComponents<<"\"";
+	if ( offset ){
+		output << " format=\"appended\" offset=\""<<*offset<<"\"";
+		*offset = *offset + array.encoded.size();
+	}
+	output << "/>\n";
+}
+
+void WriteArrayData( std::ofstream &output, DataArrayType &array )
+{
+	if ( !array.encoded.empty() ) output.write( &array.encoded[0], array.encoded.size() );
+	std::vector< char >().swap( array.encoded );
+}
+
+int				m_CompressionLevel;
+std::size_t		m_BlockSize;
+unsigned int	m_NumberOfThreads;
+
+}; // end class VTUWriter
+
+#endif // VTUWRITER_H